@@ -11,7 +11,7 @@ namespace byml {
 struct ResHeader {
   /// “BY” (big endian) or “YB” (little endian).
   std::array<char, 2> magic;
-  /// Format version (2 or 3).
+  /// Format version (2 to 7). See NodeType for the nodes that were added in each version.
   u16 version;
   /// Offset to the hash key table, relative to start (usually 0x010)
   /// May be 0 if no hash nodes are used. Must be a string table node (0xc2).
@@ -25,11 +25,31 @@ struct ResHeader {
 };
 static_assert(sizeof(ResHeader) == 0x10);
 
+/// Node types.
+///
+/// Array (0xc0): u8 type, u24 count, u8 types[count] (padded to a multiple of 4), u32 values[count]
+/// Hash (0xc1): u8 type, u24 count, {u24 key index, u8 type, u32 value}[count], sorted by key
+///
+/// Newer versions add the following nodes:
+///
+/// Binary (0xa1, v4+): the value is an offset to {u32 size, u8 data[size]}.
+/// FileData (0xa2, v5+): the value is an offset to {u32 size, u32 alignment, u8 data[size]};
+///   the data is aligned to `alignment` bytes (a power of 2) in the file.
+/// Hash32 (0x20, v7): hash keyed by 32-bit integers (usually hashes of strings) instead of
+///   strings: u8 type, u24 count, {u32 key, u32 value}[count] sorted by key, u8 types[count]
+/// ValueHash32 (0x21, v7): same as Hash32, but each entry is {u32 value, u32 key}
+/// MonoTypedArray (0xc8, v7): array whose items all have the same type, which is only stored
+///   once: u8 type, u24 count, u8 item type, 3 padding bytes, u32 values[count]
 enum class NodeType : u8 {
+  Hash32 = 0x20,
+  ValueHash32 = 0x21,
   String = 0xa0,
+  Binary = 0xa1,
+  FileData = 0xa2,
   Array = 0xc0,
   Hash = 0xc1,
   StringTable = 0xc2,
+  MonoTypedArray = 0xc8,
   Bool = 0xd0,
   Int = 0xd1,
   Float = 0xd2,
@@ -40,10 +60,23 @@ enum class NodeType : u8 {
   Null = 0xff,
 };
 
+/// Returns whether a node is an array or a hash: the containers that all versions support and
+/// that the document model (byml::Document) and the text format can represent.
 constexpr bool isContainerType(NodeType type) {
   return type == NodeType::Array || type == NodeType::Hash;
 }
 
+/// Same as isContainerType, but also includes the container nodes added in version 7.
+constexpr bool isAnyContainerType(NodeType type) {
+  return isContainerType(type) || type == NodeType::Hash32 || type == NodeType::ValueHash32 ||
+         type == NodeType::MonoTypedArray;
+}
+
+/// Returns whether a node refers to binary data (Binary or FileData).
+constexpr bool isBinaryType(NodeType type) {
+  return type == NodeType::Binary || type == NodeType::FileData;
+}
+
 constexpr bool isValueType(NodeType type) {
   return type == NodeType::String || type == NodeType::Null ||
          (NodeType::Bool <= type && type <= NodeType::UInt);
@@ -3,46 +3,145 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
 #include <optional>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
 
 #include <byml/types.h>
 #include <byml/value.h>
 
 namespace byml {
 
-/// Non-owning buffer for binary data.
-class Buffer {
-public:
-  Buffer(const u8* data, size_t size) : mData{data}, mSize{size} {}
+namespace common {
+class ThreadPool;
+}
 
-  const u8* data() const { return mData; }
-  size_t size() const { return mSize; }
-  operator const u8*() const { return data(); }
+class KeyIndex;
 
-private:
-  const u8* mData;
-  size_t mSize;
+/// Options for loading several documents at once (see Reader::openFiles).
+struct LoadOptions {
+  /// Validate each document with isValid(). Documents that are malformed are not returned.
+  /// If false, checked access is enabled instead (see Reader::setCheckedAccess).
+  bool validate = true;
+  /// Build a key index for each document (see Reader::buildKeyIndex).
+  bool buildKeyIndex = false;
 };
 
+/// Input for Reader::loadMany: a file path or data that is already in memory.
+using LoadInput = std::variant<std::string, Buffer>;
+
 /// BYML reader.
 class Reader {
 public:
   Reader(Buffer buffer);
   ~Reader();
 
+  /// Open a BYML file. The file is memory-mapped (read-only) and the mapping is owned by the
+  /// reader and its copies, so the data stays valid for as long as the reader exists.
+  /// Yaz0-compressed files (.sbyml, .smubin) are decompressed transparently.
+  /// Returns nullopt if the file cannot be opened or decompressed.
+  static std::optional<Reader> openFile(const std::string& path);
+  /// Decompress Yaz0-compressed BYML data. The decompressed data is owned by the reader.
+  /// Returns nullopt if the data is not valid Yaz0.
+  static std::optional<Reader> fromCompressed(Buffer data);
+
+  /// Open several BYML files on a thread pool. Files are opened (and decompressed if needed)
+  /// and then prepared as specified by the options. If numThreads is 0, one thread is used
+  /// per hardware thread. Readers are returned in input order; an entry is nullopt if the file
+  /// could not be opened or if a step failed.
+  static std::vector<std::optional<Reader>> openFiles(const std::vector<std::string>& paths,
+                                                      unsigned numThreads = 0,
+                                                      const LoadOptions& options = {});
+  /// Same as openFiles, but for data that is already in memory. Yaz0-compressed buffers are
+  /// decompressed; other buffers are not copied and must outlive the readers.
+  static std::vector<std::optional<Reader>> fromBuffers(const std::vector<Buffer>& buffers,
+                                                        unsigned numThreads = 0,
+                                                        const LoadOptions& options = {});
+  /// Same as openFiles, but for a mix of paths and buffers, which are all loaded on the same
+  /// thread pool. Buffers are handled like in fromBuffers.
+  static std::vector<std::optional<Reader>> loadMany(const std::vector<LoadInput>& inputs,
+                                                     unsigned numThreads = 0,
+                                                     const LoadOptions& options = {});
+
   /// Returns whether the BYML is well-formed. This should be checked before doing anything else.
   bool isValid() const;
-  /// Returns whether the root node is an array.
+  /// Same as isValid(), but the string tables and containers are checked on several threads.
+  /// This is only worth it for large documents. If numThreads is 0, one thread is used
+  /// per hardware thread.
+  bool isValidParallel(unsigned numThreads = 0) const;
+  /// Same as isValidParallel, but on an existing thread pool (which must not be used by anything
+  /// else until this returns). Avoids starting threads for each document.
+  bool isValidParallel(common::ThreadPool& pool) const;
+  /// Enable or disable checked access. When enabled, each container is checked (but not its
+  /// children) the first time it is accessed through getArray() or getHash(), which return nullopt
+  /// for malformed containers. This makes it safe to read untrusted data without calling isValid()
+  /// first, at a cost proportional to the containers that are actually accessed.
+  /// The result of each check is cached.
+  void setCheckedAccess(bool enabled);
+  bool isCheckedAccessEnabled() const { return mCheckedAccess != nullptr; }
+
+  /// Returns whether the root node is an array (including monotyped arrays).
   bool isArray() const;
   /// Returns whether the root node is a hash (aka a dictionary or map).
   bool isHash() const;
+  /// Returns whether the root node is a hash with integer keys (Hash32 or ValueHash32).
+  bool isHash32() const;
 
   u16 getVersion() const;
 
+  /// Returns whether the document has a root node (i.e. whether it is not empty).
+  bool hasRoot() const { return mRootNodeOffset != 0; }
+  /// Get the root node, which can be any container. Returns nullopt if the document is empty
+  /// or if the root node is invalid.
+  std::optional<ItemData> getRoot() const;
   /// Get the root array node. Returns nullopt if root node does not have the correct type.
   std::optional<Array> getArray() const;
   /// Get the root hash node. Returns nullopt if root node does not have the correct type.
   std::optional<Hash> getHash() const;
+  /// Get the root Hash32 node. Returns nullopt if root node does not have the correct type.
+  std::optional<Hash32> getHash32() const;
+
+  /// Look up a key in the hash key table. The returned ID can be used for fast lookups
+  /// in any hash from this document. Returns nullopt if no hash in the document uses the key.
+  std::optional<KeyId> findKey(const char* key) const;
+  /// Look up a string in the string table. The returned index is the raw value of String nodes
+  /// that refer to the string. Returns nullopt if the document does not contain the string.
+  std::optional<u32> findString(const char* string) const;
+
+  /// Get the number of strings in the hash key table.
+  size_t getNumKeys() const;
+  /// Get a string from the hash key table (the index is KeyId::index).
+  /// Returns nullptr if the index is out of bounds or (with checked access) if the string
+  /// is malformed.
+  const char* getKey(u32 index) const;
+  /// Get the number of strings in the string table.
+  size_t getNumStrings() const;
+  /// Get a string from the string table (the index is the raw value of String nodes).
+  /// Returns nullptr if the index is out of bounds or (with checked access) if the string
+  /// is malformed.
+  const char* getString(u32 index) const;
+  /// Same as getKey, but the length of the string is returned as well.
+  /// This takes constant time if string lengths have been recorded (see buildStringLengths).
+  std::optional<std::string_view> getKeyView(u32 index) const;
+  /// Same as getString, but the length of the string is returned as well.
+  /// This takes constant time if string lengths have been recorded (see buildStringLengths).
+  std::optional<std::string_view> getStringView(u32 index) const;
+
+  /// Build an index over the hash key table so that findKey() and lookups by key string
+  /// (Hash::getByKey) resolve keys in constant time instead of binary searching strings.
+  /// This takes a single pass over the key table. The document must have been validated
+  /// (or checked access must be enabled). Returns false if the key table is malformed.
+  bool buildKeyIndex();
+  bool hasKeyIndex() const { return mKeyIndex != nullptr; }
+  /// Check the hash key table and the string table and record the length of every string,
+  /// so that getKeyView(), getStringView() and ItemData::getStringView() do not need to look
+  /// for terminators. This takes a single pass over each table and can be called on documents
+  /// that have not been validated. Returns false if a table is malformed.
+  bool buildStringLengths();
+  bool hasStringLengths() const { return mStringLengths != nullptr; }
 
   Buffer getBuffer() const { return mBuffer; }
   bool isBigEndian() const { return mBigEndian; }
@@ -50,12 +149,32 @@ public:
   u32 getStringTableOffset() const { return mStringTableOffset; }
 
 private:
+  friend struct ItemData;
+  struct CheckedAccessState;
+  struct StringLengths;
+
+  Reader(Buffer buffer, std::shared_ptr<const void> storage);
+  /// If checked access is enabled, check a container before it is accessed.
+  /// Always returns true otherwise.
+  bool checkContainerOnAccess(u32 offset, NodeType type) const;
+  /// Get the number of strings in a string table (the hash key table or the string table).
+  u32 getStringTableSize(u32 tableOffset) const;
+  const char* getStringFromTable(u32 tableOffset, u32 index) const;
+  std::optional<std::string_view> getStringViewFromTable(u32 tableOffset, u32 index) const;
+  /// Binary search a sorted string table.
+  std::optional<u32> findInStringTable(u32 tableOffset, const char* string) const;
+
   Buffer mBuffer;
+  /// Keeps the data alive if it is owned by the reader (e.g. for memory-mapped files).
+  std::shared_ptr<const void> mStorage;
 
   u32 mHashKeyTableOffset = 0;
   u32 mStringTableOffset = 0;
   u32 mRootNodeOffset = 0;
   bool mHasValidHeader = false;
+  std::shared_ptr<CheckedAccessState> mCheckedAccess;
+  std::shared_ptr<const KeyIndex> mKeyIndex;
+  std::shared_ptr<const StringLengths> mStringLengths;
 
   bool mBigEndian = false;
 };
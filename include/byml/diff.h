@@ -0,0 +1,104 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <byml/types.h>
+#include <byml/value.h>
+
+namespace byml {
+
+class FingerprintTable;
+class Reader;
+
+/// An element of a path from the root of a document to a node.
+struct PathElement {
+  enum class Type : u8 {
+    /// Item of a hash: `key` is the key of the item.
+    Key,
+    /// Item of an array: `index` is the index of the item.
+    Index,
+    /// Item of a Hash32 node: `index` is the key of the item.
+    Hash32Key,
+  };
+
+  static PathElement makeKey(std::string_view key) { return {Type::Key, key, 0}; }
+  static PathElement makeIndex(u32 index) { return {Type::Index, {}, index}; }
+  static PathElement makeHash32Key(u32 key) { return {Type::Hash32Key, {}, key}; }
+
+  bool operator==(const PathElement& other) const {
+    return type == other.type && key == other.key && index == other.index;
+  }
+  bool operator!=(const PathElement& other) const { return !(*this == other); }
+
+  Type type;
+  /// Not owned. For paths that are produced by this library, this points into a document.
+  std::string_view key;
+  u32 index;
+};
+
+using Path = std::vector<PathElement>;
+
+/// Format a path with the query syntax (e.g. `Objs[3].Translate`; see byml::Query).
+/// Hash32 keys, which the query syntax does not support, are written as `<0x1234abcd>`.
+std::string formatPath(const Path& path);
+
+struct DiffEntry {
+  enum class Op : u8 {
+    /// `to` was added at `path`.
+    Add,
+    /// `from` was removed from `path`.
+    Remove,
+    /// The node at `path` was changed from `from` to `to`.
+    Change,
+  };
+
+  Op op;
+  Path path;
+  /// Node in the old document (for Remove and Change).
+  std::optional<ItemData> from;
+  /// Node in the new document (for Add and Change).
+  std::optional<ItemData> to;
+};
+
+/// Options for diff.
+struct DiffOptions {
+  /// Container fingerprints of the old and the new document (see FingerprintTable).
+  /// If both are set, containers with equal fingerprints are skipped without being walked,
+  /// so that the cost of comparing two versions of a document depends on the size of the
+  /// changes rather than on the size of the documents.
+  const FingerprintTable* fromFingerprints = nullptr;
+  const FingerprintTable* toFingerprints = nullptr;
+};
+
+/// Compute the differences between two documents as an edit script.
+///
+/// Both trees are walked together. Hashes are merge-joined by key in linear time (items are
+/// sorted by key in both documents); Hash32 nodes are merge-joined by integer key. Arrays are
+/// compared item by item: items past the end of the shorter array are added or removed.
+/// Containers of the same kind are compared recursively, so a change is reported at the
+/// deepest path at which the documents differ; a node whose type changes (including a container
+/// that becomes a container of another kind) is reported as a single change.
+///
+/// Values are compared by content and are independent of the layout and byte order of each
+/// document: strings are compared by their characters rather than by string table index,
+/// 64-bit values and binary data are compared by value, and floats are compared bitwise.
+/// Monotyped arrays compare equal to regular arrays with the same items. A subtree that is
+/// the same node in both documents (when comparing a document with itself, or two subtrees of
+/// the same document) is skipped without being walked, and a pair of containers that is
+/// reached through several parents is only walked again if it differs. With fingerprints (see
+/// DiffOptions), any pair of equal containers is skipped.
+///
+/// Entries are produced in document order. The documents must have been validated (or checked
+/// access must be enabled). Returns nullopt if an invalid node is encountered.
+std::optional<std::vector<DiffEntry>> diff(const Reader& from, const Reader& to,
+                                           const DiffOptions& options = {});
+/// Same as diff, for two nodes (usually containers). Paths are relative to the nodes.
+std::optional<std::vector<DiffEntry>> diff(const ItemData& from, const ItemData& to,
+                                           const DiffOptions& options = {});
+
+}  // namespace byml
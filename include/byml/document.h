@@ -0,0 +1,176 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include <byml/binary_format.h>
+#include <byml/types.h>
+
+namespace byml {
+
+class Reader;
+struct HashEntry;
+
+/// Node of a mutable document.
+///
+/// Nodes are 16 bytes. Values are stored inline; strings and container items are stored
+/// in memory that is owned by the document. Container items are contiguous: arrays store
+/// their nodes and hashes store their entries sorted by key.
+///
+/// Copying a container node does not copy its items (use Document::clone for that).
+///
+/// Item arrays can be shared by several container nodes (see Document::fromReader). Shared items
+/// are copied before they are modified: the non-const accessors below and the Document
+/// functions that modify a container give it its own copy of the items first.
+class Node {
+public:
+  /// Create a null node.
+  Node() : Node{NodeType::Null} {}
+
+  static Node makeNull() { return {}; }
+  static Node makeBool(bool value) { return {NodeType::Bool, static_cast<u32>(value)}; }
+  static Node makeInt(s32 value) { return {NodeType::Int, static_cast<u32>(value)}; }
+  static Node makeUInt(u32 value) { return {NodeType::UInt, value}; }
+  static Node makeFloat(f32 value);
+  static Node makeInt64(s64 value) { return {NodeType::Int64, static_cast<u64>(value)}; }
+  static Node makeUInt64(u64 value) { return {NodeType::UInt64, value}; }
+  static Node makeDouble(f64 value);
+  /// Create an empty array.
+  static Node makeArray() { return Node{NodeType::Array}; }
+  /// Create an empty hash.
+  static Node makeHash() { return Node{NodeType::Hash}; }
+
+  NodeType getType() const { return mType; }
+  bool isNull() const { return mType == NodeType::Null; }
+  bool isArray() const { return mType == NodeType::Array; }
+  bool isHash() const { return mType == NodeType::Hash; }
+
+  // Value getters. Conversions work exactly like the ItemData ones.
+
+  std::optional<bool> getBool() const;
+  std::optional<s32> getInt() const;
+  std::optional<u32> getUInt() const;
+  std::optional<f32> getFloat() const;
+  std::optional<s64> getInt64() const;
+  std::optional<u64> getUInt64() const;
+  std::optional<f64> getDouble() const;
+  /// Returns nullptr if the node is not a string. Strings are always null terminated.
+  const char* getString() const { return mType == NodeType::String ? mValue.string : nullptr; }
+  std::optional<std::string_view> getStringView() const;
+
+  /// Get the number of items (for containers). Returns 0 for other nodes.
+  size_t numItems() const { return isContainerType(mType) ? mSize : 0; }
+
+  /// Array items. Returns nullptr if the node is not an array.
+  Node* getArrayItems();
+  const Node* getArrayItems() const { return isArray() ? mValue.items : nullptr; }
+  /// Hash entries (sorted by key). Returns nullptr if the node is not a hash.
+  HashEntry* getHashEntries();
+  const HashEntry* getHashEntries() const { return isHash() ? mValue.entries : nullptr; }
+
+  /// Get an array item. Returns nullptr if the node is not an array or if the index is invalid.
+  Node* getByIndex(size_t idx);
+  const Node* getByIndex(size_t idx) const;
+  /// Look up a hash item. Returns nullptr if the node is not a hash or if the key does not exist.
+  Node* getByKey(std::string_view key);
+  const Node* getByKey(std::string_view key) const;
+
+private:
+  friend class Document;
+
+  Node(NodeType type) : mType{type} { mValue.u64Value = 0; }
+  Node(NodeType type, u32 value) : Node{type} { mValue.u32Value = value; }
+  Node(NodeType type, u64 value) : Node{type} { mValue.u64Value = value; }
+
+  /// Give a container node its own copy of its items if they are shared.
+  void detach();
+
+  NodeType mType = NodeType::Null;
+  /// Number of items (for containers) or length (for strings).
+  u32 mSize = 0;
+  union {
+    u32 u32Value;
+    u64 u64Value;
+    const char* string;
+    Node* items;
+    HashEntry* entries;
+  } mValue;
+};
+static_assert(sizeof(Node) == 16);
+
+struct HashEntry {
+  /// Null terminated key.
+  const char* key;
+  u32 keyLength;
+  Node value;
+
+  std::string_view getKey() const { return {key, keyLength}; }
+};
+
+/// Mutable BYML document.
+///
+/// All strings and container items are allocated from an arena that belongs to the document,
+/// so destroying a document only frees a few large blocks regardless of the number of nodes.
+/// Memory that is no longer used (e.g. after an array grows or an item is removed) is only
+/// reclaimed when the document is destroyed.
+///
+/// Documents that are created from a reader refer to the strings in the reader's buffer
+/// (strings are only copied when they are modified), so the buffer must outlive the document.
+/// The document keeps a copy of the reader, so memory-mapped files stay alive.
+class Document {
+public:
+  Document();
+  ~Document();
+  Document(Document&&) noexcept;
+  Document& operator=(Document&&) noexcept;
+
+  /// Convert a document. The reader must have been validated (or checked access
+  /// must be enabled). Monotyped arrays become regular arrays. Returns nullopt if a node is not
+  /// valid or cannot be represented (binary data and Hash32 nodes).
+  ///
+  /// Containers that are referenced by several parents in the source document (for example
+  /// in documents that were written by byml::Writer, which deduplicates identical containers)
+  /// are only converted once, and the resulting nodes share their items until one of them is
+  /// modified, so the conversion takes time proportional to the size of the source document.
+  static std::optional<Document> fromReader(const Reader& reader);
+
+  /// Root node. This is a null node for empty documents.
+  Node& getRoot() { return mRoot; }
+  const Node& getRoot() const { return mRoot; }
+
+  /// Create a string node. The string is copied into the document.
+  /// Returns a null node if the string contains null characters.
+  Node makeString(std::string_view value);
+  /// Deep copy a node (from this document or another one) into this document.
+  /// Shared items are only copied once and are shared in the copy as well.
+  Node clone(const Node& node);
+
+  /// Reserve space for items in a container.
+  void reserve(Node& container, size_t numItems);
+  /// Append an item to an array. Returns a pointer to the new item (which stays valid until
+  /// the array is modified), or nullptr if the node is not an array or is full.
+  Node* append(Node& array, const Node& value);
+  /// Insert an item in a hash, or replace it if an item with the same key already exists.
+  /// Returns a pointer to the item (which stays valid until the hash is modified), or nullptr
+  /// if the node is not a hash, is full or if the key contains null characters.
+  Node* set(Node& hash, std::string_view key, const Node& value);
+  /// Remove an array item. Returns false if the node is not an array or the index is invalid.
+  bool removeAt(Node& array, size_t idx);
+  /// Remove a hash item. Returns false if the node is not a hash or the key does not exist.
+  bool removeKey(Node& hash, std::string_view key);
+
+  /// Serialize the document. Returns nullopt if it cannot be represented in the specified version
+  /// (64-bit nodes in version 2) or if the root node is not a container or null.
+  std::optional<std::vector<u8>> write(u16 version, bool bigEndian) const;
+
+private:
+  struct Storage;
+  std::unique_ptr<Storage> mStorage;
+  Node mRoot;
+};
+
+}  // namespace byml
@@ -0,0 +1,62 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include <byml/types.h>
+#include <byml/value.h>
+
+namespace byml {
+
+class Reader;
+
+/// 128-bit content hash of a node.
+struct Fingerprint {
+  bool operator==(const Fingerprint& other) const { return low == other.low && high == other.high; }
+  bool operator!=(const Fingerprint& other) const { return !(*this == other); }
+
+  u64 low;
+  u64 high;
+};
+
+/// Content fingerprints of the containers of a document (Merkle hashes).
+///
+/// The fingerprint of a container is computed from the fingerprints of its items, and those of
+/// values from their content: strings and keys are hashed by their characters, 64-bit values and
+/// binary data by value and floats bitwise. Fingerprints therefore only depend on the logical
+/// content of a node: they are independent of the byte order, the version, the layout of the
+/// document and the order of the string tables, so equal subtrees of two documents (or of the
+/// same document) have equal fingerprints. Monotyped arrays have the same fingerprint as regular
+/// arrays with the same items, like in byml::diff. Fingerprints are stable across platforms and
+/// versions of this library, so they can be stored. They are not cryptographic hashes.
+///
+/// The table only stores one offset and one fingerprint per container (20 bytes), sorted by offset.
+class FingerprintTable {
+public:
+  /// Compute the fingerprints of all containers of a document in a single bottom-up pass.
+  /// Containers that are shared by several parents are only hashed once, and the hash of each
+  /// string and key is only computed once. The document must have been validated (or checked
+  /// access must be enabled). Returns nullopt if an invalid node is encountered.
+  static std::optional<FingerprintTable> build(const Reader& reader);
+
+  /// Number of containers in the table.
+  size_t size() const { return mOffsets.size(); }
+
+  /// Fingerprint of the root node. Returns nullopt if the document is empty.
+  std::optional<Fingerprint> getRoot() const { return mRoot; }
+  /// Fingerprint of the container at an offset. This is a binary search.
+  /// Returns nullopt if there is no container at the offset.
+  std::optional<Fingerprint> get(u32 offset) const;
+  /// Fingerprint of any node of the document: containers are looked up and values are hashed.
+  /// Returns nullopt if the node is invalid or is a container that is not in the table.
+  std::optional<Fingerprint> get(const ItemData& item) const;
+
+private:
+  std::optional<Fingerprint> mRoot;
+  std::vector<u32> mOffsets;
+  std::vector<Fingerprint> mFingerprints;
+};
+
+}  // namespace byml
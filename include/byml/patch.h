@@ -0,0 +1,53 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include <byml/diff.h>
+#include <byml/document.h>
+#include <byml/types.h>
+
+namespace byml {
+
+class Reader;
+
+/// Edit of a binary patch (see applyPatch).
+struct PatchEdit {
+  enum class Op : u8 {
+    /// Set the item at `path` to `value`. Hash and Hash32 items are added if the key does not
+    /// exist; array items must exist. An empty path replaces the root node.
+    Set,
+    /// Remove the item at `path` (a hash key, a Hash32 key or an array index).
+    Remove,
+    /// Append `value` to the array at `path`.
+    Append,
+  };
+
+  Op op;
+  Path path;
+  /// New value (for Set and Append). Containers are copied recursively.
+  Node value;
+};
+
+/// Apply edits to a document and serialize the result, without converting the document.
+///
+/// Edits are applied in order, so paths refer to the document as modified by the previous edits.
+/// Only the containers on the path of an edit are rewritten; they are appended to a copy of the
+/// source data and the rest of the document is copied as is (in a single block). The string table
+/// and the hash key table are only rebuilt if an edit adds a string or a key that the source
+/// document does not use, in which case the copied nodes are relocated in a single pass over the
+/// nodes that are still referenced. Strings are never removed from the tables, and replaced
+/// containers are left in place without being referenced: Writer::write can be used to compact
+/// a document that has been patched many times.
+///
+/// The version and the byte order of the source document are kept. Rewritten monotyped arrays
+/// become regular arrays. The source document must have been validated (or checked access must
+/// be enabled). Returns nullopt if a path is invalid, if a value cannot be represented in the
+/// source version (64-bit nodes in version 2) or if an invalid node is encountered.
+/// The values must stay alive until this function returns.
+std::optional<std::vector<u8>> applyPatch(const Reader& source,
+                                          const std::vector<PatchEdit>& edits);
+
+}  // namespace byml
@@ -0,0 +1,79 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <byml/types.h>
+#include <byml/value.h>
+
+namespace byml {
+
+class Reader;
+
+/// A compiled path query.
+///
+/// The syntax is similar to JSONPath (the leading `$` is optional):
+///
+///   Objs[*].UnitConfigName          key lookups; `*` and `[*]` select all items of a container
+///   Rails[0].RailPoints[1:-1]       array indices and slices ([start:stop:step]); negative
+///                                   indices count from the end of the array
+///   ["Key with spaces"]             quoted keys
+///   ..Translate                     recursive descent: `Translate` in any hash at any depth
+///   Objs[?UnitConfigName == "Foo"]  filters, which select the items of a container for which
+///                                   the condition is true
+///
+/// Filter conditions are relative paths (a bare key such as `Translate.X`, or `@` for the item
+/// itself) that are either tested for existence or compared to a literal with ==, !=, <, <=,
+/// > or >=. Literals are strings ("..." or '...'), numbers, true, false and null.
+/// Conditions can be combined with &&, || and ! and grouped with parentheses. A comparison
+/// is true if any node that the path selects satisfies it; `a != b` is the same as `!(a == b)`
+/// for each node. Numbers compare by value regardless of their node type.
+///
+/// Compiling a query parses it once. Keys and string literals are then resolved to key and
+/// string table indices once per document, so that lookups and comparisons do not need to
+/// compare strings, and documents that do not contain a key of the query are skipped without
+/// being traversed. Matches are streamed; no intermediate containers are built.
+///
+/// Queries are immutable and can be shared between threads.
+class Query {
+public:
+  /// Compile a query. Returns nullopt (and logs an error) if the expression is invalid.
+  static std::optional<Query> compile(std::string_view expression);
+
+  /// Called for each match in document order. Returning false stops the query.
+  using Callback = std::function<bool(const ItemData& item)>;
+
+  /// Run the query on the root node of a document. The document must have been validated
+  /// (or checked access must be enabled). Returns the number of matches that were passed to fn.
+  size_t forEach(const Reader& reader, const Callback& fn) const;
+  /// Run the query on a node (usually a container).
+  size_t forEach(const ItemData& root, const Callback& fn) const;
+
+  std::vector<ItemData> findAll(const Reader& reader) const;
+  std::vector<ItemData> findAll(const ItemData& root) const;
+  std::optional<ItemData> findFirst(const Reader& reader) const;
+  std::optional<ItemData> findFirst(const ItemData& root) const;
+  size_t count(const Reader& reader) const;
+  size_t count(const ItemData& root) const;
+
+  /// Returns false if the query cannot match anything in the document because a key
+  /// of the query is missing from the hash key table. This does not traverse the document.
+  bool mayMatch(const Reader& reader) const;
+
+  const std::string& getExpression() const;
+
+  struct Plan;
+
+private:
+  explicit Query(std::shared_ptr<const Plan> plan);
+
+  std::shared_ptr<const Plan> mPlan;
+};
+
+}  // namespace byml
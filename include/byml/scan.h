@@ -0,0 +1,107 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+#pragma once
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <byml/byml.h>
+#include <byml/types.h>
+
+namespace byml {
+
+struct ScanOptions {
+  /// Number of worker threads. If 0, one thread is used per hardware thread.
+  unsigned numThreads = 0;
+  /// Validate each document with isValid() before visiting it. If disabled, checked access is
+  /// enabled instead so that malformed documents cannot crash visitors.
+  bool validate = true;
+  /// File extensions (including the dot) of the files to scan in a directory tree.
+  /// If empty, all files are scanned.
+  std::vector<std::string> extensions = {".byml",  ".sbyml", ".byaml",   ".sbyaml",
+                                         ".mubin", ".smubin", ".bgdata", ".sbgdata"};
+};
+
+enum class ScanStatus {
+  /// The document was loaded and visited successfully.
+  Ok,
+  /// The file could not be opened or decompressed.
+  OpenFailed,
+  /// The file is not a valid BYML document.
+  Invalid,
+  /// The visitor reported a failure.
+  VisitFailed,
+};
+
+struct ScanFileReport {
+  std::string path;
+  ScanStatus status = ScanStatus::Ok;
+  /// Size of the file in bytes.
+  u64 size = 0;
+  /// Time spent opening, validating and visiting the document.
+  double seconds = 0;
+};
+
+struct ScanReport {
+  /// One entry per scanned file, sorted by path.
+  std::vector<ScanFileReport> files;
+  /// Wall-clock duration of the scan.
+  double seconds = 0;
+
+  size_t numFailed() const;
+  u64 totalSize() const;
+  /// Throughput in bytes per second.
+  double throughput() const { return seconds > 0 ? totalSize() / seconds : 0; }
+};
+
+/// Called for each document that was loaded successfully. `index` is the index of the file
+/// in ScanReport::files, which allows results to be stored without any synchronization and
+/// merged in a deterministic order. Visitors are called concurrently from worker threads.
+/// Returning false marks the file as failed (ScanStatus::VisitFailed).
+using ScanVisitor = std::function<bool(size_t index, const Reader& reader)>;
+
+/// List the files in a directory tree that match the extensions in `options`, sorted by path.
+/// Unreadable directories are skipped.
+std::vector<std::string> findFiles(const std::string& root, const ScanOptions& options = {});
+
+/// Open, validate and visit files on a thread pool (with work stealing). Larger files are
+/// scheduled first to reduce the time spent waiting for stragglers. Files that cannot be
+/// loaded are reported in the ScanReport rather than aborting the scan.
+ScanReport scanFiles(std::vector<std::string> paths, const ScanVisitor& visitor,
+                     const ScanOptions& options = {});
+
+/// Same as scanFiles for all matching files in a directory tree.
+ScanReport scanDirectory(const std::string& root, const ScanVisitor& visitor,
+                         const ScanOptions& options = {});
+
+/// Run `fn` (const Reader& -> std::optional<T>) on every document in a directory tree and
+/// collect the results in path order. Files for which `fn` returns nullopt are skipped.
+template <typename Fn>
+auto collectDirectory(const std::string& root, Fn fn, const ScanOptions& options = {},
+                      ScanReport* report = nullptr) {
+  using T = typename std::invoke_result_t<Fn, const Reader&>::value_type;
+  std::vector<std::string> paths = findFiles(root, options);
+  std::vector<std::optional<T>> results(paths.size());
+  ScanReport scanReport = scanFiles(
+      paths,
+      [&](size_t index, const Reader& reader) {
+        results[index] = fn(reader);
+        return true;
+      },
+      options);
+
+  std::vector<std::pair<std::string, T>> collected;
+  for (size_t i = 0; i < results.size(); ++i) {
+    if (results[i])
+      collected.emplace_back(scanReport.files[i].path, std::move(*results[i]));
+  }
+  if (report)
+    *report = std::move(scanReport);
+  return collected;
+}
+
+}  // namespace byml
@@ -0,0 +1,108 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <byml/scan.h>
+#include <byml/types.h>
+
+namespace byml {
+
+/// Inverted index of the strings (hash keys and string values) used by a corpus of documents.
+///
+/// The index is stored in a single file that is memory-mapped and used in place: opening it does
+/// not parse or copy anything, and a lookup is a binary search over the sorted strings followed
+/// by a read of the list of files that use the string.
+///
+/// File format (all values are little endian; offsets are relative to the start of the file):
+///
+///   Header        magic "BYMLSIDX", version, number of files and strings, table offsets
+///   File table    {path offset, size, modification time, flags} per file, sorted by path
+///   String table  {string offset, string length, postings offset, number of postings}
+///                 per string, sorted by string (byte-wise)
+///   Postings      u32 per (string, file) pair: file index << 2 | usage flags
+///   String data   null-terminated file paths and strings
+class StringIndex {
+public:
+  /// A file that uses a string.
+  struct Hit {
+    /// Index of the file in the file table.
+    u32 file;
+    /// Whether the string is used as a hash key.
+    bool isKey;
+    /// Whether the string is used as a string value.
+    bool isValue;
+  };
+
+  struct FileInfo {
+    std::string_view path;
+    u64 size;
+    /// Last modification time (in nanoseconds, relative to the file clock's epoch).
+    s64 modificationTime;
+    /// Whether the file could not be loaded (or its string tables could not be read)
+    /// when it was indexed. No strings are indexed for failed files.
+    bool failed;
+  };
+
+  /// Open an index. Returns nullopt if the file cannot be opened or is not a valid index.
+  static std::optional<StringIndex> open(const std::string& path);
+
+  size_t numFiles() const { return mNumFiles; }
+  size_t numStrings() const { return mNumStrings; }
+
+  /// Get information about a file. The index must be less than numFiles().
+  FileInfo getFile(u32 index) const;
+  /// Get an indexed string. The index must be less than numStrings().
+  std::string_view getString(u32 index) const;
+
+  /// Get the files that use a string, in file table order (i.e. sorted by path).
+  /// Returns an empty vector if no file uses the string.
+  std::vector<Hit> find(std::string_view string) const;
+  /// Same as find, for the string at an index in the string table.
+  std::vector<Hit> getHits(u32 index) const;
+  /// Get the indexed strings that start with a prefix, in sorted order.
+  /// At most `limit` strings are returned.
+  std::vector<std::string_view> findPrefix(std::string_view prefix, size_t limit = -1) const;
+
+private:
+  StringIndex() = default;
+  /// Get the index of the first string that is not less than `string`.
+  u32 lowerBound(std::string_view string) const;
+
+  /// Keeps the mapping alive.
+  std::shared_ptr<const void> mStorage;
+  const u8* mData = nullptr;
+  size_t mSize = 0;
+  u32 mNumFiles = 0;
+  u32 mNumStrings = 0;
+  u64 mFileTableOffset = 0;
+  u64 mStringTableOffset = 0;
+};
+
+struct StringIndexUpdateStats {
+  /// Number of files that were (re)scanned.
+  size_t numScanned = 0;
+  /// Number of files whose entries were reused from the previous index.
+  size_t numReused = 0;
+  /// Number of files that were in the previous index but no longer exist.
+  size_t numRemoved = 0;
+  /// Report for the files that were scanned.
+  ScanReport report;
+};
+
+/// Build or update an index for all matching files in the given directory trees (or files).
+/// If the index file already exists and is valid, only files that were added or modified
+/// (according to their size and modification time) since it was built are scanned; entries for
+/// other files are carried over. The new index is written to a temporary file that then
+/// replaces the index file, so readers that have the previous index open are not affected.
+/// Files that cannot be loaded are recorded as failed so that they are not scanned again
+/// until they change. Returns false if the index cannot be written.
+bool updateStringIndex(const std::string& indexPath, const std::vector<std::string>& roots,
+                       const ScanOptions& options = {}, StringIndexUpdateStats* stats = nullptr);
+
+}  // namespace byml
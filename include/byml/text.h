@@ -0,0 +1,59 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <byml/types.h>
+
+namespace byml {
+
+class Reader;
+
+enum class TextFormat {
+  /// YAML (block style). Node types that have no default YAML representation are tagged:
+  /// !u (UInt, in hex), !l (Int64), !ul (UInt64) and !f64 (Double).
+  Yaml,
+  /// JSON (indented). Numeric node types are not preserved.
+  /// Non-finite floats are written as NaN, Infinity and -Infinity like Python's json module.
+  Json,
+};
+
+/// Convert a document to text. The document must have been validated (or checked access
+/// must be enabled). Monotyped arrays are written as regular arrays. Returns nullopt if
+/// an invalid node or a node that has no text representation (binary data and Hash32 nodes)
+/// is encountered.
+std::optional<std::string> toText(const Reader& reader, TextFormat format);
+
+/// Same as toText, but the text is written to a file descriptor as it is generated.
+/// Returns false if an invalid node is encountered or if writing fails.
+bool writeText(const Reader& reader, TextFormat format, int fd);
+
+/// Convert YAML or JSON text to a BYML document. Nodes are written as they are parsed;
+/// no intermediate tree is built.
+///
+/// The accepted syntax is the subset of YAML that toText produces (and that JSON uses):
+/// block and flow collections, plain, single-quoted and double-quoted scalars, comments,
+/// and the !u, !l, !ul, !f64 and !!str tags. Anchors, aliases, explicit keys ("? "),
+/// block scalars and multi-line plain scalars outside of flow collections are not supported.
+///
+/// The root node must be a mapping or a sequence. A null root (e.g. "null" or "~", which toText
+/// emits for empty documents) or empty text produces a document without a root node;
+/// other scalar roots are rejected.
+///
+/// Untagged integers are stored as Int if they fit, and as UInt, Int64 or UInt64 otherwise.
+/// Untagged floats (including exponent forms such as 1e5, as in JSON and YAML 1.2)
+/// are stored as Float.
+///
+/// Returns nullopt if the text is invalid or cannot be represented with the given version.
+std::optional<std::vector<u8>> fromText(std::string_view text, u16 version = 2,
+                                        bool bigEndian = false);
+
+/// Same as fromText, but the text is read from a file (which is mapped into memory).
+std::optional<std::vector<u8>> fromTextFile(const std::string& path, u16 version = 2,
+                                            bool bigEndian = false);
+
+}  // namespace byml
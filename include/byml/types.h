@@ -23,4 +23,18 @@ using size_t = std::size_t;
 using f32 = float;
 using f64 = double;
 
+/// Non-owning buffer for binary data.
+class Buffer {
+public:
+  Buffer(const u8* data, size_t size) : mData{data}, mSize{size} {}
+
+  const u8* data() const { return mData; }
+  size_t size() const { return mSize; }
+  operator const u8*() const { return data(); }
+
+private:
+  const u8* mData;
+  size_t mSize;
+};
+
 }  // namespace byml
@@ -2,10 +2,16 @@
 // Licensed under GPLv2+
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <iterator>
 #include <optional>
 #include <range/v3/core.hpp>
 #include <range/v3/view/transform.hpp>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 #include <variant>
 
 #include <byml/binary_format.h>
@@ -20,6 +26,10 @@ public:
   ContainerBase(const Reader& reader, u32 offset);
   /// Get the number of items in the container.
   size_t numItems() const { return mNumItems; }
+  /// Get the offset of the container node in the document.
+  u32 getOffset() const { return mOffset; }
+  /// Get the reader for the document that contains this container.
+  const Reader& getReader() const { return mReader; }
 
 protected:
   const Reader& mReader;
@@ -59,6 +69,7 @@ private:
 
 class Array;
 class Hash;
+class Hash32;
 
 struct RawItemData {
   /// Raw node data. Already byteswapped if necessary.
@@ -75,38 +86,223 @@ struct ItemData {
   const RawItemData raw;
 
   std::optional<Hash> getHash() const;
+  /// Also returns monotyped arrays (v7+).
   std::optional<Array> getArray() const;
+  /// Get a Hash32 or ValueHash32 node (v7+).
+  std::optional<Hash32> getHash32() const;
   const char* getString() const;
-  std::optional<bool> getBool() const;
-  std::optional<s32> getInt() const;
-  std::optional<u32> getUInt() const;
-  std::optional<f32> getFloat() const;
+  /// Same as getString, but the length of the string is returned as well
+  /// (in constant time if Reader::buildStringLengths has been called).
+  std::optional<std::string_view> getStringView() const;
   std::optional<s64> getInt64() const;
   std::optional<u64> getUInt64() const;
   std::optional<f64> getDouble() const;
+  /// Get the data of a Binary (v4+) or FileData (v5+) node. The returned buffer points into
+  /// the document; no data is copied.
+  std::optional<Buffer> getBinary() const;
+  /// Get the alignment of the data of a FileData node, or 1 for a Binary node.
+  std::optional<u32> getBinaryAlignment() const;
+
+  // These do not need to read from the document, so they are defined here to allow inlining.
+
+  std::optional<bool> getBool() const {
+    if (raw.type != NodeType::Bool)
+      return {};
+    return raw != 0;
+  }
+
+  std::optional<s32> getInt() const {
+    if (raw.type != NodeType::Int)
+      return {};
+    return static_cast<s32>(raw);
+  }
+
+  std::optional<u32> getUInt() const {
+    switch (raw.type) {
+    case NodeType::Int:
+      return static_cast<s32>(raw) >= 0 ? raw : std::optional<u32>{};
+    case NodeType::UInt:
+      return raw;
+    default:
+      return {};
+    }
+  }
+
+  std::optional<f32> getFloat() const {
+    if (raw.type != NodeType::Float)
+      return {};
+    float value;
+    std::memcpy(&value, &raw.raw, sizeof(value));
+    return value;
+  }
 
   using Variant = std::variant<Hash, Array, const char*, bool, s32, u32, f32, s64, u64, f64>;
   /// Get the value as a variant. This is more convenient in some cases but less efficient.
+  /// Binary data, Hash32 and Null nodes are not supported: use getBinary(), getHash32() and
+  /// raw.type instead. Unsupported and invalid nodes (the latter are only possible if checked
+  /// access is enabled) are returned as the integer 0x0badbadbadbadbad; use tryVal to detect them.
   Variant val() const;
+  /// Same as val(), but returns nullopt if the node is not supported or invalid.
+  std::optional<Variant> tryVal() const;
+};
+
+/// Read-only view of the values of an array whose items all have the node type that corresponds
+/// to T: s32 (Int), u32 (UInt), f32 (Float) or bool (Bool). See Array::asSpan.
+///
+/// Values are read from the document on access and byteswapped if necessary. When the document's
+/// byte order matches the host's, the values can also be used in place through data().
+template <typename T>
+class ArraySpan {
+public:
+  /// Read-only iterator. Values are returned by value, so this is only an input iterator
+  /// as far as the standard library is concerned (even though it supports all random access
+  /// operations), and algorithms that modify a range (e.g. std::sort) cannot be used with it.
+  /// C++20 iterator concepts recognize it as a random access iterator.
+  class Iterator {
+  public:
+    using iterator_concept = std::random_access_iterator_tag;
+    using iterator_category = std::input_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = T;
+
+    Iterator() = default;
+    Iterator(const u8* ptr, bool byteswap) : mPtr{ptr}, mByteswap{byteswap} {}
+
+    T operator*() const { return read(mPtr, mByteswap); }
+    T operator[](difference_type n) const { return read(mPtr + 4 * n, mByteswap); }
+
+    Iterator& operator++() { return *this += 1; }
+    Iterator& operator--() { return *this -= 1; }
+    Iterator operator++(int) { return std::exchange(*this, *this + 1); }
+    Iterator operator--(int) { return std::exchange(*this, *this - 1); }
+    Iterator& operator+=(difference_type n) { return mPtr += 4 * n, *this; }
+    Iterator& operator-=(difference_type n) { return mPtr -= 4 * n, *this; }
+    Iterator operator+(difference_type n) const { return Iterator{*this} += n; }
+    Iterator operator-(difference_type n) const { return Iterator{*this} -= n; }
+    friend Iterator operator+(difference_type n, const Iterator& it) { return it + n; }
+    difference_type operator-(const Iterator& other) const { return (mPtr - other.mPtr) / 4; }
+
+    bool operator==(const Iterator& other) const { return mPtr == other.mPtr; }
+    bool operator!=(const Iterator& other) const { return mPtr != other.mPtr; }
+    bool operator<(const Iterator& other) const { return mPtr < other.mPtr; }
+    bool operator>(const Iterator& other) const { return mPtr > other.mPtr; }
+    bool operator<=(const Iterator& other) const { return mPtr <= other.mPtr; }
+    bool operator>=(const Iterator& other) const { return mPtr >= other.mPtr; }
+
+  private:
+    const u8* mPtr = nullptr;
+    bool mByteswap = false;
+  };
+
+  ArraySpan(const u8* values, size_t size, bool byteswap)
+      : mValues{values}, mSize{size}, mByteswap{byteswap} {}
+
+  size_t size() const { return mSize; }
+  bool empty() const { return mSize == 0; }
+
+  /// Returns whether the values can be used in place (see data()).
+  bool isContiguous() const {
+    return !std::is_same_v<T, bool> && !mByteswap &&
+           reinterpret_cast<std::uintptr_t>(mValues) % alignof(T) == 0;
+  }
+  /// Get a pointer to the values in the document. Returns nullptr if the values need to be
+  /// byteswapped (or if T is bool, since Bool values are stored as 32-bit words).
+  const T* data() const {
+    return isContiguous() ? reinterpret_cast<const T*>(mValues) : nullptr;
+  }
+
+  T operator[](size_t idx) const { return read(mValues + 4 * idx, mByteswap); }
+  T front() const { return (*this)[0]; }
+  T back() const { return (*this)[mSize - 1]; }
+
+  Iterator begin() const { return {mValues, mByteswap}; }
+  Iterator end() const { return {mValues + 4 * mSize, mByteswap}; }
+
+private:
+  static T read(const u8* ptr, bool byteswap) {
+    u32 raw;
+    std::memcpy(&raw, ptr, sizeof(raw));
+    if (byteswap)
+      raw = (raw >> 24) | ((raw >> 8) & 0xff00) | ((raw << 8) & 0xff0000) | (raw << 24);
+    if constexpr (std::is_same_v<T, bool>) {
+      return raw != 0;
+    } else {
+      T value;
+      std::memcpy(&value, &raw, sizeof(value));
+      return value;
+    }
+  }
+
+  const u8* mValues;
+  size_t mSize;
+  bool mByteswap;
 };
 
 /// BYML array.
+///
+/// Monotyped arrays (v7+) are also represented by this class. Their item type is read once
+/// when the Array is created; all accessors work the same way for both kinds of arrays.
 class Array : public Container<Array, ItemData> {
 public:
-  using Container::Container;
+  Array(const Reader& reader, u32 offset);
+
+  /// Get the node type of the array (Array or MonoTypedArray).
+  NodeType getNodeType() const { return mType; }
+  /// Returns whether all items have the same type, which is stored once for the whole array.
+  bool isMonoTyped() const { return mType == NodeType::MonoTypedArray; }
 
   /// Get an item by its index (assumed to be valid).
   ItemData operator[](size_t idx) const { return *getByIndex(idx); }
 
+  /// Get the type of the items if they all have the same type.
+  /// Returns nullopt if the array is empty or if it contains items of different types.
+  std::optional<NodeType> getUniformType() const;
+  /// Get the raw values of the array: numItems() 32-bit words, in the document's byte order.
+  /// For strings, containers and 64-bit nodes, values are indices or offsets.
+  const u8* getRawValues() const;
+
+  // Bulk decoding. These read the whole array at once with vectorized kernels instead of going
+  // through an ItemData per item. Output buffers must have room for numItems() elements.
+
+  /// Copy the type of each item to `types`.
+  void decodeTypes(NodeType* types) const;
+  /// Copy the raw value of each item (see RawItemData) to `values`, in the native byte order.
+  void decodeRaw(u32* values) const;
+  /// Copy the value of each item to `values`. T must be s32 (Int), u32 (UInt), f32 (Float)
+  /// or bool (Bool). Returns false without writing anything if any item has a different type.
+  template <typename T>
+  bool decodeInto(T* values) const;
+  /// Get a view of the values of the array, without copying them. T must be s32 (Int),
+  /// u32 (UInt), f32 (Float) or bool (Bool). Returns nullopt if any item has a different type.
+  /// The view can be used with standard algorithms; see ArraySpan::data() for direct access.
+  template <typename T>
+  std::optional<ArraySpan<T>> asSpan() const;
+
 private:
   friend Container<Array, ItemData>;
   std::optional<ItemData> getByIndexImpl(size_t idx) const;
+
+  NodeType mType;
+  /// Type of the items of a monotyped array.
+  NodeType mItemType = NodeType::Null;
 };
 
 struct HashItem {
   const char* name;
   ItemData data;
 };
+
+/// Index of a key in the hash key table of a document. Obtained with Reader::findKey.
+/// Key IDs are specific to a document and must not be used with containers from another one.
+struct KeyId {
+  u32 index;
+
+  bool operator==(KeyId other) const { return index == other.index; }
+  bool operator!=(KeyId other) const { return index != other.index; }
+};
+
 /// BYML hash (aka dictionary or map).
 class Hash : public Container<Hash, HashItem> {
 public:
@@ -114,13 +310,22 @@ public:
 
   /// Get an item by its key.
   std::optional<ItemData> getByKey(const char* key) const;
+  /// Get an item by its key ID. This avoids string comparisons and is faster than looking up
+  /// the key string when the same key is used for many hashes.
+  std::optional<ItemData> getByKey(KeyId key) const;
+  /// Get the key ID of an item by its index. Key IDs are unique per key string, so they can
+  /// be used to cache data derived from keys.
+  std::optional<KeyId> getKeyIdByIndex(size_t idx) const;
   /// Get an item by its key (assumed to be valid).
   ItemData operator[](const char* key) const { return *getByKey(key); }
+  /// Get an item by its key ID (assumed to be valid).
+  ItemData operator[](KeyId key) const { return *getByKey(key); }
   /// Prevents implicit conversions from 0 to const char* and other mistakes.
   ItemData operator[](int key) const = delete;
 
   /// Checks if the hash contains an element with the specified key.
   bool contains(const char* key) const { return getByKey(key).has_value(); }
+  bool contains(KeyId key) const { return getByKey(key).has_value(); }
 
   auto keys() const {
     return *this | ranges::view::transform([](const HashItem& item) { return item.name; });
@@ -135,4 +340,40 @@ private:
   std::optional<HashItem> getByIndexImpl(size_t idx) const;
 };
 
+struct Hash32Item {
+  u32 key;
+  ItemData data;
+};
+
+/// BYML hash whose keys are 32-bit integers (usually hashes of strings) instead of strings:
+/// Hash32 and ValueHash32 nodes (v7+). Items are sorted by key.
+class Hash32 : public Container<Hash32, Hash32Item> {
+public:
+  Hash32(const Reader& reader, u32 offset);
+
+  /// Get the node type of the hash (Hash32 or ValueHash32).
+  NodeType getNodeType() const { return mType; }
+
+  /// Get an item by its key.
+  std::optional<ItemData> getByKey(u32 key) const;
+  /// Get an item by its key (assumed to be valid).
+  ItemData operator[](u32 key) const { return *getByKey(key); }
+  /// Checks if the hash contains an element with the specified key.
+  bool contains(u32 key) const { return getByKey(key).has_value(); }
+
+  auto keys() const {
+    return *this | ranges::view::transform([](const Hash32Item& item) { return item.key; });
+  }
+
+  auto values() const {
+    return *this | ranges::view::transform([](const Hash32Item& item) { return item.data; });
+  }
+
+private:
+  friend Container<Hash32, Hash32Item>;
+  std::optional<Hash32Item> getByIndexImpl(size_t idx) const;
+
+  NodeType mType;
+};
+
 }  // namespace byml
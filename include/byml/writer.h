@@ -0,0 +1,90 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include <byml/types.h>
+#include <byml/value.h>
+
+namespace byml {
+
+class Reader;
+
+/// BYML writer.
+///
+/// Nodes are added in document order, starting with the root container:
+///
+///   Writer writer{2, false};
+///   writer.beginHash();
+///   writer.setKey("Objs");
+///   writer.beginArray();
+///   writer.addString("Obj0");
+///   writer.end();
+///   writer.setKey("Version");
+///   writer.addInt(1);
+///   writer.end();
+///   std::optional<std::vector<u8>> data = writer.finish();
+///
+/// Containers are encoded as soon as they are ended, and containers that are identical
+/// to an already encoded one are only emitted once (and referenced from several parents).
+/// Strings and hash keys are pooled, so each of them is stored once in the string tables.
+class Writer {
+public:
+  /// @param version  Format version (2 or 3). 64-bit nodes require version 3.
+  Writer(u16 version = 2, bool bigEndian = false);
+  ~Writer();
+  Writer(const Writer&) = delete;
+  Writer& operator=(const Writer&) = delete;
+  Writer(Writer&&) noexcept;
+  Writer& operator=(Writer&&) noexcept;
+
+  /// Set the key of the next node. Required for each node that is added to a hash.
+  void setKey(std::string_view key);
+
+  void beginArray();
+  void beginHash();
+  /// End the current container.
+  void end();
+
+  void addString(std::string_view value);
+  void addBool(bool value);
+  void addInt(s32 value);
+  void addUInt(u32 value);
+  void addFloat(f32 value);
+  void addInt64(s64 value);
+  void addUInt64(u64 value);
+  void addDouble(f64 value);
+  void addNull();
+  /// Copy a node from another document. Containers are copied recursively; monotyped arrays
+  /// are written as regular arrays. Binary data and Hash32 nodes cannot be copied.
+  void add(const ItemData& item);
+
+  /// Returns false if an invalid operation was attempted (for example adding an item to a hash
+  /// without setting a key first, adding the same key twice to a hash, adding nodes after the root
+  /// container was ended or adding 64-bit nodes to a version 2 document).
+  bool isOk() const;
+
+  /// Serialize the document. Returns nullopt if the writer is not in a good state or
+  /// if a container is still open.
+  std::optional<std::vector<u8>> finish() const;
+
+  /// Serialize a whole document with the specified version and byte order.
+  static std::optional<std::vector<u8>> write(const Reader& reader, u16 version, bool bigEndian);
+
+private:
+  friend class Document;
+
+  /// End the current container and return its offset.
+  std::optional<u32> endContainer();
+  /// Add a reference to a container that has already been ended.
+  void addContainer(NodeType type, u32 offset);
+
+  struct Impl;
+  std::unique_ptr<Impl> mImpl;
+};
+
+}  // namespace byml
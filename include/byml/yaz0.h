@@ -0,0 +1,68 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+#pragma once
+
+#include <array>
+#include <optional>
+
+#include <byml/byml.h>
+#include <byml/types.h>
+
+namespace byml::yaz0 {
+
+struct Header {
+  /// “Yaz0”
+  std::array<char, 4> magic;
+  /// Size of the decompressed data (big endian).
+  u32 uncompressedSize;
+  /// Required alignment of the decompressed data (big endian). 0 in older files.
+  u32 dataAlignment;
+  u8 reserved[4];
+};
+static_assert(sizeof(Header) == 0x10);
+
+/// Returns whether the data starts with a Yaz0 header.
+bool isCompressed(Buffer data);
+
+/// Get the size of the decompressed data. Returns nullopt if the data is not Yaz0-compressed
+/// or if the size in the header is larger than the compressed data can possibly expand to.
+std::optional<u32> getDecompressedSize(Buffer data);
+
+/// Decompress Yaz0 data into a caller-provided buffer, which must be at least as large as
+/// the size returned by getDecompressedSize(). Returns false if the data is malformed.
+bool decompress(Buffer src, u8* dst, size_t dstSize);
+
+/// Incremental Yaz0 decoder. Output is produced in order and can be consumed as soon as
+/// decodeUntil() reports that it is available, which lets callers work on the start of the
+/// data while the rest is still being decompressed.
+class Decoder {
+public:
+  /// dst must be at least as large as the size returned by getDecompressedSize().
+  Decoder(Buffer src, u8* dst, size_t dstSize);
+
+  /// Decompress until at least `size` bytes are available or the end of the data is reached.
+  /// Returns false if the data is malformed.
+  bool decodeUntil(size_t size);
+  /// Decompress all remaining data. Returns false if the data is malformed.
+  bool decodeAll() { return decodeUntil(mDstSize); }
+
+  /// Number of bytes that have been decompressed so far.
+  size_t decodedSize() const { return mDstPos; }
+  /// Total size of the decompressed data.
+  size_t totalSize() const { return mDstSize; }
+  bool isDone() const { return mDstPos == mDstSize; }
+
+private:
+  Buffer mSrc;
+  u8* mDst;
+  size_t mDstSize;
+
+  size_t mSrcPos = sizeof(Header);
+  size_t mDstPos = 0;
+  /// Current group header and number of chunks left in the group.
+  u8 mGroupHeader = 0;
+  int mGroupChunksLeft = 0;
+  bool mError = false;
+};
+
+}  // namespace byml::yaz0
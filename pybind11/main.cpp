@@ -1,12 +1,33 @@
 // Copyright 2018 leoetlino <leo@leolam.fr>
 // Licensed under GPLv2+
 
+#include <cstring>
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
 #include <byml/binary_format.h>
 #include <byml/byml.h>
+#include <byml/diff.h>
+#include <byml/document.h>
+#include <byml/fingerprint.h>
+#include <byml/patch.h>
+#include <byml/query.h>
+#include <byml/scan.h>
+#include <byml/string_index.h>
+#include <byml/text.h>
 #include <byml/value.h>
+#include <byml/writer.h>
+#include <byml/yaz0.h>
 
 namespace py = pybind11;
 
@@ -14,9 +35,10 @@ using namespace pybind11::literals;
 
 namespace {
 
-template <typename T>
-py::class_<T> registerBymlContainerClass(const py::module& m, const char* name) {
-  return py::class_<T>(m, name)
+template <typename T, typename... Extra>
+py::class_<T> registerBymlContainerClass(const py::module& m, const char* name,
+                                         const Extra&... extra) {
+  return py::class_<T>(m, name, extra...)
       .def("__len__", &T::numItems)
       .def("__getitem__",
            [](const T& ct, std::size_t idx) {
@@ -35,6 +57,558 @@ auto rangeToIter(const T& range) {
   return py::make_iterator(range.begin(), range.end());
 }
 
+/// Get the size of a numeric value in bytes. Returns nullopt for non-numeric node types.
+std::optional<size_t> getNumericSize(byml::NodeType type) {
+  switch (type) {
+  case byml::NodeType::Bool:
+  case byml::NodeType::Int:
+  case byml::NodeType::UInt:
+  case byml::NodeType::Float:
+    return 4;
+  case byml::NodeType::Int64:
+  case byml::NodeType::UInt64:
+  case byml::NodeType::Double:
+    return 8;
+  default:
+    return {};
+  }
+}
+
+/// Get the NumPy dtype for raw numeric values. `byteOrder` is one of '<', '>' and '='.
+py::dtype getRawDtype(byml::NodeType type, char byteOrder) {
+  std::string format{byteOrder};
+  switch (type) {
+  case byml::NodeType::Int:
+    format += "i4";
+    break;
+  case byml::NodeType::Bool:
+  case byml::NodeType::UInt:
+    format += "u4";
+    break;
+  case byml::NodeType::Float:
+    format += "f4";
+    break;
+  case byml::NodeType::Int64:
+    format += "i8";
+    break;
+  case byml::NodeType::UInt64:
+    format += "u8";
+    break;
+  case byml::NodeType::Double:
+    format += "f8";
+    break;
+  default:
+    throw std::invalid_argument{"not a numeric node type"};
+  }
+  return py::dtype(format);
+}
+
+/// Get the uniform numeric type of an array, or throw if the array is not homogeneous.
+byml::NodeType getNumericType(const byml::Array& array) {
+  const auto type = array.getUniformType();
+  if (!type || !getNumericSize(*type))
+    throw std::invalid_argument{"array items must all have the same numeric type"};
+  return *type;
+}
+
+char getByteOrder(const byml::Reader& reader) {
+  return reader.isBigEndian() ? '>' : '<';
+}
+
+/// Copy a numeric value (in the native byte order) to `dst`.
+void copyNativeValue(const byml::ItemData& item, byml::NodeType type, byml::u8* dst) {
+  switch (type) {
+  case byml::NodeType::Int64: {
+    const byml::s64 value = *item.getInt64();
+    std::memcpy(dst, &value, sizeof(value));
+    return;
+  }
+  case byml::NodeType::UInt64: {
+    const byml::u64 value = *item.getUInt64();
+    std::memcpy(dst, &value, sizeof(value));
+    return;
+  }
+  case byml::NodeType::Double: {
+    const byml::f64 value = *item.getDouble();
+    std::memcpy(dst, &value, sizeof(value));
+    return;
+  }
+  default:
+    std::memcpy(dst, &item.raw.raw, sizeof(item.raw.raw));
+    return;
+  }
+}
+
+/// Copy the values of a numeric array (in the native byte order) to `dst`.
+void copyNativeValues(const byml::Array& array, byml::NodeType type, byml::u8* dst) {
+  if (getNumericSize(type) == 4) {
+    // Byteswapped in bulk if necessary.
+    array.decodeRaw(reinterpret_cast<byml::u32*>(dst));
+    return;
+  }
+  // 64-bit values are stored out of line.
+  for (size_t i = 0; i < array.numItems(); ++i)
+    copyNativeValue(array[i], type, dst + 8 * i);
+}
+
+/// Bool values are stored as 32-bit words. Convert them to NumPy booleans.
+/// This is a no-op for other types.
+py::array convertBools(const py::array& values, byml::NodeType type) {
+  if (type == byml::NodeType::Bool)
+    return values.attr("astype")("bool");
+  return values;
+}
+
+py::array toNumpy(const byml::Array& array, py::handle base) {
+  if (array.numItems() == 0)
+    return py::array(py::dtype("float32"), std::vector<py::ssize_t>{0});
+  const byml::NodeType type = getNumericType(array);
+  const py::dtype dtype = getRawDtype(type, getByteOrder(array.getReader()));
+  const auto size = static_cast<py::ssize_t>(array.numItems());
+  if (getNumericSize(type) == 4 && dtype.attr("isnative").cast<bool>()) {
+    // Zero-copy view of the document (which `base` keeps alive).
+    py::array view{dtype, std::vector<py::ssize_t>{size}, {}, array.getRawValues(), base};
+    view.attr("setflags")("write"_a = false);
+    return convertBools(view, type);
+  }
+  py::array values{getRawDtype(type, '='), std::vector<py::ssize_t>{size}};
+  copyNativeValues(array, type, static_cast<byml::u8*>(values.mutable_data()));
+  return convertBools(values, type);
+}
+
+/// Gather the value for `key` in every hash of an array into a single NumPy array.
+/// Values must either be numeric arrays of the same type and size (giving a 2D array)
+/// or numeric scalars of the same type (giving a 1D array).
+py::array gatherNumpy(const byml::Array& array, byml::KeyId key) {
+  const auto numRows = static_cast<py::ssize_t>(array.numItems());
+  if (numRows == 0)
+    return py::array(py::dtype("float32"), std::vector<py::ssize_t>{0});
+
+  std::optional<byml::NodeType> type;
+  bool isScalar = false;
+  size_t numColumns = 0;
+  size_t valueSize = 0;
+  py::array raw;
+  byml::u8* dst = nullptr;
+  for (py::ssize_t i = 0; i < numRows; ++i) {
+    const auto hash = array[i].getHash();
+    if (!hash)
+      throw std::invalid_argument{"item " + std::to_string(i) + " is not a hash"};
+    const auto value = hash->getByKey(key);
+    if (!value)
+      throw py::key_error{"item " + std::to_string(i) + " does not have the key"};
+    const auto row = value->getArray();
+
+    const byml::NodeType rowType = row ? getNumericType(*row) : value->raw.type;
+    const size_t rowSize = row ? row->numItems() : 1;
+    if (!type) {
+      type = rowType;
+      isScalar = !row;
+      numColumns = rowSize;
+      valueSize = getNumericSize(*type).value_or(0);
+      if (valueSize == 0)
+        throw std::invalid_argument{"values must be numeric"};
+      const py::dtype dtype = getRawDtype(*type, '=');
+      std::vector<py::ssize_t> shape{numRows};
+      if (!isScalar)
+        shape.push_back(static_cast<py::ssize_t>(numColumns));
+      raw = py::array{dtype, shape};
+      dst = static_cast<byml::u8*>(raw.mutable_data());
+    }
+    if (rowType != *type || isScalar == bool(row) || rowSize != numColumns)
+      throw std::invalid_argument{"item " + std::to_string(i) + " has a different type or size"};
+
+    if (row)
+      copyNativeValues(*row, *type, dst + i * numColumns * valueSize);
+    else
+      copyNativeValue(*value, *type, dst + i * valueSize);
+  }
+  return convertBools(raw, *type);
+}
+
+/// Throws if a CPython API call failed (i.e. returned nullptr).
+py::object steal(PyObject* object) {
+  if (!object)
+    throw py::error_already_set();
+  return py::reinterpret_steal<py::object>(object);
+}
+
+/// Converts containers to nested dicts and lists in a single pass, without creating
+/// wrapper objects for items. Strings and keys are decoded once per string table entry
+/// and the same str object is reused for every occurrence.
+///
+/// Containers that are referenced several times are only converted once as well, and the same
+/// list or dict is reused for every reference (otherwise documents with deduplicated containers
+/// would take time exponential in their depth to convert).
+class PythonConverter {
+public:
+  explicit PythonConverter(const byml::Reader& reader) : mReader{reader} {}
+
+  template <typename Container>
+  py::object convert(const Container& container) {
+    py::object result = beginContainer(container);
+    convertPending();
+    return result;
+  }
+
+  /// Convert an item. Strings are cached across calls, so converting many items
+  /// from the same document with a single converter is cheaper.
+  py::object convert(const byml::ItemData& item) {
+    py::object result = convertItem(item);
+    convertPending();
+    return result;
+  }
+
+private:
+  struct Frame {
+    py::object object;
+    std::optional<byml::Array> array;
+    std::optional<byml::Hash> hash;
+    std::optional<byml::Hash32> hash32;
+    byml::u32 offset;
+    size_t numItems;
+    size_t next;
+  };
+
+  /// Fill in the containers that have been created but not converted yet.
+  void convertPending() {
+    while (!mStack.empty()) {
+      Frame& frame = mStack.back();
+      if (frame.next == frame.numItems) {
+        mContainers.emplace(frame.offset, frame.object);
+        if (mReader.isCheckedAccessEnabled())
+          mInProgress.erase(frame.offset);
+        mStack.pop_back();
+        continue;
+      }
+
+      const size_t idx = frame.next++;
+      // Copy what is needed from the frame: converting the value may push a new frame.
+      PyObject* parent = frame.object.ptr();
+      if (frame.array) {
+        py::object value = convertItem((*frame.array)[idx]);
+        PyList_SET_ITEM(parent, idx, value.release().ptr());
+      } else if (frame.hash32) {
+        const byml::Hash32Item item = *frame.hash32->getByIndex(idx);
+        py::object key = steal(PyLong_FromUnsignedLong(item.key));
+        py::object value = convertItem(item.data);
+        if (PyDict_SetItem(parent, key.ptr(), value.ptr()) != 0)
+          throw py::error_already_set();
+      } else {
+        const byml::Hash& hash = *frame.hash;
+        const byml::HashItem item = *hash.getByIndex(idx);
+        py::object key = getKey(*hash.getKeyIdByIndex(idx), item.name);
+        py::object value = convertItem(item.data);
+        if (PyDict_SetItem(parent, key.ptr(), value.ptr()) != 0)
+          throw py::error_already_set();
+      }
+    }
+  }
+
+  py::object beginContainer(const byml::Array& array) {
+    if (py::object converted = getConverted(array.getOffset()))
+      return converted;
+    checkCycle(array.getOffset());
+    py::object list = steal(PyList_New(array.numItems()));
+    mStack.push_back(
+        {list, array, std::nullopt, std::nullopt, array.getOffset(), array.numItems(), 0});
+    return list;
+  }
+
+  py::object beginContainer(const byml::Hash& hash) {
+    if (py::object converted = getConverted(hash.getOffset()))
+      return converted;
+#if PY_VERSION_HEX < 0x030D0000
+    py::object dict = steal(_PyDict_NewPresized(hash.numItems()));
+#else
+    py::object dict = steal(PyDict_New());
+#endif
+    checkCycle(hash.getOffset());
+    mStack.push_back(
+        {dict, std::nullopt, hash, std::nullopt, hash.getOffset(), hash.numItems(), 0});
+    return dict;
+  }
+
+  /// Hash32 nodes are converted to dicts with integer keys.
+  py::object beginContainer(const byml::Hash32& hash) {
+    if (py::object converted = getConverted(hash.getOffset()))
+      return converted;
+    py::object dict = steal(PyDict_New());
+    checkCycle(hash.getOffset());
+    mStack.push_back(
+        {dict, std::nullopt, std::nullopt, hash, hash.getOffset(), hash.numItems(), 0});
+    return dict;
+  }
+
+  /// Returns the object for a container that has already been converted (or a null object).
+  py::object getConverted(byml::u32 offset) const {
+    const auto it = mContainers.find(offset);
+    return it != mContainers.end() ? it->second : py::object{};
+  }
+
+  /// With checked access, documents have not necessarily been validated
+  /// and may contain containers that include themselves.
+  void checkCycle(byml::u32 offset) {
+    if (mReader.isCheckedAccessEnabled() && !mInProgress.insert(offset).second)
+      throw std::invalid_argument{"invalid document: cycle detected"};
+  }
+
+  py::object convertItem(const byml::ItemData& item) {
+    switch (item.raw.type) {
+    case byml::NodeType::Array:
+    case byml::NodeType::MonoTypedArray:
+      if (const auto array = item.getArray())
+        return beginContainer(*array);
+      break;
+    case byml::NodeType::Hash:
+      if (const auto hash = item.getHash())
+        return beginContainer(*hash);
+      break;
+    case byml::NodeType::Hash32:
+    case byml::NodeType::ValueHash32:
+      if (const auto hash = item.getHash32())
+        return beginContainer(*hash);
+      break;
+    case byml::NodeType::Binary:
+    case byml::NodeType::FileData:
+      if (const auto data = item.getBinary())
+        return py::bytes(reinterpret_cast<const char*>(data->data()), data->size());
+      break;
+    case byml::NodeType::String:
+      return getString(item);
+    case byml::NodeType::Bool:
+      return py::bool_(item.raw.raw != 0);
+    case byml::NodeType::Int:
+      return steal(PyLong_FromLong(*item.getInt()));
+    case byml::NodeType::UInt:
+      return steal(PyLong_FromUnsignedLong(item.raw.raw));
+    case byml::NodeType::Float:
+      return steal(PyFloat_FromDouble(*item.getFloat()));
+    case byml::NodeType::Int64:
+      return steal(PyLong_FromLongLong(*item.getInt64()));
+    case byml::NodeType::UInt64:
+      return steal(PyLong_FromUnsignedLongLong(*item.getUInt64()));
+    case byml::NodeType::Double:
+      return steal(PyFloat_FromDouble(*item.getDouble()));
+    case byml::NodeType::Null:
+      return py::none();
+    default:
+      break;
+    }
+    throw std::invalid_argument{"invalid node"};
+  }
+
+  static py::object decode(std::string_view string) {
+    return steal(PyUnicode_DecodeUTF8(string.data(), string.size(), nullptr));
+  }
+
+  py::object getString(const byml::ItemData& item) {
+    const byml::u32 idx = item.raw.raw;
+    if (idx >= mStrings.size())
+      mStrings.resize(idx + 1);
+    if (!mStrings[idx]) {
+      const auto string = item.getStringView();
+      if (!string)
+        throw std::invalid_argument{"invalid node"};
+      mStrings[idx] = decode(*string);
+    }
+    return mStrings[idx];
+  }
+
+  py::object getKey(byml::KeyId key, const char* name) {
+    if (key.index >= mKeys.size())
+      mKeys.resize(key.index + 1);
+    if (!mKeys[key.index])
+      mKeys[key.index] = decode(name);
+    return mKeys[key.index];
+  }
+
+  const byml::Reader& mReader;
+  std::vector<Frame> mStack;
+  std::vector<py::object> mStrings;
+  std::vector<py::object> mKeys;
+  /// Containers that have been fully converted, by offset.
+  std::unordered_map<byml::u32, py::object> mContainers;
+  std::unordered_set<byml::u32> mInProgress;
+};
+
+py::object toPython(const byml::Reader& reader) {
+  if (const auto hash = reader.getHash())
+    return PythonConverter{reader}.convert(*hash);
+  if (const auto array = reader.getArray())
+    return PythonConverter{reader}.convert(*array);
+  if (const auto hash = reader.getHash32())
+    return PythonConverter{reader}.convert(*hash);
+  if (reader.isHash() || reader.isArray() || reader.isHash32())
+    throw std::invalid_argument{"invalid root node"};
+  return py::none();
+}
+
+/// Load documents from paths and buffers. The native part (opening, decompressing and
+/// validating documents) runs on a thread pool without holding the GIL.
+py::list loadMany(const py::iterable& inputs, unsigned numThreads, bool validate,
+                  bool buildKeyIndex, bool convertToPython) {
+  std::vector<py::object> objects;
+  std::vector<byml::LoadInput> loadInputs;
+  // Keeps buffer exports (and the data) alive while documents are being loaded.
+  std::vector<py::buffer_info> bufferInfos;
+
+  const py::object fspath = py::module::import("os").attr("fspath");
+  for (const py::handle input : inputs) {
+    objects.push_back(py::reinterpret_borrow<py::object>(input));
+    if (py::isinstance<byml::Buffer>(input)) {
+      loadInputs.emplace_back(input.cast<byml::Buffer>());
+    } else if (py::isinstance<py::buffer>(input)) {
+      py::buffer_info info = py::reinterpret_borrow<py::buffer>(input).request();
+      if (info.itemsize != 1 || info.ndim != 1)
+        throw std::invalid_argument{"buffers must be one-dimensional byte buffers"};
+      loadInputs.emplace_back(
+          byml::Buffer{static_cast<byml::u8*>(info.ptr), static_cast<size_t>(info.size)});
+      bufferInfos.push_back(std::move(info));
+    } else {
+      loadInputs.emplace_back(fspath(input).cast<std::string>());
+    }
+  }
+
+  const byml::LoadOptions options{validate, buildKeyIndex};
+  std::vector<std::optional<byml::Reader>> readers;
+  {
+    py::gil_scoped_release release;
+    readers = byml::Reader::loadMany(loadInputs, numThreads, options);
+  }
+
+  py::list results{objects.size()};
+  for (size_t i = 0; i < readers.size(); ++i) {
+    py::object result = py::none();
+    if (readers[i] && convertToPython) {
+      result = toPython(*readers[i]);
+    } else if (readers[i]) {
+      result = py::cast(std::move(*readers[i]));
+      // Readers that were created from a buffer may refer to its data.
+      if (std::holds_alternative<byml::Buffer>(loadInputs[i]))
+        py::detail::keep_alive_impl(result, objects[i]);
+    }
+    results[i] = std::move(result);
+  }
+  return results;
+}
+
+const byml::Reader& getQueryRoot(const byml::Reader& reader) {
+  return reader;
+}
+
+byml::ItemData getQueryRoot(const byml::Array& array) {
+  return {array.getReader(), {array.getOffset(), array.getNodeType()}};
+}
+
+byml::ItemData getQueryRoot(const byml::Hash& hash) {
+  return {hash.getReader(), {hash.getOffset(), byml::NodeType::Hash}};
+}
+
+/// Run a query on a Reader, Array or Hash. The query runs without holding the GIL; matches are
+/// then converted to Python objects (sharing a single string cache), or returned as ItemData.
+template <typename Source>
+void registerQuerySource(py::class_<byml::Query>& cls) {
+  cls.def("findAll",
+          [](const byml::Query& query, py::object source, bool convertToPython) {
+            const Source& root = source.cast<const Source&>();
+            const std::vector<byml::ItemData> matches = [&] {
+              py::gil_scoped_release release;
+              return query.findAll(getQueryRoot(root));
+            }();
+            py::list results{matches.size()};
+            if (matches.empty())
+              return results;
+            PythonConverter converter{matches[0].reader};
+            for (size_t i = 0; i < matches.size(); ++i) {
+              if (convertToPython) {
+                results[i] = converter.convert(matches[i]);
+              } else {
+                py::object item = py::cast(matches[i]);
+                py::detail::keep_alive_impl(item, source);
+                results[i] = std::move(item);
+              }
+            }
+            return results;
+          },
+          "source"_a, "toPython"_a = true);
+  cls.def("findFirst",
+          [](const byml::Query& query, py::object source, bool convertToPython) -> py::object {
+            const Source& root = source.cast<const Source&>();
+            const std::optional<byml::ItemData> match = [&] {
+              py::gil_scoped_release release;
+              return query.findFirst(getQueryRoot(root));
+            }();
+            if (!match)
+              return py::none();
+            if (convertToPython)
+              return PythonConverter{match->reader}.convert(*match);
+            py::object item = py::cast(*match);
+            py::detail::keep_alive_impl(item, source);
+            return item;
+          },
+          "source"_a, "toPython"_a = true);
+  cls.def("count",
+          [](const byml::Query& query, const Source& source) {
+            py::gil_scoped_release release;
+            return query.count(getQueryRoot(source));
+          },
+          "source"_a);
+}
+
+/// Convert a diff path to a list of keys (str) and indexes or Hash32 keys (int).
+py::list convertPath(const byml::Path& path) {
+  py::list result{path.size()};
+  for (size_t i = 0; i < path.size(); ++i) {
+    const byml::PathElement& element = path[i];
+    if (element.type == byml::PathElement::Type::Key)
+      result[i] = py::str(element.key.data(), element.key.size());
+    else
+      result[i] = py::int_(element.index);
+  }
+  return result;
+}
+
+/// Get the value of an item. Binary data is copied to bytes and Null nodes are returned as None.
+/// Throws if the item is invalid.
+py::object getValue(const byml::ItemData& item) {
+  switch (item.raw.type) {
+  case byml::NodeType::Binary:
+  case byml::NodeType::FileData:
+    if (const auto data = item.getBinary())
+      return py::bytes(reinterpret_cast<const char*>(data->data()), data->size());
+    break;
+  case byml::NodeType::Hash32:
+  case byml::NodeType::ValueHash32:
+    if (const auto hash = item.getHash32())
+      return py::cast(*hash);
+    break;
+  case byml::NodeType::Null:
+    return py::none();
+  default:
+    if (auto value = item.tryVal())
+      return py::cast(std::move(*value));
+    break;
+  }
+  throw std::invalid_argument{"invalid node"};
+}
+
+/// Format the value of an item for __repr__, which should not throw.
+py::object reprValue(const byml::ItemData& item) {
+  try {
+    return getValue(item);
+  } catch (const std::invalid_argument&) {
+    return py::str("<invalid>");
+  }
+}
+
+/// Convert a fingerprint to a 128-bit int.
+py::object convertFingerprint(const std::optional<byml::Fingerprint>& fingerprint) {
+  if (!fingerprint)
+    return py::none();
+  return py::int_(fingerprint->high).attr("__lshift__")(64).attr("__or__")(fingerprint->low);
+}
+
 }  // namespace
 
 PYBIND11_MODULE(bymlplus, m) {
@@ -42,10 +616,15 @@ PYBIND11_MODULE(bymlplus, m) {
 
   // binary_format.h
   py::enum_<NodeType>(m, "NodeType")
+      .value("Hash32", NodeType::Hash32)
+      .value("ValueHash32", NodeType::ValueHash32)
       .value("String", NodeType::String)
+      .value("Binary", NodeType::Binary)
+      .value("FileData", NodeType::FileData)
       .value("Array", NodeType::Array)
       .value("Hash", NodeType::Hash)
       .value("StringTable", NodeType::StringTable)
+      .value("MonoTypedArray", NodeType::MonoTypedArray)
       .value("Bool", NodeType::Bool)
       .value("Int", NodeType::Int)
       .value("Float", NodeType::Float)
@@ -56,7 +635,7 @@ PYBIND11_MODULE(bymlplus, m) {
       .value("Null", NodeType::Null);
 
   // byml.h
-  py::class_<Buffer>(m, "Buffer")
+  py::class_<Buffer>(m, "Buffer", py::buffer_protocol())
       .def(py::init([](py::buffer b) -> Buffer {
              py::buffer_info info = b.request();
              if (info.itemsize != 1 || info.ndim != 1 || info.size <= 0)
@@ -65,30 +644,424 @@ PYBIND11_MODULE(bymlplus, m) {
            }),
            "buf"_a, py::keep_alive<1, 2>())
       .def("__len__", [](const Buffer& buffer) { return buffer.size(); })
+      .def_buffer([](const Buffer& buffer) {
+        return py::buffer_info(const_cast<u8*>(buffer.data()), 1, "B", buffer.size(), true);
+      })
       .def("__repr__", [](const Buffer& buffer) {
         return py::str("<byml.Buffer len={} bytes>").format(buffer.size());
       });
 
   py::class_<Reader>(m, "Reader")
       .def(py::init<Buffer>(), "buffer"_a, py::keep_alive<1, 2>())
+      .def_static("openFile",
+                  [](const std::string& path) {
+                    if (auto reader = Reader::openFile(path))
+                      return *reader;
+                    throw std::runtime_error{"failed to open " + path};
+                  },
+                  "path"_a)
+      .def_static("fromCompressed",
+                  [](const Buffer& data) {
+                    if (auto reader = Reader::fromCompressed(data))
+                      return *reader;
+                    throw std::invalid_argument{"invalid Yaz0 data"};
+                  },
+                  "data"_a)
       .def("isValid", &Reader::isValid)
+      .def("isValidParallel", py::overload_cast<unsigned>(&Reader::isValidParallel, py::const_),
+           "numThreads"_a = 0, py::call_guard<py::gil_scoped_release>())
+      .def("setCheckedAccess", &Reader::setCheckedAccess, "enabled"_a)
+      .def("isCheckedAccessEnabled", &Reader::isCheckedAccessEnabled)
       .def("isArray", &Reader::isArray)
       .def("isHash", &Reader::isHash)
+      .def("isHash32", &Reader::isHash32)
       .def("getVersion", &Reader::getVersion)
+      .def("findKey", &Reader::findKey, "key"_a)
+      .def("buildKeyIndex", &Reader::buildKeyIndex)
+      .def("hasKeyIndex", &Reader::hasKeyIndex)
+      .def("buildStringLengths", &Reader::buildStringLengths)
+      .def("hasStringLengths", &Reader::hasStringLengths)
       .def("getArray", &Reader::getArray, py::keep_alive<0, 1>())
       .def("getHash", &Reader::getHash, py::keep_alive<0, 1>())
+      .def("getHash32", &Reader::getHash32, py::keep_alive<0, 1>())
+      .def("toPython", &toPython)
       .def("__repr__", [](const Reader& reader) {
         const char* type = "???";
         if (reader.isArray())
           type = "array";
         else if (reader.isHash())
           type = "hash";
+        else if (reader.isHash32())
+          type = "hash32";
         return py::str("<byml.Reader type={}>").format(type);
       });
 
+  m.def("loadMany", &loadMany, "inputs"_a, "threads"_a = 0, "validate"_a = true,
+        "buildKeyIndex"_a = false, "toPython"_a = false);
+
+  // yaz0.h
+  py::module yaz0Module = m.def_submodule("yaz0");
+  yaz0Module.def("isCompressed", &yaz0::isCompressed, "data"_a);
+  yaz0Module.def("getDecompressedSize", &yaz0::getDecompressedSize, "data"_a);
+  yaz0Module.def("decompress",
+           [](const Buffer& data) {
+             const auto size = yaz0::getDecompressedSize(data);
+             if (!size)
+               throw std::invalid_argument{"invalid Yaz0 header"};
+             py::bytes result{nullptr, *size};
+             auto* dst = reinterpret_cast<u8*>(PyBytes_AS_STRING(result.ptr()));
+             bool ok;
+             {
+               py::gil_scoped_release release;
+               ok = yaz0::decompress(data, dst, *size);
+             }
+             if (!ok)
+               throw std::invalid_argument{"invalid Yaz0 data"};
+             return result;
+           },
+           "data"_a);
+
+  // document.h
+  py::class_<Node>(m, "Node")
+      .def(py::init<>())
+      .def_static("makeNull", &Node::makeNull)
+      .def_static("makeBool", &Node::makeBool, "value"_a)
+      .def_static("makeInt", &Node::makeInt, "value"_a)
+      .def_static("makeUInt", &Node::makeUInt, "value"_a)
+      .def_static("makeFloat", &Node::makeFloat, "value"_a)
+      .def_static("makeInt64", &Node::makeInt64, "value"_a)
+      .def_static("makeUInt64", &Node::makeUInt64, "value"_a)
+      .def_static("makeDouble", &Node::makeDouble, "value"_a)
+      .def_static("makeArray", &Node::makeArray)
+      .def_static("makeHash", &Node::makeHash)
+      .def("getType", &Node::getType)
+      .def("isNull", &Node::isNull)
+      .def("isArray", &Node::isArray)
+      .def("isHash", &Node::isHash)
+      .def("getBool", &Node::getBool)
+      .def("getInt", &Node::getInt)
+      .def("getUInt", &Node::getUInt)
+      .def("getFloat", &Node::getFloat)
+      .def("getInt64", &Node::getInt64)
+      .def("getUInt64", &Node::getUInt64)
+      .def("getDouble", &Node::getDouble)
+      .def("getString", &Node::getStringView)
+      .def("__len__", &Node::numItems)
+      .def("__getitem__",
+           [](Node& node, size_t idx) -> Node& {
+             if (Node* item = node.getByIndex(idx))
+               return *item;
+             throw py::index_error{std::to_string(idx)};
+           },
+           "idx"_a, py::return_value_policy::reference_internal)
+      .def("__getitem__",
+           [](Node& node, std::string_view key) -> Node& {
+             if (Node* item = node.getByKey(key))
+               return *item;
+             throw py::key_error{std::string(key)};
+           },
+           "key"_a, py::return_value_policy::reference_internal)
+      .def("__contains__",
+           [](const Node& node, std::string_view key) { return node.getByKey(key) != nullptr; },
+           "key"_a)
+      .def("keys", [](const Node& node) {
+        py::list keys;
+        for (size_t i = 0; i < node.numItems() && node.isHash(); ++i)
+          keys.append(py::str(node.getHashEntries()[i].key, node.getHashEntries()[i].keyLength));
+        return keys;
+      });
+
+  py::class_<Document>(m, "Document")
+      .def(py::init<>())
+      .def_static("fromReader",
+                  [](const Reader& reader) {
+                    if (auto document = Document::fromReader(reader))
+                      return std::move(*document);
+                    throw std::invalid_argument{"failed to convert document"};
+                  },
+                  "reader"_a, py::keep_alive<0, 1>())
+      .def_property("root", py::overload_cast<>(&Document::getRoot),
+                    [](Document& document, const Node& node) { document.getRoot() = node; },
+                    py::return_value_policy::reference_internal)
+      .def("makeString", &Document::makeString, "value"_a)
+      .def("clone", &Document::clone, "node"_a)
+      .def("reserve", &Document::reserve, "container"_a, "numItems"_a)
+      .def("append",
+           [](Document& document, Node& array, const Node& value) {
+             if (!document.append(array, value))
+               throw std::invalid_argument{"not an array or array is full"};
+           },
+           "array"_a, "value"_a)
+      .def("set",
+           [](Document& document, Node& hash, std::string_view key, const Node& value) {
+             if (!document.set(hash, key, value))
+               throw std::invalid_argument{"not a hash, hash is full or invalid key"};
+           },
+           "hash"_a, "key"_a, "value"_a)
+      .def("removeAt", &Document::removeAt, "array"_a, "idx"_a)
+      .def("removeKey", &Document::removeKey, "hash"_a, "key"_a)
+      .def("write",
+           [](const Document& document, u16 version, bool bigEndian) {
+             if (auto data = document.write(version, bigEndian))
+               return py::bytes(reinterpret_cast<const char*>(data->data()), data->size());
+             throw std::invalid_argument{"failed to write document"};
+           },
+           "version"_a, "bigEndian"_a);
+
+  // query.h
+  py::class_<Query> queryClass(m, "Query");
+  queryClass
+      .def(py::init([](const std::string& expression) {
+             if (auto query = Query::compile(expression))
+               return std::move(*query);
+             throw std::invalid_argument{"invalid query: " + expression};
+           }),
+           "expression"_a)
+      .def("getExpression", &Query::getExpression)
+      .def("mayMatch", &Query::mayMatch, "reader"_a)
+      .def("__repr__", [](const Query& query) {
+        return py::str("<byml.Query {!r}>").format(query.getExpression());
+      });
+  registerQuerySource<Reader>(queryClass);
+  registerQuerySource<Array>(queryClass);
+  registerQuerySource<Hash>(queryClass);
+
+  // fingerprint.h
+  py::class_<FingerprintTable>(m, "FingerprintTable")
+      .def_static("build",
+                  [](const Reader& reader) {
+                    std::optional<FingerprintTable> table;
+                    {
+                      py::gil_scoped_release release;
+                      table = FingerprintTable::build(reader);
+                    }
+                    if (!table)
+                      throw std::invalid_argument{"invalid document"};
+                    return std::move(*table);
+                  },
+                  "reader"_a)
+      .def("__len__", &FingerprintTable::size)
+      .def("getRoot",
+           [](const FingerprintTable& table) { return convertFingerprint(table.getRoot()); })
+      .def("get",
+           [](const FingerprintTable& table, u32 offset) {
+             return convertFingerprint(table.get(offset));
+           },
+           "offset"_a)
+      .def("get",
+           [](const FingerprintTable& table, const ItemData& item) {
+             return convertFingerprint(table.get(item));
+           },
+           "item"_a);
+
+  // diff.h
+  m.def("diff",
+        [](const Reader& from, const Reader& to, const FingerprintTable* fromFingerprints,
+           const FingerprintTable* toFingerprints) {
+          const auto entries = [&] {
+            py::gil_scoped_release release;
+            return diff(from, to, {fromFingerprints, toFingerprints});
+          }();
+          if (!entries)
+            throw std::invalid_argument{"invalid document"};
+          PythonConverter fromConverter{from};
+          PythonConverter toConverter{to};
+          py::list result{entries->size()};
+          for (size_t i = 0; i < entries->size(); ++i) {
+            const DiffEntry& entry = (*entries)[i];
+            const char* op = entry.op == DiffEntry::Op::Add ?
+                                 "add" :
+                                 entry.op == DiffEntry::Op::Remove ? "remove" : "change";
+            result[i] = py::make_tuple(
+                op, convertPath(entry.path),
+                entry.from ? fromConverter.convert(*entry.from) : py::object(py::none()),
+                entry.to ? toConverter.convert(*entry.to) : py::object(py::none()));
+          }
+          return result;
+        },
+        "from"_a, "to"_a, "fromFingerprints"_a = nullptr, "toFingerprints"_a = nullptr);
+
+  // patch.h
+  m.def("applyPatch",
+        [](const Reader& source, const std::vector<py::tuple>& edits) {
+          // Keys are copied so that paths can refer to them.
+          std::deque<std::string> keys;
+          std::vector<PatchEdit> patchEdits;
+          for (const py::tuple& edit : edits) {
+            if (edit.size() < 2 || edit.size() > 3)
+              throw std::invalid_argument{"edits must be (op, path[, value]) tuples"};
+            PatchEdit patchEdit{};
+            const std::string op = edit[0].cast<std::string>();
+            if (op == "set")
+              patchEdit.op = PatchEdit::Op::Set;
+            else if (op == "remove")
+              patchEdit.op = PatchEdit::Op::Remove;
+            else if (op == "append")
+              patchEdit.op = PatchEdit::Op::Append;
+            else
+              throw std::invalid_argument{"unknown op: " + op};
+            for (const py::handle element : edit[1]) {
+              if (py::isinstance<py::str>(element)) {
+                keys.push_back(element.cast<std::string>());
+                patchEdit.path.push_back(PathElement::makeKey(keys.back()));
+              } else {
+                patchEdit.path.push_back(PathElement::makeIndex(element.cast<u32>()));
+              }
+            }
+            if (edit.size() == 3 && !edit[2].is_none())
+              patchEdit.value = edit[2].cast<Node>();
+            patchEdits.push_back(std::move(patchEdit));
+          }
+          const auto data = [&] {
+            py::gil_scoped_release release;
+            return applyPatch(source, patchEdits);
+          }();
+          if (!data)
+            throw std::invalid_argument{"failed to apply patch"};
+          return py::bytes(reinterpret_cast<const char*>(data->data()), data->size());
+        },
+        "source"_a, "edits"_a);
+
+  // string_index.h
+  py::class_<StringIndex>(m, "StringIndex")
+      .def_static("open",
+                  [](const std::string& path) {
+                    if (auto index = StringIndex::open(path))
+                      return std::move(*index);
+                    throw std::runtime_error{"failed to open " + path};
+                  },
+                  "path"_a)
+      .def("numFiles", &StringIndex::numFiles)
+      .def("numStrings", &StringIndex::numStrings)
+      .def("find",
+           [](const StringIndex& index, std::string_view string) {
+             py::list result;
+             for (const StringIndex::Hit& hit : index.find(string)) {
+               const std::string_view path = index.getFile(hit.file).path;
+               result.append(py::make_tuple(py::str(path.data(), path.size()), hit.isKey,
+                                            hit.isValue));
+             }
+             return result;
+           },
+           "string"_a)
+      .def("findPrefix", &StringIndex::findPrefix, "prefix"_a, "limit"_a = size_t(-1));
+
+  m.def("updateStringIndex",
+        [](const std::string& indexPath, const std::vector<std::string>& roots,
+           unsigned numThreads, bool validate) {
+          ScanOptions options;
+          options.numThreads = numThreads;
+          options.validate = validate;
+          StringIndexUpdateStats stats;
+          bool ok;
+          {
+            py::gil_scoped_release release;
+            ok = updateStringIndex(indexPath, roots, options, &stats);
+          }
+          if (!ok)
+            throw std::runtime_error{"failed to write " + indexPath};
+          return py::dict("scanned"_a = stats.numScanned, "reused"_a = stats.numReused,
+                          "removed"_a = stats.numRemoved, "failed"_a = stats.report.numFailed());
+        },
+        "indexPath"_a, "roots"_a, "threads"_a = 0, "validate"_a = true);
+
+  // writer.h
+  py::class_<Writer>(m, "Writer")
+      .def(py::init<u16, bool>(), "version"_a = 2, "bigEndian"_a = false)
+      .def("setKey", &Writer::setKey, "key"_a)
+      .def("beginArray", &Writer::beginArray)
+      .def("beginHash", &Writer::beginHash)
+      .def("end", &Writer::end)
+      .def("addString", &Writer::addString, "value"_a)
+      .def("addBool", &Writer::addBool, "value"_a)
+      .def("addInt", &Writer::addInt, "value"_a)
+      .def("addUInt", &Writer::addUInt, "value"_a)
+      .def("addFloat", &Writer::addFloat, "value"_a)
+      .def("addInt64", &Writer::addInt64, "value"_a)
+      .def("addUInt64", &Writer::addUInt64, "value"_a)
+      .def("addDouble", &Writer::addDouble, "value"_a)
+      .def("addNull", &Writer::addNull)
+      .def("add", &Writer::add, "item"_a)
+      .def("isOk", &Writer::isOk)
+      .def("finish",
+           [](const Writer& writer) {
+             if (auto data = writer.finish())
+               return py::bytes(reinterpret_cast<const char*>(data->data()), data->size());
+             throw std::invalid_argument{"invalid or incomplete document"};
+           })
+      .def_static("write",
+                  [](const Reader& reader, u16 version, bool bigEndian) {
+                    if (auto data = Writer::write(reader, version, bigEndian))
+                      return py::bytes(reinterpret_cast<const char*>(data->data()), data->size());
+                    throw std::invalid_argument{"failed to write document"};
+                  },
+                  "reader"_a, "version"_a, "bigEndian"_a);
+
+  // text.h
+  py::enum_<TextFormat>(m, "TextFormat")
+      .value("Yaml", TextFormat::Yaml)
+      .value("Json", TextFormat::Json);
+  m.def("toText",
+        [](const Reader& reader, TextFormat format) {
+          std::optional<std::string> text;
+          {
+            py::gil_scoped_release release;
+            text = toText(reader, format);
+          }
+          if (!text)
+            throw std::invalid_argument{"invalid document"};
+          return py::str(*text);
+        },
+        "reader"_a, "format"_a);
+  m.def("writeText",
+        [](const Reader& reader, TextFormat format, int fd) {
+          if (!writeText(reader, format, fd))
+            throw std::runtime_error{"invalid document or write error"};
+        },
+        "reader"_a, "format"_a, "fd"_a, py::call_guard<py::gil_scoped_release>());
+  m.def("fromText",
+        [](const py::str& text, u16 version, bool bigEndian) {
+          Py_ssize_t size;
+          const char* utf8 = PyUnicode_AsUTF8AndSize(text.ptr(), &size);
+          if (!utf8)
+            throw py::error_already_set();
+          std::optional<std::vector<u8>> data;
+          {
+            py::gil_scoped_release release;
+            data = fromText({utf8, static_cast<size_t>(size)}, version, bigEndian);
+          }
+          if (!data)
+            throw std::invalid_argument{"failed to convert text"};
+          return py::bytes(reinterpret_cast<const char*>(data->data()), data->size());
+        },
+        "text"_a, "version"_a = 2, "bigEndian"_a = false);
+
   // value.h
-  registerBymlContainerClass<Array>(m, "Array")
-      .def("__iter__", [](const Array& a) { return rangeToIter(a); }, py::keep_alive<0, 1>());
+  registerBymlContainerClass<Array>(m, "Array", py::buffer_protocol())
+      .def("__iter__", [](const Array& a) { return rangeToIter(a); }, py::keep_alive<0, 1>())
+      .def("toPython", [](const Array& a) { return PythonConverter{a.getReader()}.convert(a); })
+      .def("getNodeType", &Array::getNodeType)
+      .def("isMonoTyped", &Array::isMonoTyped)
+      .def("toNumpy",
+           [](py::object self) { return toNumpy(self.cast<const Array&>(), self); })
+      .def("gatherNumpy",
+           [](const Array& a, const char* key) {
+             if (const auto id = a.getReader().findKey(key))
+               return gatherNumpy(a, *id);
+             throw py::key_error{key};
+           },
+           "key"_a)
+      .def("gatherNumpy", &gatherNumpy, "key"_a)
+      .def_buffer([](const Array& a) {
+        // Only arrays of 32-bit values can be exposed without making a copy.
+        // Boolean items are exposed as 32-bit integers.
+        const NodeType type = a.numItems() == 0 ? NodeType::Float : getNumericType(a);
+        if (getNumericSize(type) != 4u)
+          throw py::buffer_error{"64-bit values cannot be exposed as a buffer"};
+        const char* code = type == NodeType::Float ? "f" : type == NodeType::Int ? "i" : "I";
+        return py::buffer_info(const_cast<u8*>(a.getRawValues()), 4,
+                               getByteOrder(a.getReader()) + std::string{code}, a.numItems(), true);
+      });
 
   registerBymlContainerClass<Hash>(m, "Hash")
       .def("__getitem__",
@@ -98,11 +1071,45 @@ PYBIND11_MODULE(bymlplus, m) {
              throw py::key_error{key};
            },
            "key"_a, py::keep_alive<0, 1>())
+      .def("__getitem__",
+           [](const Hash& h, KeyId key) {
+             if (auto value = h.getByKey(key))
+               return *value;
+             throw py::key_error{std::to_string(key.index)};
+           },
+           "key"_a, py::keep_alive<0, 1>())
       .def("__contains__", [](const Hash& h, const char* k) { return h.contains(k); }, "key"_a)
+      .def("__contains__", [](const Hash& h, KeyId k) { return h.contains(k); }, "key"_a)
       .def("__iter__", [](const Hash& h) { return rangeToIter(h.keys()); }, py::keep_alive<0, 1>())
       .def("keys", [](const Hash& h) { return rangeToIter(h.keys()); }, py::keep_alive<0, 1>())
       .def("values", [](const Hash& h) { return rangeToIter(h.values()); }, py::keep_alive<0, 1>())
-      .def("items", [](const Hash& h) { return rangeToIter(h); }, py::keep_alive<0, 1>());
+      .def("items", [](const Hash& h) { return rangeToIter(h); }, py::keep_alive<0, 1>())
+      .def("toPython", [](const Hash& h) { return PythonConverter{h.getReader()}.convert(h); });
+
+  // Integer keys would be ambiguous with indices, so items are looked up with getByKey.
+  registerBymlContainerClass<Hash32>(m, "Hash32")
+      .def("getNodeType", &Hash32::getNodeType)
+      .def("getByKey",
+           [](const Hash32& h, u32 key) {
+             if (auto value = h.getByKey(key))
+               return *value;
+             throw py::key_error{std::to_string(key)};
+           },
+           "key"_a, py::keep_alive<0, 1>())
+      .def("__contains__", [](const Hash32& h, u32 key) { return h.contains(key); }, "key"_a)
+      .def("__iter__", [](const Hash32& h) { return rangeToIter(h.keys()); },
+           py::keep_alive<0, 1>())
+      .def("keys", [](const Hash32& h) { return rangeToIter(h.keys()); }, py::keep_alive<0, 1>())
+      .def("values", [](const Hash32& h) { return rangeToIter(h.values()); },
+           py::keep_alive<0, 1>())
+      .def("items", [](const Hash32& h) { return rangeToIter(h); }, py::keep_alive<0, 1>())
+      .def("toPython", [](const Hash32& h) { return PythonConverter{h.getReader()}.convert(h); });
+
+  py::class_<KeyId>(m, "KeyId")
+      .def_readonly("index", &KeyId::index)
+      .def("__eq__", [](KeyId a, KeyId b) { return a == b; })
+      .def("__hash__", [](KeyId k) { return k.index; })
+      .def("__repr__", [](KeyId k) { return py::str("<byml.KeyId index={}>").format(k.index); });
 
   py::class_<RawItemData>(m, "RawItemData")
       .def_readonly("raw", &RawItemData::raw)
@@ -112,6 +1119,7 @@ PYBIND11_MODULE(bymlplus, m) {
       .def_readonly("raw", &ItemData::raw)
       .def("getHash", &ItemData::getHash, py::keep_alive<0, 1>())
       .def("getArray", &ItemData::getArray, py::keep_alive<0, 1>())
+      .def("getHash32", &ItemData::getHash32, py::keep_alive<0, 1>())
       .def("getString", &ItemData::getString)
       .def("getBool", &ItemData::getBool)
       .def("getInt", &ItemData::getInt)
@@ -120,24 +1128,31 @@ PYBIND11_MODULE(bymlplus, m) {
       .def("getInt64", &ItemData::getInt64)
       .def("getUInt64", &ItemData::getUInt64)
       .def("getDouble", &ItemData::getDouble)
+      // The buffer refers to the document's data and supports the buffer protocol.
+      .def("getBinary", &ItemData::getBinary, py::keep_alive<0, 1>())
+      .def("getBinaryAlignment", &ItemData::getBinaryAlignment)
       .def("val",
            [](const ItemData& i) {
-             auto v = i.val();
              // Forbid using val() to get containers because of lifetime issues.
-             if (std::holds_alternative<Hash>(v) || std::holds_alternative<Array>(v))
-               throw std::invalid_argument{"use getHash or getArray for container items"};
-             return v;
+             // (Binary data is copied for the same reason.)
+             if (isAnyContainerType(i.raw.type))
+               throw std::invalid_argument{"use getHash, getArray or getHash32 for containers"};
+             return getValue(i);
            })
-      .def("valu", &ItemData::val,
+      .def("valu", &getValue,
            "Unsafe variant: same as val() but assumes that the user will keep the reader instance "
            "valid as long as necessary.")
       .def("__repr__",
-           [](const ItemData& i) { return py::str("<byml.ItemData: {}>").format(i.val()); });
+           [](const ItemData& i) { return py::str("<byml.ItemData: {}>").format(reprValue(i)); });
+
+  py::class_<Hash32Item>(m, "Hash32Item")
+      .def_readonly("key", &Hash32Item::key)
+      .def_readonly("data", &Hash32Item::data);
 
   py::class_<HashItem>(m, "HashItem")
       .def_readonly("name", &HashItem::name)
       .def_readonly("data", &HashItem::data)
       .def("__repr__", [](const HashItem& i) {
-        return py::str("<byml.HashItem: {} = {}>").format(i.name, i.data.val());
+        return py::str("<byml.HashItem: {} = {}>").format(i.name, reprValue(i.data));
       });
 }
@@ -3,31 +3,56 @@
 
 #include "byml/byml.h"
 
+#include <atomic>
 #include <cstring>
+#include <memory>
+#include <new>
+#include <variant>
+#include <vector>
 
 #include "byml/binary_format.h"
 #include "byml/container_util.h"
+#include "byml/key_index.h"
 #include "byml/value.h"
+#include "byml/yaz0.h"
 #include "common/binary_reader.h"
 #include "common/log.h"
+#include "common/mapped_file.h"
+#include "common/simd.h"
+#include "common/thread_pool.h"
 
 namespace byml {
 
 namespace {
+template <typename BR>
 struct NodeCheckContext {
-  common::BinaryReader br;
+  /// Get a copy of this context that uses a different reader.
+  template <typename OtherBR>
+  NodeCheckContext<OtherBR> withReader(OtherBR other) const {
+    return {other, bufferSize, hashKeyTableLen, stringTableLen, checkReferencedStrings,
+            hashKeyTableOffset, stringTableOffset};
+  }
+
+  BR br;
   u32 bufferSize = 0;
   u32 hashKeyTableLen = 0;
   u32 stringTableLen = 0;
+  /// Whether strings that are referenced by containers should be checked individually.
+  /// This is used when the string tables have not been checked as a whole.
+  bool checkReferencedStrings = false;
+  u32 hashKeyTableOffset = 0;
+  u32 stringTableOffset = 0;
 };
 
-bool checkStringTable(const NodeCheckContext& ctx, u64 offset, u32* numItems) {
+/// Check the string table header and offsets. This does not check the strings themselves.
+template <typename BR>
+bool checkStringTableHeader(const NodeCheckContext<BR>& ctx, u64 offset, u32* numItems) {
   DEBUG_LOG("Checking string table node at offset 0x{:x}", offset);
 
   if (ctx.bufferSize < offset + 4)
     return false;
 
-  const auto type = NodeType(ctx.br.read<u8>(offset));
+  const auto type = NodeType(ctx.br.template read<u8>(offset));
   if (type != NodeType::StringTable)
     return false;
 
@@ -35,7 +60,58 @@ bool checkStringTable(const NodeCheckContext& ctx, u64 offset, u32* numItems) {
   if (ctx.bufferSize < offset + 4 + 4 * (*numItems + 1))
     return false;
 
-  for (u32 i = 0; i < *numItems; ++i) {
+  return true;
+}
+
+/// Check a string table whose offsets are strictly increasing and whose strings each end before
+/// the next one begins, which is how tables are laid out in practice. The string data is swept
+/// once from front to back, 64 bytes at a time, and the search for a terminator never goes past
+/// the next string. Returns false if the table does not have this layout or if it is malformed.
+template <typename BR>
+bool sweepStringTable(const NodeCheckContext<BR>& ctx, u64 offset, u32 numItems, u32* lengths) {
+  const u8* data = ctx.br.data();
+  u64 stringOffset = numItems != 0 ? util::getStringOffset(ctx.br, offset, 0) : 0;
+  for (u32 i = 0; i < numItems; ++i) {
+    const u64 nextOffset =
+        i + 1 < numItems ? util::getStringOffset(ctx.br, offset, i + 1) : ctx.bufferSize;
+    if (nextOffset <= stringOffset || ctx.bufferSize < nextOffset)
+      return false;
+
+    u64 end;
+    u64 mask;
+    if (stringOffset + 64 <= ctx.bufferSize &&
+        (mask = common::findZeroBytes64(data + stringOffset)) != 0) {
+      end = stringOffset + common::countTrailingZeros(mask);
+    } else {
+      const void* terminator = std::memchr(data + stringOffset, 0, nextOffset - stringOffset);
+      if (!terminator)
+        return false;
+      end = static_cast<const u8*>(terminator) - data;
+    }
+    if (nextOffset <= end)
+      return false;
+
+    if (lengths)
+      lengths[i] = u32(end - stringOffset);
+    stringOffset = nextOffset;
+  }
+  return true;
+}
+
+/// Check that all strings in a string table are in bounds and null terminated.
+/// If `lengths` is not null, it receives the length of each string.
+template <typename BR>
+bool checkStringTableStrings(const NodeCheckContext<BR>& ctx, u64 offset, u32 numItems,
+                             std::vector<u32>* lengths = nullptr) {
+  if (lengths)
+    lengths->resize(numItems);
+  u32* lengthData = lengths ? lengths->data() : nullptr;
+  if (sweepStringTable(ctx, offset, numItems, lengthData))
+    return true;
+
+  // Slow path for tables with an unusual layout (e.g. strings that share their data)
+  // and for malformed tables.
+  for (u32 i = 0; i < numItems; ++i) {
     const u64 stringOffset = util::getStringOffset(ctx.br, offset, i);
     if (ctx.bufferSize <= stringOffset)
       return false;
@@ -47,14 +123,76 @@ bool checkStringTable(const NodeCheckContext& ctx, u64 offset, u32* numItems) {
       ERR_LOG("String at 0x{:x} is too long", stringOffset);
       return false;
     }
+    if (lengthData)
+      lengthData[i] = u32(len);
   }
 
   return true;
 }
 
-bool checkNode(const NodeCheckContext& ctx, u64 data, NodeType type);
+/// Check that a string is in bounds and null terminated.
+template <typename BR>
+bool checkString(const NodeCheckContext<BR>& ctx, u64 tableOffset, u32 idx) {
+  const u64 stringOffset = util::getStringOffset(ctx.br, tableOffset, idx);
+  if (ctx.bufferSize <= stringOffset)
+    return false;
+  return std::memchr(ctx.br.getString(stringOffset), 0, ctx.bufferSize - stringOffset) != nullptr;
+}
+
+/// Check a binary data node. data is an offset to a header whose first field is the size
+/// of the data, which directly follows the header.
+template <typename BR>
+bool checkBinaryData(const NodeCheckContext<BR>& ctx, u64 data, u32 headerSize) {
+  if (ctx.bufferSize < data + headerSize)
+    return false;
+  const u32 size = ctx.br.template read<u32>(data);
+  return data + headerSize + size <= ctx.bufferSize;
+}
+
+/// Check a non-container node. Child containers are checked separately by checkContainerTree.
+template <typename BR>
+bool checkValueNode(const NodeCheckContext<BR>& ctx, u64 data, NodeType type) {
+  switch (type) {
+  case NodeType::String:
+    // data is an index into the string table.
+    return data < ctx.stringTableLen &&
+           (!ctx.checkReferencedStrings || checkString(ctx, ctx.stringTableOffset, data));
+  case NodeType::Binary:
+    // data is an offset to {u32 size, u8 data[size]}.
+    return checkBinaryData(ctx, data, 4);
+  case NodeType::FileData:
+    // data is an offset to {u32 size, u32 alignment, u8 data[size]}.
+    return checkBinaryData(ctx, data, 8);
+  case NodeType::Array:
+  case NodeType::Hash:
+  case NodeType::Hash32:
+  case NodeType::ValueHash32:
+  case NodeType::MonoTypedArray:
+    // data is an offset to the node, which is checked when the tree is walked.
+    return true;
+  case NodeType::Bool:
+  case NodeType::Int:
+  case NodeType::Float:
+  case NodeType::UInt:
+    // Simple value types. Nothing to check.
+    return true;
+  case NodeType::Int64:
+  case NodeType::UInt64:
+  case NodeType::Double:
+    // "Big" value types. data is an offset to a 64-bit value.
+    return data + 8 < ctx.bufferSize;
+  case NodeType::Null:
+    // Another simple value type. Nothing to do.
+    return true;
+  default:
+    ERR_LOG("Unknown node type: 0x{:x}", int(type));
+    return false;
+  }
+}
 
-bool checkArrayNode(const NodeCheckContext& ctx, u64 offset) {
+/// Check an array node and its non-container children.
+template <typename BR>
+bool checkArrayNode(const NodeCheckContext<BR>& ctx, u64 offset) {
   DEBUG_LOG("Checking array node at offset 0x{:x}", offset);
 
   if (ctx.bufferSize < offset + 4) {
@@ -62,7 +200,7 @@ bool checkArrayNode(const NodeCheckContext& ctx, u64 offset) {
     return false;
   }
 
-  if (NodeType(ctx.br.read<u8>(offset)) != NodeType::Array) {
+  if (NodeType(ctx.br.template read<u8>(offset)) != NodeType::Array) {
     ERR_LOG("Unexpected node type");
     return false;
   }
@@ -77,7 +215,7 @@ bool checkArrayNode(const NodeCheckContext& ctx, u64 offset) {
 
   for (u32 i = 0; i < numItems; ++i) {
     const auto item = util::readArrayItem(ctx.br, typesOffset, valuesOffset, i);
-    if (!checkNode(ctx, item.raw, item.type)) {
+    if (!checkValueNode(ctx, item.raw, item.type)) {
       ERR_LOG("Node check failed for array @ 0x{:x}, child {} with type 0x{:x} and data 0x{:x}",
               offset, i, int(item.type), item.raw);
       return false;
@@ -87,7 +225,50 @@ bool checkArrayNode(const NodeCheckContext& ctx, u64 offset) {
   return true;
 }
 
-bool checkHashNode(const NodeCheckContext& ctx, u64 offset) {
+/// Check a monotyped array node and its non-container children.
+template <typename BR>
+bool checkMonoTypedArrayNode(const NodeCheckContext<BR>& ctx, u64 offset) {
+  DEBUG_LOG("Checking monotyped array node at offset 0x{:x}", offset);
+
+  if (ctx.bufferSize < offset + 8) {
+    ERR_LOG("Buffer is too small: 0x{:x} < 0x{:x}", ctx.bufferSize, offset + 8);
+    return false;
+  }
+
+  if (NodeType(ctx.br.template read<u8>(offset)) != NodeType::MonoTypedArray) {
+    ERR_LOG("Unexpected node type");
+    return false;
+  }
+
+  const u32 numItems = util::readContainerSize(ctx.br, offset);
+  const u64 valuesOffset = util::getMonoTypedArrayValuesOffset(offset);
+  if (ctx.bufferSize < valuesOffset + 4 * numItems) {
+    ERR_LOG("Buffer is too small: 0x{:x} < 0x{:x}", ctx.bufferSize, valuesOffset + 4 * numItems);
+    return false;
+  }
+
+  // Values of these types are always valid, so they do not need to be looked at.
+  const NodeType type = util::readMonoTypedArrayItemType(ctx.br, offset);
+  if (type == NodeType::Bool || type == NodeType::Int || type == NodeType::Float ||
+      type == NodeType::UInt || type == NodeType::Null) {
+    return true;
+  }
+
+  for (u32 i = 0; i < numItems; ++i) {
+    const u32 value = ctx.br.template read<u32>(valuesOffset + 4 * i);
+    if (!checkValueNode(ctx, value, type)) {
+      ERR_LOG("Node check failed for array @ 0x{:x}, child {} with type 0x{:x} and data 0x{:x}",
+              offset, i, int(type), value);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/// Check a hash node and its non-container children.
+template <typename BR>
+bool checkHashNode(const NodeCheckContext<BR>& ctx, u64 offset) {
   DEBUG_LOG("Checking hash node at offset 0x{:x}", offset);
 
   if (ctx.bufferSize < offset + 4) {
@@ -95,7 +276,7 @@ bool checkHashNode(const NodeCheckContext& ctx, u64 offset) {
     return false;
   }
 
-  if (NodeType(ctx.br.read<u8>(offset)) != NodeType::Hash) {
+  if (NodeType(ctx.br.template read<u8>(offset)) != NodeType::Hash) {
     ERR_LOG("Unexpected node type");
     return false;
   }
@@ -117,7 +298,12 @@ bool checkHashNode(const NodeCheckContext& ctx, u64 offset) {
       return false;
     }
 
-    if (!checkNode(ctx, item.data.raw, item.data.type)) {
+    if (ctx.checkReferencedStrings && !checkString(ctx, ctx.hashKeyTableOffset, item.keyIndex)) {
+      ERR_LOG("Invalid key string: keyIndex={}", item.keyIndex);
+      return false;
+    }
+
+    if (!checkValueNode(ctx, item.data.raw, item.data.type)) {
       ERR_LOG("Node check failed for hash @ 0x{:x}, child {} with type 0x{:x} and data 0x{:x}",
               offset, i, int(item.data.type), item.data.raw);
       return false;
@@ -127,39 +313,371 @@ bool checkHashNode(const NodeCheckContext& ctx, u64 offset) {
   return true;
 }
 
-bool checkNode(const NodeCheckContext& ctx, u64 data, NodeType type) {
+/// Check a Hash32 or ValueHash32 node and its non-container children.
+template <typename BR>
+bool checkHash32Node(const NodeCheckContext<BR>& ctx, u64 offset, NodeType type) {
+  DEBUG_LOG("Checking hash32 node at offset 0x{:x}", offset);
+
+  if (ctx.bufferSize < offset + 4) {
+    ERR_LOG("Buffer is too small: 0x{:x} < 0x{:x}", ctx.bufferSize, offset + 4);
+    return false;
+  }
+
+  if (NodeType(ctx.br.template read<u8>(offset)) != type) {
+    ERR_LOG("Unexpected node type");
+    return false;
+  }
+
+  const u32 numItems = util::readContainerSize(ctx.br, offset);
+  const u64 end = util::getHash32TypesOffset(offset, numItems) + numItems;
+  if (ctx.bufferSize < end) {
+    ERR_LOG("Buffer is too small: 0x{:x} < 0x{:x}", ctx.bufferSize, end);
+    return false;
+  }
+
+  for (u32 i = 0; i < numItems; ++i) {
+    const auto item = util::readHash32Item(ctx.br, offset, type, numItems, i);
+    if (!checkValueNode(ctx, item.data.raw, item.data.type)) {
+      ERR_LOG("Node check failed for hash @ 0x{:x}, child {} with type 0x{:x} and data 0x{:x}",
+              offset, i, int(item.data.type), item.data.raw);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+template <typename BR>
+bool checkContainerNode(const NodeCheckContext<BR>& ctx, u64 offset, NodeType type) {
   switch (type) {
-  case NodeType::String:
-    // data is an index into the string table.
-    return data < ctx.stringTableLen;
   case NodeType::Array:
-    // data is an offset to the node.
-    return checkArrayNode(ctx, data);
+    return checkArrayNode(ctx, offset);
+  case NodeType::MonoTypedArray:
+    return checkMonoTypedArrayNode(ctx, offset);
   case NodeType::Hash:
-    // data is an offset to the node.
-    return checkHashNode(ctx, data);
-  case NodeType::Bool:
-  case NodeType::Int:
-  case NodeType::Float:
-  case NodeType::UInt:
-    // Simple value types. Nothing to check.
+    return checkHashNode(ctx, offset);
+  case NodeType::Hash32:
+  case NodeType::ValueHash32:
+    return checkHash32Node(ctx, offset, type);
+  default:
+    return false;
+  }
+}
+
+/// Walk the container tree starting at the specified root and check every container.
+///
+/// Containers may be shared by several parents, so each container is only checked once.
+/// The walk is iterative to avoid overflowing the stack on deeply nested documents and
+/// references back to a container that is still being walked are rejected as cycles.
+///
+/// If checkContents is false, containers are assumed to have been checked already
+/// and only the tree structure is checked.
+template <typename BR>
+bool checkContainerTree(const NodeCheckContext<BR>& ctx, u64 rootOffset, NodeType rootType,
+                        bool checkContents = true) {
+  struct Frame {
+    u64 offset;
+    NodeType type;
+    u32 numItems;
+    u32 nextItem;
+  };
+
+  // Containers that have been fully checked (including their children)
+  // and containers that are on the current path from the root.
+  std::vector<bool> done(ctx.bufferSize);
+  std::vector<bool> inProgress(ctx.bufferSize);
+  std::vector<Frame> stack;
+
+  const auto enter = [&](u64 offset, NodeType type) {
+    if (checkContents && !checkContainerNode(ctx, offset, type))
+      return false;
+    inProgress[offset] = true;
+    stack.push_back({offset, type, util::readContainerSize(ctx.br, offset), 0});
     return true;
-  case NodeType::Int64:
-  case NodeType::UInt64:
-  case NodeType::Double:
-    // "Big" value types. data is an offset to a 64-bit value.
-    return data + 8 < ctx.bufferSize;
-  case NodeType::Null:
-    // Another simple value type. Nothing to do.
+  };
+
+  if (!enter(rootOffset, rootType))
+    return false;
+
+  while (!stack.empty()) {
+    Frame& frame = stack.back();
+    if (frame.nextItem == frame.numItems) {
+      inProgress[frame.offset] = false;
+      done[frame.offset] = true;
+      stack.pop_back();
+      continue;
+    }
+
+    const u32 i = frame.nextItem++;
+    const RawItemData item =
+        util::readContainerItem(ctx.br, frame.offset, frame.type, frame.numItems, i);
+
+    if (!isAnyContainerType(item.type))
+      continue;
+
+    if (ctx.bufferSize <= item.raw) {
+      ERR_LOG("Container @ 0x{:x}, child {} is out of bounds: 0x{:x}", frame.offset, i, item.raw);
+      return false;
+    }
+
+    if (done[item.raw]) {
+      // The container has been checked already, but possibly as a different type.
+      if (NodeType(ctx.br.template read<u8>(item.raw)) != item.type) {
+        ERR_LOG("Container @ 0x{:x}, child {} has an unexpected node type", frame.offset, i);
+        return false;
+      }
+      continue;
+    }
+
+    if (inProgress[item.raw]) {
+      ERR_LOG("Cycle detected: container @ 0x{:x}, child {} refers to 0x{:x}", frame.offset, i,
+              item.raw);
+      return false;
+    }
+
+    // Note: frame is only invalidated if enter() succeeds.
+    if (!enter(item.raw, item.type)) {
+      ERR_LOG("Node check failed for container @ 0x{:x}, child {} with type 0x{:x} and data 0x{:x}",
+              frame.offset, i, int(item.type), item.raw);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/// Checks every container in a tree on a thread pool.
+///
+/// Each container is claimed by the first task that reaches it, so shared containers are only
+/// checked once. Tasks walk their part of the tree depth first and give away the oldest half of
+/// their pending containers whenever the pool runs out of queued work.
+template <typename BR>
+class ParallelContainerTreeChecker {
+public:
+  ParallelContainerTreeChecker(const NodeCheckContext<BR>& ctx, common::ThreadPool& pool)
+      : mCtx{ctx}, mPool{pool}, mClaimed{new std::atomic<u64>[ctx.bufferSize / 64 + 1]} {
+    for (size_t i = 0; i < ctx.bufferSize / 64 + 1; ++i)
+      mClaimed[i].store(0, std::memory_order_relaxed);
+  }
+
+  /// Start checking the tree. Results are available after the pool has finished all tasks.
+  void start(u64 rootOffset, NodeType rootType) {
+    claim(rootOffset);
+    submit({{rootOffset, rootType}});
+  }
+
+  void fail() { mFailed.store(true, std::memory_order_relaxed); }
+  bool hasFailed() const { return mFailed.load(std::memory_order_relaxed); }
+
+  /// Whether any container refers to a container at a lower or equal offset.
+  /// Cycles are only possible if this is the case.
+  bool hasBackReference() const { return mHasBackReference.load(std::memory_order_relaxed); }
+
+private:
+  struct PendingContainer {
+    u64 offset;
+    NodeType type;
+  };
+
+  /// Returns true if the container was not claimed yet.
+  bool claim(u64 offset) {
+    const u64 mask = u64(1) << (offset % 64);
+    return !(mClaimed[offset / 64].fetch_or(mask, std::memory_order_relaxed) & mask);
+  }
+
+  void submit(std::vector<PendingContainer> containers) {
+    mPool.submit([this, containers = std::move(containers)]() mutable { run(containers); });
+  }
+
+  void run(std::vector<PendingContainer>& stack) {
+    while (!stack.empty() && !hasFailed()) {
+      const PendingContainer container = stack.back();
+      stack.pop_back();
+      if (!checkContainer(container, stack)) {
+        fail();
+        return;
+      }
+
+      constexpr size_t MinSplitSize = 16;
+      if (stack.size() >= MinSplitSize && !mPool.hasQueuedTasks()) {
+        const auto middle = stack.begin() + stack.size() / 2;
+        submit({stack.begin(), middle});
+        stack.erase(stack.begin(), middle);
+      }
+    }
+  }
+
+  bool checkContainer(const PendingContainer& container, std::vector<PendingContainer>& stack) {
+    if (!checkContainerNode(mCtx, container.offset, container.type))
+      return false;
+
+    const u32 numItems = util::readContainerSize(mCtx.br, container.offset);
+    for (u32 i = 0; i < numItems; ++i) {
+      const RawItemData item =
+          util::readContainerItem(mCtx.br, container.offset, container.type, numItems, i);
+
+      if (!isAnyContainerType(item.type))
+        continue;
+
+      if (mCtx.bufferSize <= item.raw) {
+        ERR_LOG("Container @ 0x{:x}, child {} is out of bounds: 0x{:x}", container.offset, i,
+                item.raw);
+        return false;
+      }
+
+      if (item.raw <= container.offset)
+        mHasBackReference.store(true, std::memory_order_relaxed);
+
+      if (claim(item.raw)) {
+        stack.push_back({item.raw, item.type});
+      } else if (NodeType(mCtx.br.template read<u8>(item.raw)) != item.type) {
+        // Another task checks this container against the type it expects; make sure that
+        // this reference agrees with it.
+        ERR_LOG("Container @ 0x{:x}, child {} has an unexpected node type", container.offset, i);
+        return false;
+      }
+    }
     return true;
-  default:
-    ERR_LOG("Unknown node type: 0x{:x}", int(type));
+  }
+
+  const NodeCheckContext<BR>& mCtx;
+  common::ThreadPool& mPool;
+  /// Bitmap of containers that have been claimed by a task.
+  std::unique_ptr<std::atomic<u64>[]> mClaimed;
+  std::atomic<bool> mFailed{false};
+  std::atomic<bool> mHasBackReference{false};
+};
+
+/// Check a document. If a thread pool is specified, the string tables and containers are checked
+/// in parallel; the result is the same either way.
+template <typename BR>
+bool checkDocument(BR br, Buffer buffer, u32 hashKeyTableOffset, u32 stringTableOffset,
+                   u32 rootNodeOffset, common::ThreadPool* pool) {
+  if (buffer.size() <= hashKeyTableOffset || buffer.size() <= stringTableOffset ||
+      buffer.size() <= rootNodeOffset) {
+    return false;
+  }
+
+  NodeCheckContext<BR> ctx{br};
+  ctx.bufferSize = buffer.size();
+  if (hashKeyTableOffset &&
+      !checkStringTableHeader(ctx, hashKeyTableOffset, &ctx.hashKeyTableLen)) {
+    ERR_LOG("Hash key table check failed");
+    return false;
+  }
+  if (stringTableOffset && !checkStringTableHeader(ctx, stringTableOffset, &ctx.stringTableLen)) {
+    ERR_LOG("String table check failed");
+    return false;
+  }
+
+  NodeType rootType = NodeType::Null;
+  if (rootNodeOffset) {
+    // Note: uint64s are used for all user controlled offsets to avoid possible wraparounds.
+    if (buffer.size() < u64(rootNodeOffset) + 1)
+      return false;
+
+    rootType = NodeType(br.template read<u8>(rootNodeOffset));
+    if (!isAnyContainerType(rootType)) {
+      ERR_LOG("Invalid root node type");
+      return false;
+    }
+  }
+
+  if (!pool) {
+    if (hashKeyTableOffset &&
+        !checkStringTableStrings(ctx, hashKeyTableOffset, ctx.hashKeyTableLen)) {
+      ERR_LOG("Hash key table check failed");
+      return false;
+    }
+    if (stringTableOffset && !checkStringTableStrings(ctx, stringTableOffset, ctx.stringTableLen)) {
+      ERR_LOG("String table check failed");
+      return false;
+    }
+    if (rootNodeOffset && !checkContainerTree(ctx, rootNodeOffset, rootType)) {
+      ERR_LOG("Root node check failed");
+      return false;
+    }
+    return true;
+  }
+
+  ParallelContainerTreeChecker<BR> checker{ctx, *pool};
+  const auto checkStringTableAsync = [&](u32 offset, u32 numItems) {
+    if (!offset)
+      return;
+    pool->submit([&ctx, &checker, offset, numItems] {
+      if (!checkStringTableStrings(ctx, offset, numItems)) {
+        ERR_LOG("String table check failed");
+        checker.fail();
+      }
+    });
+  };
+  checkStringTableAsync(hashKeyTableOffset, ctx.hashKeyTableLen);
+  checkStringTableAsync(stringTableOffset, ctx.stringTableLen);
+  if (rootNodeOffset)
+    checker.start(rootNodeOffset, rootType);
+  pool->wait();
+
+  if (checker.hasFailed()) {
+    ERR_LOG("Document check failed");
+    return false;
+  }
+
+  // All containers have been checked. Cycles are impossible if every reference points forward;
+  // otherwise, walk the tree again to look for them.
+  if (checker.hasBackReference() &&
+      !checkContainerTree(ctx, rootNodeOffset, rootType, /* checkContents */ false)) {
+    ERR_LOG("Root node check failed");
     return false;
   }
+
+  return true;
 }
 
 }  // end of anonymous namespace
 
+struct Reader::CheckedAccessState {
+  /// Number of offsets that are covered by a page of the bitmap.
+  static constexpr size_t PageSize = 0x1000;
+
+  ~CheckedAccessState() {
+    for (size_t i = 0; i < numPages; ++i)
+      delete[] pages[i].load(std::memory_order_relaxed);
+  }
+
+  bool isChecked(u32 offset) const {
+    const std::atomic<u64>* page = pages[offset / PageSize].load(std::memory_order_acquire);
+    return page && page[offset % PageSize / 64].load(std::memory_order_relaxed) & getMask(offset);
+  }
+
+  void markChecked(u32 offset) {
+    std::atomic<std::atomic<u64>*>& slot = pages[offset / PageSize];
+    std::atomic<u64>* page = slot.load(std::memory_order_acquire);
+    if (!page) {
+      // Another thread may be allocating the same page.
+      auto* newPage = new std::atomic<u64>[PageSize / 64]();
+      if (slot.compare_exchange_strong(page, newPage, std::memory_order_acq_rel))
+        page = newPage;
+      else
+        delete[] newPage;
+    }
+    page[offset % PageSize / 64].fetch_or(getMask(offset), std::memory_order_relaxed);
+  }
+
+  static u64 getMask(u32 offset) { return u64(1) << (offset % 64); }
+
+  NodeCheckContext<common::BinaryReader> ctx;
+  /// Bitmap of containers that have been checked successfully. Pages are only allocated when
+  /// a container in their range is checked, so the memory that is used is proportional to
+  /// the part of the document that is accessed.
+  std::unique_ptr<std::atomic<std::atomic<u64>*>[]> pages;
+  size_t numPages;
+};
+
+struct Reader::StringLengths {
+  std::vector<u32> keys;
+  std::vector<u32> strings;
+};
+
 Reader::Reader(Buffer buffer) : mBuffer{buffer} {
   if (mBuffer.size() < sizeof(ResHeader))
     return;
@@ -173,7 +691,7 @@ Reader::Reader(Buffer buffer) : mBuffer{buffer} {
   const common::BinaryReader br{mBuffer, mBigEndian};
 
   const u16 version = br.read<u16>(offsetof(ResHeader, version));
-  if (version != 2 && version != 3) {
+  if (version < 2 || version > 7) {
     ERR_LOG("Unknown version: {}", version);
     return;
   }
@@ -184,76 +702,376 @@ Reader::Reader(Buffer buffer) : mBuffer{buffer} {
   mHasValidHeader = true;
 }
 
+Reader::Reader(Buffer buffer, std::shared_ptr<const void> storage) : Reader{buffer} {
+  mStorage = std::move(storage);
+}
+
 Reader::~Reader() = default;
 
+std::optional<Reader> Reader::openFile(const std::string& path) {
+  auto file = common::MappedFile::open(path);
+  if (!file) {
+    ERR_LOG("Failed to open {}", path);
+    return {};
+  }
+  const Buffer buffer{file->data(), file->size()};
+  if (yaz0::isCompressed(buffer))
+    return fromCompressed(buffer);
+  return Reader{buffer, std::move(file)};
+}
+
+std::optional<Reader> Reader::fromCompressed(Buffer data) {
+  const auto size = yaz0::getDecompressedSize(data);
+  if (!size)
+    return {};
+
+  std::shared_ptr<u8[]> decompressed{new (std::nothrow) u8[*size]};
+  if (!decompressed) {
+    ERR_LOG("Failed to allocate 0x{:x} bytes for decompressed data", *size);
+    return {};
+  }
+  if (!yaz0::decompress(data, decompressed.get(), *size))
+    return {};
+  return Reader{{decompressed.get(), *size}, std::move(decompressed)};
+}
+
+namespace {
+std::optional<Reader> loadBuffer(Buffer buffer) {
+  if (yaz0::isCompressed(buffer))
+    return Reader::fromCompressed(buffer);
+  return Reader{buffer};
+}
+
+/// Load documents in parallel. `load` is called on worker threads for each input.
+template <typename Input, typename LoadFn>
+std::vector<std::optional<Reader>> loadInParallel(const std::vector<Input>& inputs,
+                                                  unsigned numThreads, const LoadOptions& options,
+                                                  LoadFn load) {
+  std::vector<std::optional<Reader>> readers(inputs.size());
+  if (inputs.empty())
+    return readers;
+  common::ThreadPool pool{numThreads};
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    pool.submit([&, i] {
+      std::optional<Reader> reader = load(inputs[i]);
+      if (reader && options.validate && !reader->isValid())
+        reader.reset();
+      // Documents that have not been validated must not be read without checks.
+      if (reader && !options.validate)
+        reader->setCheckedAccess(true);
+      if (reader && options.buildKeyIndex && !reader->buildKeyIndex())
+        reader.reset();
+      readers[i] = std::move(reader);
+    });
+  }
+  pool.wait();
+  return readers;
+}
+}  // end of anonymous namespace
+
+std::vector<std::optional<Reader>> Reader::openFiles(const std::vector<std::string>& paths,
+                                                     unsigned numThreads,
+                                                     const LoadOptions& options) {
+  return loadInParallel(paths, numThreads, options,
+                        [](const std::string& path) { return openFile(path); });
+}
+
+std::vector<std::optional<Reader>> Reader::fromBuffers(const std::vector<Buffer>& buffers,
+                                                       unsigned numThreads,
+                                                       const LoadOptions& options) {
+  return loadInParallel(buffers, numThreads, options, loadBuffer);
+}
+
+std::vector<std::optional<Reader>> Reader::loadMany(const std::vector<LoadInput>& inputs,
+                                                    unsigned numThreads,
+                                                    const LoadOptions& options) {
+  return loadInParallel(inputs, numThreads, options, [](const LoadInput& input) {
+    if (const auto* path = std::get_if<std::string>(&input))
+      return openFile(*path);
+    return loadBuffer(std::get<Buffer>(input));
+  });
+}
+
 bool Reader::isValid() const {
   if (!mHasValidHeader)
     return false;
+  return common::withStaticReader(mBuffer, mBigEndian, [&](auto br) {
+    return checkDocument(br, mBuffer, mHashKeyTableOffset, mStringTableOffset, mRootNodeOffset,
+                         nullptr);
+  });
+}
 
-  const common::BinaryReader br{mBuffer, mBigEndian};
+bool Reader::isValidParallel(unsigned numThreads) const {
+  if (!mHasValidHeader)
+    return false;
+  common::ThreadPool pool{numThreads};
+  return isValidParallel(pool);
+}
 
-  if (mBuffer.size() <= mHashKeyTableOffset || mBuffer.size() <= mStringTableOffset ||
-      mBuffer.size() <= mRootNodeOffset) {
+bool Reader::isValidParallel(common::ThreadPool& pool) const {
+  if (!mHasValidHeader)
+    return false;
+  try {
+    return common::withStaticReader(mBuffer, mBigEndian, [&](auto br) {
+      return checkDocument(br, mBuffer, mHashKeyTableOffset, mStringTableOffset, mRootNodeOffset,
+                           &pool);
+    });
+  } catch (const std::bad_alloc&) {
+    // Thrown on the calling thread or rethrown by ThreadPool::wait() if a task ran out of memory.
+    ERR_LOG("Out of memory while checking the document");
     return false;
   }
+}
 
-  NodeCheckContext ctx{br};
+void Reader::setCheckedAccess(bool enabled) {
+  if (!enabled) {
+    mCheckedAccess.reset();
+    return;
+  }
+
+  std::shared_ptr<CheckedAccessState> state{
+      new CheckedAccessState{{{mBuffer, mBigEndian}}, nullptr, 0}};
+  auto& ctx = state->ctx;
   ctx.bufferSize = mBuffer.size();
-  if (mHashKeyTableOffset && !checkStringTable(ctx, mHashKeyTableOffset, &ctx.hashKeyTableLen)) {
-    ERR_LOG("Hash key table check failed");
-    return false;
+  ctx.checkReferencedStrings = true;
+  // If the header or a table is invalid, the table lengths are left at 0, which makes any container
+  // that refers to the table fail the checks.
+  if (mHasValidHeader) {
+    if (mHashKeyTableOffset && mHashKeyTableOffset < mBuffer.size() &&
+        checkStringTableHeader(ctx, mHashKeyTableOffset, &ctx.hashKeyTableLen)) {
+      ctx.hashKeyTableOffset = mHashKeyTableOffset;
+    } else {
+      ctx.hashKeyTableLen = 0;
+    }
+    if (mStringTableOffset && mStringTableOffset < mBuffer.size() &&
+        checkStringTableHeader(ctx, mStringTableOffset, &ctx.stringTableLen)) {
+      ctx.stringTableOffset = mStringTableOffset;
+    } else {
+      ctx.stringTableLen = 0;
+    }
   }
-  if (mStringTableOffset && !checkStringTable(ctx, mStringTableOffset, &ctx.stringTableLen)) {
-    ERR_LOG("String table check failed");
+
+  state->numPages = mBuffer.size() / CheckedAccessState::PageSize + 1;
+  state->pages.reset(new std::atomic<std::atomic<u64>*>[state->numPages]());
+
+  mCheckedAccess = std::move(state);
+}
+
+bool Reader::checkContainerOnAccess(u32 offset, NodeType type) const {
+  if (!mCheckedAccess)
+    return true;
+
+  CheckedAccessState& state = *mCheckedAccess;
+  if (!mHasValidHeader || state.ctx.bufferSize <= offset)
+    return false;
+
+  if (state.isChecked(offset))
+    return NodeType(mBuffer[offset]) == type;
+
+  const bool ok = common::withStaticReader(mBuffer, mBigEndian, [&](auto br) {
+    return checkContainerNode(state.ctx.withReader(br), offset, type);
+  });
+  if (!ok)
     return false;
+  state.markChecked(offset);
+  return true;
+}
+
+std::optional<KeyId> Reader::findKey(const char* key) const {
+  if (!mHasValidHeader || !mHashKeyTableOffset)
+    return {};
+
+  if (mKeyIndex) {
+    if (const auto index = mKeyIndex->find(key))
+      return KeyId{*index};
+    return {};
   }
 
-  if (mRootNodeOffset) {
-    // Note: uint64s are used for all user controlled offsets to avoid possible wraparounds.
-    if (mBuffer.size() < u64(mRootNodeOffset) + 1)
-      return false;
+  if (const auto index = findInStringTable(mHashKeyTableOffset, key))
+    return KeyId{*index};
+  return {};
+}
 
-    const auto type = NodeType(br.read<u8>(mRootNodeOffset));
-    if (type != NodeType::Array && type != NodeType::Hash) {
-      ERR_LOG("Invalid root node type");
-      return false;
-    }
+std::optional<u32> Reader::findString(const char* string) const {
+  if (!mHasValidHeader || !mStringTableOffset)
+    return {};
+  return findInStringTable(mStringTableOffset, string);
+}
 
-    if (!checkNode(ctx, mRootNodeOffset, type)) {
-      ERR_LOG("Root node check failed");
-      return false;
+size_t Reader::getNumKeys() const {
+  return getStringTableSize(mHashKeyTableOffset);
+}
+
+const char* Reader::getKey(u32 index) const {
+  return getStringFromTable(mHashKeyTableOffset, index);
+}
+
+size_t Reader::getNumStrings() const {
+  return getStringTableSize(mStringTableOffset);
+}
+
+const char* Reader::getString(u32 index) const {
+  return getStringFromTable(mStringTableOffset, index);
+}
+
+std::optional<std::string_view> Reader::getKeyView(u32 index) const {
+  return getStringViewFromTable(mHashKeyTableOffset, index);
+}
+
+std::optional<std::string_view> Reader::getStringView(u32 index) const {
+  return getStringViewFromTable(mStringTableOffset, index);
+}
+
+u32 Reader::getStringTableSize(u32 tableOffset) const {
+  if (!mHasValidHeader || !tableOffset)
+    return 0;
+  if (mCheckedAccess) {
+    return tableOffset == mHashKeyTableOffset ? mCheckedAccess->ctx.hashKeyTableLen :
+                                                mCheckedAccess->ctx.stringTableLen;
+  }
+  return util::readContainerSize(common::BinaryReader{mBuffer, mBigEndian}, tableOffset);
+}
+
+const char* Reader::getStringFromTable(u32 tableOffset, u32 index) const {
+  if (index >= getStringTableSize(tableOffset))
+    return nullptr;
+  if (mCheckedAccess && !checkString(mCheckedAccess->ctx, tableOffset, index))
+    return nullptr;
+  const common::BinaryReader br{mBuffer, mBigEndian};
+  return br.getString(util::getStringOffset(br, tableOffset, index));
+}
+
+std::optional<std::string_view> Reader::getStringViewFromTable(u32 tableOffset,
+                                                               u32 index) const {
+  if (mStringLengths) {
+    const std::vector<u32>& lengths = tableOffset == mHashKeyTableOffset ? mStringLengths->keys :
+                                                                           mStringLengths->strings;
+    if (!tableOffset || index >= lengths.size())
+      return {};
+    const common::BinaryReader br{mBuffer, mBigEndian};
+    return std::string_view{br.getString(util::getStringOffset(br, tableOffset, index)),
+                            lengths[index]};
+  }
+  const char* string = getStringFromTable(tableOffset, index);
+  if (!string)
+    return {};
+  return std::string_view{string};
+}
+
+std::optional<u32> Reader::findInStringTable(u32 tableOffset, const char* string) const {
+  // String tables are sorted, so a binary search can be performed here.
+  s32 a = 0;
+  s32 b = s32(getStringTableSize(tableOffset)) - 1;
+  while (a <= b) {
+    s32 m = (a + b) / 2;
+    const char* name = getStringFromTable(tableOffset, m);
+    if (!name)
+      return {};
+    const int cmp = std::strcmp(name, string);
+    if (cmp < 0)
+      a = m + 1;
+    else if (cmp > 0)
+      b = m - 1;
+    else
+      return u32(m);
+  }
+  return {};
+}
+
+bool Reader::buildKeyIndex() {
+  if (!mHasValidHeader)
+    return false;
+
+  const common::BinaryReader br{mBuffer, mBigEndian};
+  u32 numKeys = 0;
+  if (mHashKeyTableOffset) {
+    if (mCheckedAccess) {
+      const auto& ctx = mCheckedAccess->ctx;
+      if (ctx.hashKeyTableOffset != mHashKeyTableOffset)
+        return false;
+      numKeys = ctx.hashKeyTableLen;
+      for (u32 i = 0; i < numKeys; ++i) {
+        if (!checkString(ctx, mHashKeyTableOffset, i))
+          return false;
+      }
+    } else {
+      numKeys = util::readContainerSize(br, mHashKeyTableOffset);
     }
   }
 
+  mKeyIndex = std::make_shared<KeyIndex>(br, mHashKeyTableOffset, numKeys);
+  return true;
+}
+
+bool Reader::buildStringLengths() {
+  if (!mHasValidHeader)
+    return false;
+
+  auto lengths = std::make_shared<StringLengths>();
+  const bool ok = common::withStaticReader(mBuffer, mBigEndian, [&](auto br) {
+    NodeCheckContext<decltype(br)> ctx{br};
+    ctx.bufferSize = mBuffer.size();
+    const auto checkTable = [&](u32 offset, std::vector<u32>* tableLengths) {
+      u32 numItems = 0;
+      return !offset || (checkStringTableHeader(ctx, offset, &numItems) &&
+                         checkStringTableStrings(ctx, offset, numItems, tableLengths));
+    };
+    return checkTable(mHashKeyTableOffset, &lengths->keys) &&
+           checkTable(mStringTableOffset, &lengths->strings);
+  });
+  if (!ok)
+    return false;
+  mStringLengths = std::move(lengths);
   return true;
 }
 
-static bool checkRootNodeType(const u8* data, u32 offset, NodeType type) {
-  return offset && NodeType(data[offset]) == type;
+static bool checkRootNodeType(Buffer buffer, u32 offset, NodeType type) {
+  return offset && offset < buffer.size() && NodeType(buffer[offset]) == type;
 }
 
 bool Reader::isArray() const {
-  return checkRootNodeType(mBuffer, mRootNodeOffset, NodeType::Array);
+  return checkRootNodeType(mBuffer, mRootNodeOffset, NodeType::Array) ||
+         checkRootNodeType(mBuffer, mRootNodeOffset, NodeType::MonoTypedArray);
 }
 
 bool Reader::isHash() const {
   return checkRootNodeType(mBuffer, mRootNodeOffset, NodeType::Hash);
 }
 
+bool Reader::isHash32() const {
+  return checkRootNodeType(mBuffer, mRootNodeOffset, NodeType::Hash32) ||
+         checkRootNodeType(mBuffer, mRootNodeOffset, NodeType::ValueHash32);
+}
+
 u16 Reader::getVersion() const {
   return common::BinaryReader{mBuffer, mBigEndian}.read<u16>(offsetof(ResHeader, version));
 }
 
+std::optional<ItemData> Reader::getRoot() const {
+  if (!mRootNodeOffset || mBuffer.size() <= mRootNodeOffset)
+    return {};
+  const auto type = NodeType(mBuffer[mRootNodeOffset]);
+  if (!isAnyContainerType(type) || !checkContainerOnAccess(mRootNodeOffset, type))
+    return {};
+  return ItemData{*this, {mRootNodeOffset, type}};
+}
+
 std::optional<Array> Reader::getArray() const {
-  if (!isArray())
+  if (!isArray() || !checkContainerOnAccess(mRootNodeOffset, NodeType(mBuffer[mRootNodeOffset])))
     return {};
   return Array{*this, mRootNodeOffset};
 }
 
 std::optional<Hash> Reader::getHash() const {
-  if (!isHash())
+  if (!isHash() || !checkContainerOnAccess(mRootNodeOffset, NodeType::Hash))
     return {};
   return Hash{*this, mRootNodeOffset};
 }
 
+std::optional<Hash32> Reader::getHash32() const {
+  if (!isHash32() || !checkContainerOnAccess(mRootNodeOffset, NodeType(mBuffer[mRootNodeOffset])))
+    return {};
+  return Hash32{*this, mRootNodeOffset};
+}
+
 }  // namespace byml
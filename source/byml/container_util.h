@@ -2,20 +2,56 @@
 // Licensed under GPLv2+
 #pragma once
 
+#include <cstring>
+#include <string_view>
+#include <vector>
+
 #include "byml/binary_format.h"
 #include "byml/types.h"
 #include "byml/value.h"
 #include "common/align.h"
 #include "common/binary_reader.h"
+#include "common/binary_writer.h"
 
 namespace byml::util {
 
-inline u64 getStringOffset(common::BinaryReader br, u64 tableOffset, u32 idx) {
-  return tableOffset + br.read<u32>(tableOffset + 4 + 4 * idx);
+// The functions that read data are templated on the reader type so that they can be used
+// with common::BinaryReader as well as with common::StaticBinaryReader in hot code.
+
+// String table utilities.
+
+template <typename BR>
+inline u64 getStringOffset(BR br, u64 tableOffset, u32 idx) {
+  return tableOffset + br.template read<u32>(tableOffset + 4 + 4 * idx);
+}
+
+/// Get the size of a string table with the specified strings (sorted), including padding.
+inline u32 getStringTableSize(const std::vector<std::string_view>& strings) {
+  if (strings.empty())
+    return 0;
+  size_t size = 4 + 4 * (strings.size() + 1);
+  for (const std::string_view string : strings)
+    size += string.size() + 1;
+  return common::AlignUp(static_cast<u32>(size), 4);
+}
+
+/// Write a string table. The strings must be sorted and null terminated.
+inline void writeStringTable(const common::BinaryWriter& writer, u32 offset,
+                             const std::vector<std::string_view>& strings) {
+  writer.write<u8>(offset, u8(NodeType::StringTable));
+  writer.writeU24(offset + 1, strings.size());
+  u32 stringOffset = 4 + 4 * (strings.size() + 1);
+  for (size_t i = 0; i < strings.size(); ++i) {
+    writer.write<u32>(offset + 4 + 4 * i, stringOffset);
+    std::memcpy(writer.data() + offset + stringOffset, strings[i].data(), strings[i].size() + 1);
+    stringOffset += strings[i].size() + 1;
+  }
+  writer.write<u32>(offset + 4 + 4 * strings.size(), stringOffset);
 }
 
 /// Get the number of items in a container.
-inline u32 readContainerSize(common::BinaryReader br, u64 offset) {
+template <typename BR>
+inline u32 readContainerSize(BR br, u64 offset) {
   return br.readU24(offset + 1);
 }
 
@@ -30,9 +66,26 @@ constexpr u64 getArrayValuesOffset(u64 offset, u32 numItems) {
 }
 
 /// Get an item (type + raw data) in an array.
-inline RawItemData readArrayItem(common::BinaryReader br, u64 typesOffset, u64 valuesOffset,
-                                 u32 idx) {
-  return {br.read<u32>(valuesOffset + 4 * idx), NodeType(br.read<u8>(typesOffset + idx))};
+template <typename BR>
+inline RawItemData readArrayItem(BR br, u64 typesOffset, u64 valuesOffset, u32 idx) {
+  return {br.template read<u32>(valuesOffset + 4 * idx),
+          NodeType(br.template read<u8>(typesOffset + idx))};
+}
+
+// Monotyped array utilities.
+
+constexpr u64 getMonoTypedArrayItemTypeOffset(u64 offset) {
+  return offset + 4;
+}
+
+constexpr u64 getMonoTypedArrayValuesOffset(u64 offset) {
+  return offset + 8;
+}
+
+/// Get the type of the items in a monotyped array.
+template <typename BR>
+inline NodeType readMonoTypedArrayItemType(BR br, u64 offset) {
+  return NodeType(br.template read<u8>(getMonoTypedArrayItemTypeOffset(offset)));
 }
 
 // Hash utilities.
@@ -50,15 +103,72 @@ struct RawHashItem {
   RawItemData data;
 };
 
+/// Get the key index of an item in a hash.
+template <typename BR>
+inline u32 readHashItemKeyIndex(BR br, u64 offset, u32 idx) {
+  return br.readU24(getHashItemOffset(offset, idx));
+}
+
 /// Get an item (key index + type + raw data) in a hash.
-inline RawHashItem readHashItemWithItemOffset(common::BinaryReader br, u64 itemOffset) {
+template <typename BR>
+inline RawHashItem readHashItemWithItemOffset(BR br, u64 itemOffset) {
   const u32 keyIndex = br.readU24(itemOffset);
-  const auto type = NodeType(br.read<u8>(itemOffset + 3));
-  const u32 rawData = br.read<u32>(itemOffset + 4);
+  const auto type = NodeType(br.template read<u8>(itemOffset + 3));
+  const u32 rawData = br.template read<u32>(itemOffset + 4);
   return {keyIndex, {rawData, type}};
 }
-inline RawHashItem readHashItem(common::BinaryReader br, u64 offset, u32 idx) {
+template <typename BR>
+inline RawHashItem readHashItem(BR br, u64 offset, u32 idx) {
   return readHashItemWithItemOffset(br, getHashItemOffset(offset, idx));
 }
 
+// Hash32 utilities (for both Hash32 and ValueHash32 nodes).
+
+constexpr u64 getHash32ItemOffset(u64 offset, u32 idx) {
+  return offset + 4 + 8 * idx;
+}
+
+constexpr u64 getHash32TypesOffset(u64 offset, u32 numItems) {
+  return getHash32ItemOffset(offset, numItems);
+}
+
+struct RawHash32Item {
+  u32 key;
+  RawItemData data;
+};
+
+/// Get the key of an item in a Hash32 or ValueHash32 node.
+template <typename BR>
+inline u32 readHash32ItemKey(BR br, u64 offset, NodeType type, u32 idx) {
+  const u32 keyOffset = type == NodeType::ValueHash32 ? 4 : 0;
+  return br.template read<u32>(getHash32ItemOffset(offset, idx) + keyOffset);
+}
+
+/// Get an item (key + type + raw data) in a Hash32 or ValueHash32 node.
+template <typename BR>
+inline RawHash32Item readHash32Item(BR br, u64 offset, NodeType type, u32 numItems, u32 idx) {
+  const u32 valueOffset = type == NodeType::ValueHash32 ? 0 : 4;
+  const u32 rawData = br.template read<u32>(getHash32ItemOffset(offset, idx) + valueOffset);
+  const u64 typesOffset = getHash32TypesOffset(offset, numItems);
+  const auto itemType = NodeType(br.template read<u8>(typesOffset + idx));
+  return {readHash32ItemKey(br, offset, type, idx), {rawData, itemType}};
+}
+
+/// Get an item (type + raw data) in a container of any type (see isAnyContainerType).
+template <typename BR>
+inline RawItemData readContainerItem(BR br, u64 offset, NodeType type, u32 numItems, u32 idx) {
+  switch (type) {
+  case NodeType::Array:
+    return readArrayItem(br, getArrayTypesOffset(offset), getArrayValuesOffset(offset, numItems),
+                         idx);
+  case NodeType::MonoTypedArray:
+    return {br.template read<u32>(getMonoTypedArrayValuesOffset(offset) + 4 * idx),
+            readMonoTypedArrayItemType(br, offset)};
+  case NodeType::Hash:
+    return readHashItem(br, offset, idx).data;
+  default:
+    return readHash32Item(br, offset, type, numItems, idx).data;
+  }
+}
+
 }  // namespace byml::util
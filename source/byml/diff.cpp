@@ -0,0 +1,439 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+
+#include "byml/diff.h"
+
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <unordered_set>
+#include <utility>
+#include <variant>
+
+#include "byml/binary_format.h"
+#include "byml/byml.h"
+#include "byml/fingerprint.h"
+
+namespace byml {
+
+namespace {
+
+/// Returns whether a key can be written as a plain key in the query syntax.
+bool isPlainKey(std::string_view key) {
+  if (key.empty())
+    return false;
+  for (const char c : key) {
+    const bool isAlpha = ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z');
+    if (!isAlpha && !('0' <= c && c <= '9') && c != '_')
+      return false;
+  }
+  return true;
+}
+
+/// Kinds of nodes that can be compared with each other.
+enum class NodeKind {
+  Array,
+  Hash,
+  Hash32,
+  Value,
+};
+
+NodeKind getNodeKind(NodeType type) {
+  switch (type) {
+  case NodeType::Array:
+  case NodeType::MonoTypedArray:
+    return NodeKind::Array;
+  case NodeType::Hash:
+    return NodeKind::Hash;
+  case NodeType::Hash32:
+  case NodeType::ValueHash32:
+    return NodeKind::Hash32;
+  default:
+    return NodeKind::Value;
+  }
+}
+
+u64 getBits(f64 value) {
+  u64 bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+/// Walks two trees together and records the differences.
+class DiffEngine {
+public:
+  DiffEngine(const Reader& from, const Reader& to, const DiffOptions& options,
+             std::vector<DiffEntry>& entries)
+      : mFrom{from}, mTo{to}, mOptions{options}, mEntries{entries} {
+    mSameDocument = from.getBuffer().data() == to.getBuffer().data() &&
+                    from.getBuffer().size() == to.getBuffer().size();
+    if (!mSameDocument)
+      mKeyMap.assign(from.getNumKeys(), UnknownKey);
+  }
+
+  /// Returns false if an invalid node is encountered.
+  bool run(const ItemData& from, const ItemData& to) {
+    if (!compare(from, to, nullptr))
+      return false;
+
+    while (!mStack.empty()) {
+      Frame& frame = mStack.back();
+      // step() may push to the stack, so the frame must not be used after it is called.
+      const bool ok = std::visit([&](auto& pair) { return step(frame, pair); }, frame.containers);
+      if (!ok)
+        return false;
+    }
+    return true;
+  }
+
+private:
+  using ArrayPair = std::pair<Array, Array>;
+  using HashPair = std::pair<Hash, Hash>;
+  using Hash32Pair = std::pair<Hash32, Hash32>;
+
+  struct Frame {
+    std::variant<ArrayPair, HashPair, Hash32Pair> containers;
+    /// Whether the frame adds an element to the current path (false for the root).
+    bool hasPathElement;
+    /// Number of entries when the frame was pushed.
+    size_t numEntries;
+    /// Index of the next item in each container.
+    u32 i = 0;
+    u32 j = 0;
+  };
+
+  static constexpr u32 UnknownKey = 0xffffffff;
+  static constexpr u32 MissingKey = 0xfffffffe;
+
+  /// Compare two nodes. Containers of the same kind are pushed to the stack and their items
+  /// are compared by the main loop. Returns false if a node is invalid.
+  bool compare(const ItemData& from, const ItemData& to, const PathElement* element) {
+    const NodeKind kind = getNodeKind(from.raw.type);
+    if (kind != getNodeKind(to.raw.type)) {
+      emit(DiffEntry::Op::Change, element, from, to);
+      return true;
+    }
+
+    if (kind == NodeKind::Value) {
+      const auto equal = equalValues(from, to);
+      if (!equal)
+        return false;
+      if (!*equal)
+        emit(DiffEntry::Op::Change, element, from, to);
+      return true;
+    }
+
+    // The same container in both documents.
+    if (mSameDocument && from.raw.raw == to.raw.raw)
+      return true;
+
+    if (mOptions.fromFingerprints && mOptions.toFingerprints) {
+      const auto fromFingerprint = mOptions.fromFingerprints->get(from.raw.raw);
+      if (fromFingerprint && fromFingerprint == mOptions.toFingerprints->get(to.raw.raw))
+        return true;
+    }
+
+    // Containers that are shared by several parents only need to be compared once.
+    if (mEqualContainers.count({from.raw.raw, to.raw.raw}) != 0)
+      return true;
+
+    if (mCheckCycles && !mInProgress.insert({from.raw.raw, to.raw.raw}).second)
+      return false;
+
+    switch (kind) {
+    case NodeKind::Array:
+      return push(from.getArray(), to.getArray(), element);
+    case NodeKind::Hash:
+      return push(from.getHash(), to.getHash(), element);
+    default:
+      return push(from.getHash32(), to.getHash32(), element);
+    }
+  }
+
+  template <typename T>
+  bool push(const std::optional<T>& from, const std::optional<T>& to,
+            const PathElement* element) {
+    if (!from || !to)
+      return false;
+    if (element)
+      mPath.push_back(*element);
+    mStack.push_back({std::pair<T, T>{*from, *to}, element != nullptr, mEntries.size()});
+    return true;
+  }
+
+  void pop() {
+    const Frame& frame = mStack.back();
+    const auto offsets = std::visit(
+        [](const auto& pair) {
+          return std::pair<u32, u32>{pair.first.getOffset(), pair.second.getOffset()};
+        },
+        frame.containers);
+    if (mCheckCycles)
+      mInProgress.erase(offsets);
+    if (mEntries.size() == frame.numEntries)
+      mEqualContainers.insert(offsets);
+    if (frame.hasPathElement)
+      mPath.pop_back();
+    mStack.pop_back();
+  }
+
+  bool step(Frame& frame, ArrayPair& arrays) {
+    const auto& [from, to] = arrays;
+    if (frame.i < from.numItems() && frame.i < to.numItems()) {
+      const u32 idx = frame.i++;
+      frame.j++;
+      const PathElement element = PathElement::makeIndex(idx);
+      return compare(from[idx], to[idx], &element);
+    }
+    if (frame.i < from.numItems()) {
+      const u32 idx = frame.i++;
+      const PathElement element = PathElement::makeIndex(idx);
+      emit(DiffEntry::Op::Remove, &element, from[idx], std::nullopt);
+      return true;
+    }
+    if (frame.j < to.numItems()) {
+      const u32 idx = frame.j++;
+      const PathElement element = PathElement::makeIndex(idx);
+      emit(DiffEntry::Op::Add, &element, std::nullopt, to[idx]);
+      return true;
+    }
+    pop();
+    return true;
+  }
+
+  bool step(Frame& frame, HashPair& hashes) {
+    const auto& [from, to] = hashes;
+    const bool hasFrom = frame.i < from.numItems();
+    const bool hasTo = frame.j < to.numItems();
+    if (!hasFrom && !hasTo) {
+      pop();
+      return true;
+    }
+
+    int cmp;
+    if (!hasFrom)
+      cmp = 1;
+    else if (!hasTo)
+      cmp = -1;
+    else
+      cmp = compareKeys(from.getKeyIdByIndex(frame.i)->index,
+                        to.getKeyIdByIndex(frame.j)->index);
+
+    if (cmp < 0) {
+      const HashItem item = *from.getByIndex(frame.i++);
+      const PathElement element = PathElement::makeKey(item.name);
+      emit(DiffEntry::Op::Remove, &element, item.data, std::nullopt);
+      return true;
+    }
+    if (cmp > 0) {
+      const HashItem item = *to.getByIndex(frame.j++);
+      const PathElement element = PathElement::makeKey(item.name);
+      emit(DiffEntry::Op::Add, &element, std::nullopt, item.data);
+      return true;
+    }
+    const HashItem fromItem = *from.getByIndex(frame.i++);
+    const HashItem toItem = *to.getByIndex(frame.j++);
+    const PathElement element = PathElement::makeKey(toItem.name);
+    return compare(fromItem.data, toItem.data, &element);
+  }
+
+  bool step(Frame& frame, Hash32Pair& hashes) {
+    const auto& [from, to] = hashes;
+    const bool hasFrom = frame.i < from.numItems();
+    const bool hasTo = frame.j < to.numItems();
+    if (!hasFrom && !hasTo) {
+      pop();
+      return true;
+    }
+
+    const auto fromItem = hasFrom ? from.getByIndex(frame.i) : std::nullopt;
+    const auto toItem = hasTo ? to.getByIndex(frame.j) : std::nullopt;
+    if (!hasTo || (hasFrom && fromItem->key < toItem->key)) {
+      frame.i++;
+      const PathElement element = PathElement::makeHash32Key(fromItem->key);
+      emit(DiffEntry::Op::Remove, &element, fromItem->data, std::nullopt);
+      return true;
+    }
+    if (!hasFrom || toItem->key < fromItem->key) {
+      frame.j++;
+      const PathElement element = PathElement::makeHash32Key(toItem->key);
+      emit(DiffEntry::Op::Add, &element, std::nullopt, toItem->data);
+      return true;
+    }
+    frame.i++;
+    frame.j++;
+    const PathElement element = PathElement::makeHash32Key(toItem->key);
+    return compare(fromItem->data, toItem->data, &element);
+  }
+
+  /// Compare a key of the old document with a key of the new document (like strcmp).
+  /// Keys of the old document are looked up in the new document's key table once; after that,
+  /// comparing them does not require any string comparison since both key tables are sorted.
+  int compareKeys(u32 fromIndex, u32 toIndex) {
+    if (mSameDocument)
+      return fromIndex < toIndex ? -1 : fromIndex > toIndex;
+
+    u32& mapped = mKeyMap[fromIndex];
+    if (mapped == UnknownKey) {
+      const char* key = mFrom.getKey(fromIndex);
+      const auto id = key ? mTo.findKey(key) : std::nullopt;
+      mapped = id ? id->index : MissingKey;
+    }
+    if (mapped != MissingKey)
+      return mapped < toIndex ? -1 : mapped > toIndex;
+
+    const char* fromKey = mFrom.getKey(fromIndex);
+    const char* toKey = mTo.getKey(toIndex);
+    if (!fromKey || !toKey)
+      return 0;
+    return std::strcmp(fromKey, toKey);
+  }
+
+  /// Compare two non-container nodes. Returns nullopt if a node is invalid.
+  std::optional<bool> equalValues(const ItemData& from, const ItemData& to) const {
+    if (from.raw.type != to.raw.type)
+      return false;
+
+    switch (from.raw.type) {
+    case NodeType::String: {
+      if (mSameDocument)
+        return from.raw.raw == to.raw.raw;
+      const auto fromString = from.getStringView();
+      const auto toString = to.getStringView();
+      if (!fromString || !toString)
+        return {};
+      return *fromString == *toString;
+    }
+    case NodeType::Bool:
+      return (from.raw.raw != 0) == (to.raw.raw != 0);
+    case NodeType::Int:
+    case NodeType::UInt:
+    case NodeType::Float:
+      return from.raw.raw == to.raw.raw;
+    case NodeType::Int64:
+      return *from.getInt64() == *to.getInt64();
+    case NodeType::UInt64:
+      return *from.getUInt64() == *to.getUInt64();
+    case NodeType::Double:
+      return getBits(*from.getDouble()) == getBits(*to.getDouble());
+    case NodeType::Binary:
+    case NodeType::FileData: {
+      const Buffer fromData = *from.getBinary();
+      const Buffer toData = *to.getBinary();
+      return fromData.size() == toData.size() &&
+             from.getBinaryAlignment() == to.getBinaryAlignment() &&
+             std::memcmp(fromData.data(), toData.data(), fromData.size()) == 0;
+    }
+    case NodeType::Null:
+      return true;
+    default:
+      return {};
+    }
+  }
+
+  void emit(DiffEntry::Op op, const PathElement* element, std::optional<ItemData> from,
+            std::optional<ItemData> to) {
+    Path path = mPath;
+    if (element)
+      path.push_back(*element);
+    mEntries.push_back({op, std::move(path), std::move(from), std::move(to)});
+  }
+
+  struct OffsetPairHash {
+    size_t operator()(const std::pair<u32, u32>& pair) const {
+      return std::hash<u64>{}(u64(pair.first) << 32 | pair.second);
+    }
+  };
+
+  const Reader& mFrom;
+  const Reader& mTo;
+  const DiffOptions& mOptions;
+  std::vector<DiffEntry>& mEntries;
+  /// Whether both nodes are in the same document, in which case strings and keys can be
+  /// compared by index and identical containers have the same offset.
+  bool mSameDocument;
+  /// Index of each key of the old document in the new document's key table
+  /// (or UnknownKey if it has not been looked up yet, or MissingKey).
+  std::vector<u32> mKeyMap;
+  std::vector<Frame> mStack;
+  /// Path to the containers at the top of the stack.
+  Path mPath;
+  // Documents that have not been validated may contain cycles.
+  const bool mCheckCycles = mFrom.isCheckedAccessEnabled() || mTo.isCheckedAccessEnabled();
+  /// Pairs of containers that are on the stack (only tracked if mCheckCycles is true).
+  std::unordered_set<std::pair<u32, u32>, OffsetPairHash> mInProgress;
+  /// Pairs of containers that have been compared and found to be equal.
+  std::unordered_set<std::pair<u32, u32>, OffsetPairHash> mEqualContainers;
+};
+
+}  // end of anonymous namespace
+
+std::string formatPath(const Path& path) {
+  std::string result;
+  for (const PathElement& element : path) {
+    switch (element.type) {
+    case PathElement::Type::Key:
+      if (isPlainKey(element.key)) {
+        if (!result.empty())
+          result += '.';
+        result += element.key;
+      } else {
+        result += "[\"";
+        for (const char c : element.key) {
+          if (c == '\n') {
+            result += "\\n";
+          } else if (c == '\t') {
+            result += "\\t";
+          } else {
+            if (c == '"' || c == '\\')
+              result += '\\';
+            result += c;
+          }
+        }
+        result += "\"]";
+      }
+      break;
+    case PathElement::Type::Index:
+      result += '[';
+      result += std::to_string(element.index);
+      result += ']';
+      break;
+    case PathElement::Type::Hash32Key: {
+      char buffer[16];
+      std::snprintf(buffer, sizeof(buffer), "<0x%08x>", element.index);
+      result += buffer;
+      break;
+    }
+    }
+  }
+  return result;
+}
+
+std::optional<std::vector<DiffEntry>> diff(const ItemData& from, const ItemData& to,
+                                           const DiffOptions& options) {
+  std::vector<DiffEntry> entries;
+  if (!DiffEngine{from.reader, to.reader, options, entries}.run(from, to))
+    return {};
+  return entries;
+}
+
+std::optional<std::vector<DiffEntry>> diff(const Reader& from, const Reader& to,
+                                           const DiffOptions& options) {
+  const auto fromRoot = from.getRoot();
+  const auto toRoot = to.getRoot();
+  if ((!fromRoot && from.hasRoot()) || (!toRoot && to.hasRoot()))
+    return {};
+
+  if (fromRoot && toRoot)
+    return diff(*fromRoot, *toRoot, options);
+
+  // At least one of the documents is empty.
+  std::vector<DiffEntry> entries;
+  if (fromRoot)
+    entries.push_back({DiffEntry::Op::Remove, {}, *fromRoot, std::nullopt});
+  if (toRoot)
+    entries.push_back({DiffEntry::Op::Add, {}, std::nullopt, *toRoot});
+  return entries;
+}
+
+}  // namespace byml
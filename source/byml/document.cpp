@@ -0,0 +1,618 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+
+#include "byml/document.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#include "byml/byml.h"
+#include "byml/value.h"
+#include "byml/writer.h"
+#include "common/arena.h"
+
+namespace byml {
+
+namespace {
+
+constexpr u32 MaxNumItems = 0xffffff;
+
+/// Container items are preceded by a header that stores the capacity of the item array.
+struct ItemsHeader {
+  u32 capacity;
+  /// Whether the items are referenced by several container nodes. Shared items are never
+  /// modified in place.
+  bool shared;
+  /// Arena that the items were allocated from (used to copy shared items).
+  common::Arena* arena;
+};
+
+template <typename T>
+T* allocateItems(common::Arena& arena, u32 capacity) {
+  static_assert(alignof(T) <= sizeof(ItemsHeader));
+  if (capacity == 0)
+    return nullptr;
+  void* memory = arena.allocate(sizeof(ItemsHeader) + sizeof(T) * capacity, alignof(T));
+  auto* header = new (memory) ItemsHeader{capacity, false, &arena};
+  return reinterpret_cast<T*>(header + 1);
+}
+
+ItemsHeader* getHeader(const void* items) {
+  return static_cast<ItemsHeader*>(const_cast<void*>(items)) - 1;
+}
+
+u32 getCapacity(const void* items) {
+  if (!items)
+    return 0;
+  return getHeader(items)->capacity;
+}
+
+bool isShared(const void* items) {
+  return items && getHeader(items)->shared;
+}
+
+void markShared(const void* items) {
+  if (items)
+    getHeader(items)->shared = true;
+}
+
+/// Returns the items of a container node, or nullptr for other nodes and empty containers.
+const void* getItems(const Node& node) {
+  if (const Node* items = node.getArrayItems())
+    return items;
+  return node.getHashEntries();
+}
+
+/// Returns the index of the first entry whose key is not less than `key`.
+u32 lowerBound(const HashEntry* entries, u32 size, std::string_view key) {
+  const HashEntry* it = std::lower_bound(
+      entries, entries + size, key,
+      [](const HashEntry& entry, std::string_view k) { return entry.getKey() < k; });
+  return static_cast<u32>(it - entries);
+}
+
+bool isSortedByKey(const HashEntry* entries, u32 size) {
+  return std::is_sorted(entries, entries + size, [](const HashEntry& a, const HashEntry& b) {
+    return a.getKey() < b.getKey();
+  });
+}
+
+}  // end of anonymous namespace
+
+Node Node::makeFloat(f32 value) {
+  u32 raw;
+  std::memcpy(&raw, &value, sizeof(raw));
+  return {NodeType::Float, raw};
+}
+
+Node Node::makeDouble(f64 value) {
+  u64 raw;
+  std::memcpy(&raw, &value, sizeof(raw));
+  return {NodeType::Double, raw};
+}
+
+std::optional<bool> Node::getBool() const {
+  if (mType != NodeType::Bool)
+    return {};
+  return mValue.u32Value != 0;
+}
+
+std::optional<s32> Node::getInt() const {
+  if (mType != NodeType::Int)
+    return {};
+  return static_cast<s32>(mValue.u32Value);
+}
+
+std::optional<u32> Node::getUInt() const {
+  switch (mType) {
+  case NodeType::Int:
+    return static_cast<s32>(mValue.u32Value) >= 0 ? mValue.u32Value : std::optional<u32>{};
+  case NodeType::UInt:
+    return mValue.u32Value;
+  default:
+    return {};
+  }
+}
+
+std::optional<f32> Node::getFloat() const {
+  if (mType != NodeType::Float)
+    return {};
+  f32 value;
+  std::memcpy(&value, &mValue.u32Value, sizeof(value));
+  return value;
+}
+
+std::optional<s64> Node::getInt64() const {
+  switch (mType) {
+  case NodeType::Int:
+    return static_cast<s32>(mValue.u32Value);
+  case NodeType::UInt:
+    return mValue.u32Value;
+  case NodeType::Int64:
+    return static_cast<s64>(mValue.u64Value);
+  default:
+    return {};
+  }
+}
+
+std::optional<u64> Node::getUInt64() const {
+  if (auto value = getUInt())
+    return value;
+  if (mType == NodeType::UInt64)
+    return mValue.u64Value;
+  if (mType == NodeType::Int64 && static_cast<s64>(mValue.u64Value) >= 0)
+    return mValue.u64Value;
+  return {};
+}
+
+std::optional<f64> Node::getDouble() const {
+  if (auto value = getFloat())
+    return value;
+  if (mType != NodeType::Double)
+    return {};
+  f64 value;
+  std::memcpy(&value, &mValue.u64Value, sizeof(value));
+  return value;
+}
+
+std::optional<std::string_view> Node::getStringView() const {
+  if (mType != NodeType::String)
+    return {};
+  return std::string_view{mValue.string, mSize};
+}
+
+void Node::detach() {
+  const void* items = getItems(*this);
+  if (!isShared(items))
+    return;
+
+  common::Arena& arena = *getHeader(items)->arena;
+  if (isArray()) {
+    Node* copy = allocateItems<Node>(arena, mSize);
+    std::memcpy(copy, mValue.items, sizeof(Node) * mSize);
+    mValue.items = copy;
+    // The children are now referenced by both item arrays.
+    for (u32 i = 0; i < mSize; ++i)
+      markShared(getItems(copy[i]));
+  } else {
+    HashEntry* copy = allocateItems<HashEntry>(arena, mSize);
+    std::memcpy(copy, mValue.entries, sizeof(HashEntry) * mSize);
+    mValue.entries = copy;
+    for (u32 i = 0; i < mSize; ++i)
+      markShared(getItems(copy[i].value));
+  }
+}
+
+Node* Node::getArrayItems() {
+  detach();
+  return isArray() ? mValue.items : nullptr;
+}
+
+HashEntry* Node::getHashEntries() {
+  detach();
+  return isHash() ? mValue.entries : nullptr;
+}
+
+Node* Node::getByIndex(size_t idx) {
+  detach();
+  return const_cast<Node*>(std::as_const(*this).getByIndex(idx));
+}
+
+const Node* Node::getByIndex(size_t idx) const {
+  if (!isArray() || idx >= mSize)
+    return nullptr;
+  return &mValue.items[idx];
+}
+
+Node* Node::getByKey(std::string_view key) {
+  detach();
+  return const_cast<Node*>(std::as_const(*this).getByKey(key));
+}
+
+const Node* Node::getByKey(std::string_view key) const {
+  if (!isHash())
+    return nullptr;
+  const u32 idx = lowerBound(mValue.entries, mSize, key);
+  if (idx == mSize || mValue.entries[idx].getKey() != key)
+    return nullptr;
+  return &mValue.entries[idx].value;
+}
+
+struct Document::Storage {
+  common::Arena arena;
+  /// Source document (if any). Unmodified strings point to its buffer.
+  std::optional<Reader> source;
+};
+
+Document::Document() : mStorage{std::make_unique<Storage>()} {}
+
+Document::~Document() = default;
+
+Document::Document(Document&&) noexcept = default;
+
+Document& Document::operator=(Document&&) noexcept = default;
+
+std::optional<Document> Document::fromReader(const Reader& reader) {
+  Document document;
+  common::Arena& arena = document.mStorage->arena;
+  const Reader& source = document.mStorage->source.emplace(reader);
+
+  // Containers are converted iteratively so that deeply nested documents cannot overflow
+  // the stack. Each container gets an item array of the right size up front, so the item nodes
+  // never move and can be filled in place.
+  struct Frame {
+    Node* node;
+    u32 offset;
+    std::optional<Array> array;
+    std::optional<Hash> hash;
+    u32 nextItem;
+  };
+  std::vector<Frame> stack;
+  bool ok = true;
+  // Documents that have not been validated may contain cycles.
+  const bool checkCycles = source.isCheckedAccessEnabled();
+  std::unordered_set<u32> inProgress;
+  // Containers that have been converted, by offset. Containers that are referenced several times
+  // are only converted once and share their items.
+  std::unordered_map<u32, Node> converted;
+
+  const auto convert = [&](const ItemData& item, Node& out) {
+    switch (item.raw.type) {
+    case NodeType::Array:
+    case NodeType::MonoTypedArray:
+    case NodeType::Hash: {
+      // This checks the container (including its type) if checked access is enabled,
+      // so it must be done before looking for a converted container.
+      auto array = item.getArray();
+      auto hash = item.getHash();
+      if (!array && !hash) {
+        ok = false;
+        return;
+      }
+      if (const auto it = converted.find(item.raw); it != converted.end()) {
+        out = it->second;
+        markShared(getItems(out));
+        return;
+      }
+      if (checkCycles && !inProgress.insert(item.raw).second) {
+        ok = false;
+        return;
+      }
+      // Monotyped arrays are converted to regular arrays.
+      out = Node{array ? NodeType::Array : NodeType::Hash};
+      out.mSize = array ? array->numItems() : hash->numItems();
+      if (array)
+        out.mValue.items = allocateItems<Node>(arena, out.mSize);
+      else
+        out.mValue.entries = allocateItems<HashEntry>(arena, out.mSize);
+      stack.push_back({&out, item.raw, std::move(array), std::move(hash), 0});
+      return;
+    }
+    case NodeType::String: {
+      const char* string = item.getString();
+      out = Node{NodeType::String};
+      out.mValue.string = string;
+      out.mSize = std::strlen(string);
+      return;
+    }
+    case NodeType::Bool:
+    case NodeType::Int:
+    case NodeType::UInt:
+    case NodeType::Float:
+      out = Node{item.raw.type, item.raw.raw};
+      return;
+    case NodeType::Int64:
+      out = Node::makeInt64(*item.getInt64());
+      return;
+    case NodeType::UInt64:
+      out = Node::makeUInt64(*item.getUInt64());
+      return;
+    case NodeType::Double:
+      out = Node::makeDouble(*item.getDouble());
+      return;
+    case NodeType::Null:
+      out = Node{};
+      return;
+    default:
+      ok = false;
+      return;
+    }
+  };
+
+  if (source.isHash32())
+    return {};
+  if (source.isArray() || source.isHash()) {
+    const auto array = source.getArray();
+    const auto hash = source.getHash();
+    if (!array && !hash)
+      return {};
+    if (array)
+      convert(ItemData{source, {array->getOffset(), array->getNodeType()}}, document.mRoot);
+    else
+      convert(ItemData{source, {hash->getOffset(), NodeType::Hash}}, document.mRoot);
+  }
+
+  while (ok && !stack.empty()) {
+    Frame& frame = stack.back();
+    Node& node = *frame.node;
+    if (frame.nextItem == node.mSize) {
+      // Hash items are expected to be sorted, but nothing guarantees it.
+      if (node.isHash() && !isSortedByKey(node.mValue.entries, node.mSize)) {
+        std::sort(node.mValue.entries, node.mValue.entries + node.mSize,
+                  [](const HashEntry& a, const HashEntry& b) { return a.getKey() < b.getKey(); });
+      }
+      converted.emplace(frame.offset, node);
+      inProgress.erase(frame.offset);
+      stack.pop_back();
+      continue;
+    }
+
+    // `frame` must not be used after convert() since it may push to the stack.
+    const u32 idx = frame.nextItem++;
+    if (frame.array) {
+      convert((*frame.array)[idx], node.mValue.items[idx]);
+    } else {
+      const HashItem item = *frame.hash->getByIndex(idx);
+      HashEntry& entry = node.mValue.entries[idx];
+      entry.key = item.name;
+      entry.keyLength = std::strlen(item.name);
+      convert(item.data, entry.value);
+    }
+  }
+
+  if (!ok)
+    return {};
+  return document;
+}
+
+Node Document::makeString(std::string_view value) {
+  if (std::memchr(value.data(), 0, value.size()))
+    return {};
+  const std::string_view copy = mStorage->arena.copyString(value);
+  Node node{NodeType::String};
+  node.mValue.string = copy.data();
+  node.mSize = copy.size();
+  return node;
+}
+
+Node Document::clone(const Node& node) {
+  struct Frame {
+    const Node* source;
+    Node* node;
+    u32 nextItem;
+  };
+  std::vector<Frame> stack;
+  common::Arena& arena = mStorage->arena;
+  // Copies of the item arrays that have already been copied.
+  std::unordered_map<const void*, Node> copied;
+
+  const auto copy = [&](const Node& source, Node& out) {
+    out = source;
+    if (const void* items = getItems(source)) {
+      const auto it = copied.find(items);
+      if (it != copied.end() && it->second.mSize == source.mSize) {
+        out = it->second;
+        markShared(getItems(out));
+        return;
+      }
+    }
+    switch (source.mType) {
+    case NodeType::String:
+      out.mValue.string = arena.copyString(*source.getStringView()).data();
+      break;
+    case NodeType::Array:
+      out.mValue.items = allocateItems<Node>(arena, source.mSize);
+      stack.push_back({&source, &out, 0});
+      break;
+    case NodeType::Hash:
+      out.mValue.entries = allocateItems<HashEntry>(arena, source.mSize);
+      stack.push_back({&source, &out, 0});
+      break;
+    default:
+      break;
+    }
+  };
+
+  Node result;
+  copy(node, result);
+  // The root may have been pushed with a pointer to `result`, which does not move.
+  while (!stack.empty()) {
+    Frame& frame = stack.back();
+    if (frame.nextItem == frame.source->mSize) {
+      if (const void* items = getItems(*frame.source))
+        copied.emplace(items, *frame.node);
+      stack.pop_back();
+      continue;
+    }
+    const u32 idx = frame.nextItem++;
+    const Node& source = *frame.source;
+    Node& out = *frame.node;
+    if (source.isArray()) {
+      copy(source.mValue.items[idx], out.mValue.items[idx]);
+    } else {
+      const HashEntry& entry = source.mValue.entries[idx];
+      HashEntry& outEntry = out.mValue.entries[idx];
+      outEntry.key = arena.copyString(entry.getKey()).data();
+      outEntry.keyLength = entry.keyLength;
+      copy(entry.value, outEntry.value);
+    }
+  }
+  return result;
+}
+
+void Document::reserve(Node& container, size_t numItems) {
+  if (!isContainerType(container.mType) || numItems > MaxNumItems)
+    return;
+  container.detach();
+  if (numItems <= getCapacity(container.mValue.items))
+    return;
+
+  common::Arena& arena = mStorage->arena;
+  if (container.isArray()) {
+    Node* items = allocateItems<Node>(arena, numItems);
+    if (container.mSize)
+      std::memcpy(items, container.mValue.items, sizeof(Node) * container.mSize);
+    container.mValue.items = items;
+  } else {
+    HashEntry* entries = allocateItems<HashEntry>(arena, numItems);
+    if (container.mSize)
+      std::memcpy(entries, container.mValue.entries, sizeof(HashEntry) * container.mSize);
+    container.mValue.entries = entries;
+  }
+}
+
+/// Make room for one more item. Returns false if the container is full.
+static bool growIfNeeded(Document& document, Node& container) {
+  const size_t size = container.numItems();
+  if (size == MaxNumItems)
+    return false;
+  const u32 capacity = container.isArray() ? getCapacity(container.getArrayItems()) :
+                                             getCapacity(container.getHashEntries());
+  if (size == capacity)
+    document.reserve(container, std::min(std::max(2 * capacity, 4u), MaxNumItems));
+  return true;
+}
+
+Node* Document::append(Node& array, const Node& value) {
+  if (!array.isArray())
+    return nullptr;
+  array.detach();
+  if (!growIfNeeded(*this, array))
+    return nullptr;
+  return new (&array.mValue.items[array.mSize++]) Node(value);
+}
+
+Node* Document::set(Node& hash, std::string_view key, const Node& value) {
+  if (!hash.isHash() || std::memchr(key.data(), 0, key.size()))
+    return nullptr;
+  hash.detach();
+
+  const u32 idx = lowerBound(hash.mValue.entries, hash.mSize, key);
+  if (idx != hash.mSize && hash.mValue.entries[idx].getKey() == key) {
+    hash.mValue.entries[idx].value = value;
+    return &hash.mValue.entries[idx].value;
+  }
+
+  if (!growIfNeeded(*this, hash))
+    return nullptr;
+  HashEntry* entries = hash.mValue.entries;
+  std::memmove(&entries[idx + 1], &entries[idx], sizeof(HashEntry) * (hash.mSize - idx));
+  const std::string_view keyCopy = mStorage->arena.copyString(key);
+  new (&entries[idx]) HashEntry{keyCopy.data(), static_cast<u32>(keyCopy.size()), value};
+  ++hash.mSize;
+  return &entries[idx].value;
+}
+
+bool Document::removeAt(Node& array, size_t idx) {
+  if (!array.isArray() || idx >= array.mSize)
+    return false;
+  array.detach();
+  Node* items = array.mValue.items;
+  std::memmove(&items[idx], &items[idx + 1], sizeof(Node) * (array.mSize - idx - 1));
+  --array.mSize;
+  return true;
+}
+
+bool Document::removeKey(Node& hash, std::string_view key) {
+  if (!hash.isHash())
+    return false;
+  const u32 idx = lowerBound(hash.mValue.entries, hash.mSize, key);
+  if (idx == hash.mSize || hash.mValue.entries[idx].getKey() != key)
+    return false;
+  hash.detach();
+  HashEntry* entries = hash.mValue.entries;
+  std::memmove(&entries[idx], &entries[idx + 1], sizeof(HashEntry) * (hash.mSize - idx - 1));
+  --hash.mSize;
+  return true;
+}
+
+std::optional<std::vector<u8>> Document::write(u16 version, bool bigEndian) const {
+  Writer writer{version, bigEndian};
+  if (mRoot.isNull())
+    return writer.finish();
+  if (!isContainerType(mRoot.mType))
+    return {};
+
+  struct Frame {
+    const Node* node;
+    u32 nextItem;
+  };
+  std::vector<Frame> stack;
+  // Shared items are only written once.
+  std::unordered_map<const void*, std::pair<u32, u32>> written;
+
+  const auto add = [&](const Node& node) {
+    if (const void* items = getItems(node)) {
+      const auto it = written.find(items);
+      if (it != written.end() && it->second.first == node.mSize) {
+        writer.addContainer(node.mType, it->second.second);
+        return;
+      }
+    }
+    switch (node.mType) {
+    case NodeType::Array:
+      writer.beginArray();
+      stack.push_back({&node, 0});
+      break;
+    case NodeType::Hash:
+      writer.beginHash();
+      stack.push_back({&node, 0});
+      break;
+    case NodeType::String:
+      writer.addString(*node.getStringView());
+      break;
+    case NodeType::Bool:
+      writer.addBool(*node.getBool());
+      break;
+    case NodeType::Int:
+      writer.addInt(*node.getInt());
+      break;
+    case NodeType::UInt:
+      writer.addUInt(*node.getUInt());
+      break;
+    case NodeType::Float:
+      writer.addFloat(*node.getFloat());
+      break;
+    case NodeType::Int64:
+      writer.addInt64(*node.getInt64());
+      break;
+    case NodeType::UInt64:
+      writer.addUInt64(*node.getUInt64());
+      break;
+    case NodeType::Double:
+      writer.addDouble(*node.getDouble());
+      break;
+    default:
+      writer.addNull();
+      break;
+    }
+  };
+
+  add(mRoot);
+  while (!stack.empty() && writer.isOk()) {
+    Frame& frame = stack.back();
+    const Node& node = *frame.node;
+    if (frame.nextItem == node.mSize) {
+      const auto offset = writer.endContainer();
+      if (const void* items = getItems(node); offset && isShared(items))
+        written.emplace(items, std::make_pair(node.mSize, *offset));
+      stack.pop_back();
+      continue;
+    }
+    const u32 idx = frame.nextItem++;
+    if (node.isArray()) {
+      add(node.mValue.items[idx]);
+    } else {
+      const HashEntry& entry = node.mValue.entries[idx];
+      writer.setKey(entry.getKey());
+      add(entry.value);
+    }
+  }
+  return writer.finish();
+}
+
+}  // namespace byml
@@ -0,0 +1,350 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+
+#include "byml/fingerprint.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#include "byml/binary_format.h"
+#include "byml/byml.h"
+#include "common/binary_reader.h"
+
+namespace byml {
+
+namespace {
+
+constexpr u64 rotateLeft(u64 value, int shift) {
+  return value << shift | value >> (64 - shift);
+}
+
+/// Finalizer of MurmurHash3.
+constexpr u64 mix64(u64 value) {
+  value ^= value >> 33;
+  value *= 0xff51afd7ed558ccd;
+  value ^= value >> 33;
+  value *= 0xc4ceb9fe1a85ec53;
+  value ^= value >> 33;
+  return value;
+}
+
+/// Streaming hash of 64-bit words with a 128-bit result.
+/// The result only depends on the words, not on the platform.
+class Hasher {
+public:
+  void add(u64 word) {
+    mLow = rotateLeft(mLow ^ (word * 0x87c37b91114253d5), 31) * 0x9e3779b97f4a7c15;
+    mHigh = (rotateLeft(mHigh ^ (word * 0x4cf5ad432745937f), 33) + mLow) * 0xc2b2ae3d27d4eb4f;
+    ++mNumWords;
+  }
+
+  void add(const Fingerprint& fingerprint) {
+    add(fingerprint.low);
+    add(fingerprint.high);
+  }
+
+  void addBytes(const u8* data, size_t size) {
+    add(size);
+    // Bytes are always read in little endian order so that hashes are the same on all platforms.
+    const common::BinaryReader br{data, false};
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+      add(br.read<u64>(i));
+    if (i < size) {
+      u64 tail = 0;
+      for (size_t j = i; j < size; ++j)
+        tail |= u64(data[j]) << (8 * (j - i));
+      add(tail);
+    }
+  }
+
+  Fingerprint finish() const {
+    u64 low = mix64(mLow ^ mNumWords);
+    u64 high = mix64(mHigh ^ rotateLeft(mNumWords, 32));
+    low += high;
+    high += low;
+    return {low, high};
+  }
+
+private:
+  u64 mLow = 0x243f6a8885a308d3;
+  u64 mHigh = 0x13198a2e03707344;
+  u64 mNumWords = 0;
+};
+
+/// Returns the tag that is hashed for a node type. Monotyped arrays are hashed like arrays,
+/// and ValueHash32 nodes like Hash32 nodes.
+u64 getTag(NodeType type) {
+  switch (type) {
+  case NodeType::MonoTypedArray:
+    return u64(NodeType::Array);
+  case NodeType::ValueHash32:
+    return u64(NodeType::Hash32);
+  default:
+    return u64(type);
+  }
+}
+
+Fingerprint hashString(std::string_view string) {
+  Hasher hasher;
+  hasher.addBytes(reinterpret_cast<const u8*>(string.data()), string.size());
+  return hasher.finish();
+}
+
+/// Hash the content of a node that is not a container. getStringHash returns the hash of
+/// a string table entry. Returns false if the node is invalid.
+template <typename GetStringHash>
+bool addValue(Hasher& hasher, const ItemData& item, GetStringHash getStringHash) {
+  hasher.add(getTag(item.raw.type));
+  switch (item.raw.type) {
+  case NodeType::String: {
+    const std::optional<Fingerprint> hash = getStringHash(item.raw.raw);
+    if (!hash)
+      return false;
+    hasher.add(*hash);
+    return true;
+  }
+  case NodeType::Bool:
+    hasher.add(item.raw.raw != 0);
+    return true;
+  case NodeType::Int:
+  case NodeType::UInt:
+  case NodeType::Float:
+    hasher.add(item.raw.raw);
+    return true;
+  case NodeType::Int64:
+    hasher.add(static_cast<u64>(*item.getInt64()));
+    return true;
+  case NodeType::UInt64:
+    hasher.add(*item.getUInt64());
+    return true;
+  case NodeType::Double: {
+    const f64 value = *item.getDouble();
+    u64 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    hasher.add(bits);
+    return true;
+  }
+  case NodeType::Binary:
+  case NodeType::FileData: {
+    const Buffer data = *item.getBinary();
+    hasher.add(*item.getBinaryAlignment());
+    hasher.addBytes(data.data(), data.size());
+    return true;
+  }
+  case NodeType::Null:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/// Computes the fingerprints of the containers of a document, children first.
+class FingerprintBuilder {
+public:
+  explicit FingerprintBuilder(const Reader& reader)
+      : mReader{reader}, mKeyHashes(reader.getNumKeys()), mStringHashes(reader.getNumStrings()) {}
+
+  /// Returns the fingerprint of the root container, or nullopt if a node is invalid.
+  std::optional<Fingerprint> run(const ItemData& root) {
+    if (!push(root))
+      return {};
+
+    while (true) {
+      Frame& frame = mStack.back();
+      if (frame.next == frame.numItems) {
+        const Fingerprint fingerprint = frame.hasher.finish();
+        mFingerprints.emplace(frame.offset, fingerprint);
+        if (mCheckCycles)
+          mInProgress.erase(frame.offset);
+        mStack.pop_back();
+        if (mStack.empty())
+          return fingerprint;
+        continue;
+      }
+
+      const u32 idx = frame.next;
+      std::optional<ItemData> item;
+      std::optional<Fingerprint> keyHash;
+      if (frame.array) {
+        item.emplace((*frame.array)[idx]);
+      } else if (frame.hash) {
+        const auto keyId = frame.hash->getKeyIdByIndex(idx);
+        const auto child = frame.hash->getByIndex(idx);
+        if (!keyId || !child)
+          return {};
+        keyHash = getKeyHash(keyId->index);
+        if (!keyHash)
+          return {};
+        item.emplace(child->data);
+      } else {
+        const auto child = frame.hash32->getByIndex(idx);
+        if (!child)
+          return {};
+        keyHash = Fingerprint{child->key, 0};
+        item.emplace(child->data);
+      }
+
+      // Children are hashed before their parents.
+      std::optional<Fingerprint> childFingerprint;
+      if (isAnyContainerType(item->raw.type)) {
+        const auto it = mFingerprints.find(item->raw.raw);
+        if (it == mFingerprints.end()) {
+          // frame must not be used after this.
+          if (!push(*item))
+            return {};
+          continue;
+        }
+        // The offset may be referenced with another node type in malformed documents.
+        if (mCheckCycles && !item->getArray() && !item->getHash() && !item->getHash32())
+          return {};
+        childFingerprint = it->second;
+      }
+
+      if (keyHash)
+        frame.hasher.add(*keyHash);
+      if (childFingerprint) {
+        frame.hasher.add(getTag(item->raw.type));
+        frame.hasher.add(*childFingerprint);
+      } else if (!addValue(frame.hasher, *item, [&](u32 i) { return getStringHash(i); })) {
+        return {};
+      }
+      frame.next++;
+    }
+  }
+
+  std::unordered_map<u32, Fingerprint>& getFingerprints() { return mFingerprints; }
+
+private:
+  struct Frame {
+    u32 offset;
+    std::optional<Array> array;
+    std::optional<Hash> hash;
+    std::optional<Hash32> hash32;
+    u32 numItems;
+    u32 next = 0;
+    Hasher hasher;
+  };
+
+  bool push(const ItemData& item) {
+    if (mCheckCycles && !mInProgress.insert(item.raw.raw).second)
+      return false;
+
+    Frame frame{item.raw.raw, {}, {}, {}, 0, 0, {}};
+    if (item.raw.type == NodeType::Hash) {
+      if (const auto hash = item.getHash()) {
+        frame.hash.emplace(*hash);
+        frame.numItems = hash->numItems();
+      }
+    } else if (item.raw.type == NodeType::Hash32 || item.raw.type == NodeType::ValueHash32) {
+      if (const auto hash32 = item.getHash32()) {
+        frame.hash32.emplace(*hash32);
+        frame.numItems = hash32->numItems();
+      }
+    } else if (const auto array = item.getArray()) {
+      frame.array.emplace(*array);
+      frame.numItems = array->numItems();
+    }
+    if (!frame.array && !frame.hash && !frame.hash32)
+      return false;
+
+    frame.hasher.add(getTag(item.raw.type));
+    frame.hasher.add(frame.numItems);
+    mStack.push_back(std::move(frame));
+    return true;
+  }
+
+  std::optional<Fingerprint> getKeyHash(u32 index) {
+    if (index >= mKeyHashes.size())
+      return {};
+    if (!mKeyHashes[index]) {
+      const auto key = mReader.getKeyView(index);
+      if (!key)
+        return {};
+      mKeyHashes[index] = hashString(*key);
+    }
+    return mKeyHashes[index];
+  }
+
+  std::optional<Fingerprint> getStringHash(u32 index) {
+    if (index >= mStringHashes.size())
+      return {};
+    if (!mStringHashes[index]) {
+      const auto string = mReader.getStringView(index);
+      if (!string)
+        return {};
+      mStringHashes[index] = hashString(*string);
+    }
+    return mStringHashes[index];
+  }
+
+  const Reader& mReader;
+  /// Hashes of the keys and strings of the string tables (computed when first needed).
+  std::vector<std::optional<Fingerprint>> mKeyHashes;
+  std::vector<std::optional<Fingerprint>> mStringHashes;
+  std::vector<Frame> mStack;
+  /// Fingerprints of the containers that have been hashed.
+  std::unordered_map<u32, Fingerprint> mFingerprints;
+  // Documents that have not been validated may contain cycles.
+  const bool mCheckCycles = mReader.isCheckedAccessEnabled();
+  std::unordered_set<u32> mInProgress;
+};
+
+}  // end of anonymous namespace
+
+std::optional<FingerprintTable> FingerprintTable::build(const Reader& reader) {
+  FingerprintTable table;
+  const auto root = reader.getRoot();
+  if (!root) {
+    if (reader.hasRoot())
+      return {};
+    return table;
+  }
+
+  FingerprintBuilder builder{reader};
+  table.mRoot = builder.run(*root);
+  if (!table.mRoot)
+    return {};
+
+  std::vector<std::pair<u32, Fingerprint>> entries(builder.getFingerprints().begin(),
+                                                   builder.getFingerprints().end());
+  builder.getFingerprints().clear();
+  std::sort(entries.begin(), entries.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+  table.mOffsets.reserve(entries.size());
+  table.mFingerprints.reserve(entries.size());
+  for (const auto& [offset, fingerprint] : entries) {
+    table.mOffsets.push_back(offset);
+    table.mFingerprints.push_back(fingerprint);
+  }
+  return table;
+}
+
+std::optional<Fingerprint> FingerprintTable::get(u32 offset) const {
+  const auto it = std::lower_bound(mOffsets.begin(), mOffsets.end(), offset);
+  if (it == mOffsets.end() || *it != offset)
+    return {};
+  return mFingerprints[it - mOffsets.begin()];
+}
+
+std::optional<Fingerprint> FingerprintTable::get(const ItemData& item) const {
+  if (isAnyContainerType(item.raw.type))
+    return get(item.raw.raw);
+
+  Hasher hasher;
+  const auto getStringHash = [&](u32 index) -> std::optional<Fingerprint> {
+    const auto string = item.reader.getStringView(index);
+    if (!string)
+      return {};
+    return hashString(*string);
+  };
+  if (!addValue(hasher, item, getStringHash))
+    return {};
+  return hasher.finish();
+}
+
+}  // namespace byml
@@ -0,0 +1,56 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+
+#include "byml/key_index.h"
+
+#include <cstring>
+
+#include "byml/container_util.h"
+
+namespace byml {
+
+u32 KeyIndex::hashString(const char* string, u32* length) {
+  // FNV-1a
+  u32 hash = 2166136261;
+  const char* it = string;
+  for (; *it; ++it)
+    hash = (hash ^ u8(*it)) * 16777619;
+  *length = u32(it - string);
+  return hash;
+}
+
+KeyIndex::KeyIndex(common::BinaryReader br, u32 tableOffset, u32 numKeys)
+    : mBr{br}, mTableOffset{tableOffset} {
+  // Keep the load factor at or below 50% so that probe sequences stay short.
+  u32 capacity = 1;
+  while (capacity < 2 * numKeys)
+    capacity *= 2;
+  mSlots.assign(capacity, Slot{0, 0, EmptySlot});
+  mMask = capacity - 1;
+
+  for (u32 i = 0; i < numKeys; ++i) {
+    Slot slot{0, 0, i};
+    slot.hash = hashString(br.getString(util::getStringOffset(br, tableOffset, i)), &slot.length);
+    u32 pos = slot.hash & mMask;
+    while (mSlots[pos].keyIndex != EmptySlot)
+      pos = (pos + 1) & mMask;
+    mSlots[pos] = slot;
+  }
+}
+
+std::optional<u32> KeyIndex::find(const char* key) const {
+  u32 length;
+  const u32 hash = hashString(key, &length);
+  for (u32 pos = hash & mMask;; pos = (pos + 1) & mMask) {
+    const Slot& slot = mSlots[pos];
+    if (slot.keyIndex == EmptySlot)
+      return {};
+    if (slot.hash != hash || slot.length != length)
+      continue;
+    const char* candidate = mBr.getString(util::getStringOffset(mBr, mTableOffset, slot.keyIndex));
+    if (std::memcmp(candidate, key, length) == 0)
+      return slot.keyIndex;
+  }
+}
+
+}  // namespace byml
@@ -0,0 +1,41 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include "byml/types.h"
+#include "common/binary_reader.h"
+
+namespace byml {
+
+/// Open-addressing hash table over the hash key table of a document,
+/// which maps key strings to key indices in constant time.
+class KeyIndex {
+public:
+  /// Build an index for the specified hash key table, which must have been checked.
+  KeyIndex(common::BinaryReader br, u32 tableOffset, u32 numKeys);
+
+  /// Returns the index of a key in the key table, or nullopt if it is not in the table.
+  std::optional<u32> find(const char* key) const;
+
+  /// Hash a null-terminated string and get its length.
+  static u32 hashString(const char* string, u32* length);
+
+private:
+  struct Slot {
+    u32 hash;
+    u32 length;
+    /// Index in the key table, or EmptySlot.
+    u32 keyIndex;
+  };
+  static constexpr u32 EmptySlot = 0xffffffff;
+
+  common::BinaryReader mBr;
+  u32 mTableOffset;
+  std::vector<Slot> mSlots;
+  u32 mMask = 0;
+};
+
+}  // namespace byml
@@ -0,0 +1,847 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+
+#include "byml/patch.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <variant>
+
+#include "byml/binary_format.h"
+#include "byml/byml.h"
+#include "byml/container_util.h"
+#include "common/align.h"
+#include "common/arena.h"
+#include "common/binary_reader.h"
+#include "common/binary_writer.h"
+#include "common/log.h"
+
+namespace byml {
+
+namespace {
+
+constexpr u32 MaxNumItems = 0xffffff;
+/// Alignment of the data of FileData nodes is only preserved up to this value.
+constexpr u32 MaxDataAlignment = 0x10000;
+
+/// Returns whether the raw value of a node is an offset (for containers, 64-bit values and
+/// binary data).
+constexpr bool isOffsetType(NodeType type) {
+  return !isValueType(type);
+}
+
+/// Reference to a container that is rewritten (index in Patcher::mContainers).
+struct ContainerRef {
+  u32 index;
+};
+
+/// Item of a container that is rewritten: an item of the source document that is kept as is,
+/// a new value or a container that is rewritten as well.
+using Item = std::variant<RawItemData, Node, ContainerRef>;
+
+/// Container that is rewritten. Items are stored in the order in which they are written.
+struct Container {
+  /// Array, Hash, Hash32 or ValueHash32.
+  NodeType type;
+  std::vector<Item> items;
+  /// Keys of the items (for hashes). Keys are sorted and null terminated.
+  std::vector<std::string_view> keys;
+  /// Keys of the items (for Hash32 nodes), sorted.
+  std::vector<u32> hash32Keys;
+};
+
+/// Maps the indices of a string table of the source document to the new table.
+/// Empty if the table is unchanged.
+using IndexMap = std::vector<u32>;
+
+/// Merge the strings of a table of the source document with new strings.
+/// Returns nullopt if a string of the source table is invalid.
+template <typename GetString>
+std::optional<std::vector<std::string_view>>
+mergeStrings(size_t numStrings, GetString getString, const std::vector<std::string_view>& added,
+             IndexMap& map) {
+  std::vector<std::string_view> result;
+  result.reserve(numStrings + added.size());
+  map.resize(numStrings);
+  size_t j = 0;
+  for (u32 i = 0; i < numStrings; ++i) {
+    const std::optional<std::string_view> string = getString(i);
+    if (!string)
+      return {};
+    while (j < added.size() && added[j] < *string)
+      result.push_back(added[j++]);
+    map[i] = static_cast<u32>(result.size());
+    result.push_back(*string);
+  }
+  result.insert(result.end(), added.begin() + j, added.end());
+  return result;
+}
+
+class Patcher {
+public:
+  explicit Patcher(const Reader& source)
+      : mSource{source}, mBr{source.getBuffer().data(), source.isBigEndian()} {}
+
+  bool init() {
+    if (const auto root = mSource.getRoot())
+      mRoot = root->raw;
+    return mSource.hasRoot() == std::holds_alternative<RawItemData>(mRoot);
+  }
+
+  bool apply(const PatchEdit& edit) {
+    mModified = true;
+    if (edit.path.empty()) {
+      if (edit.op == PatchEdit::Op::Set) {
+        if (!isContainerType(edit.value.getType()) && !edit.value.isNull())
+          return false;
+        mRoot = edit.value;
+        return true;
+      }
+      if (edit.op == PatchEdit::Op::Remove)
+        return false;
+    }
+
+    // Rewrite the containers on the path of the edit.
+    const size_t depth = edit.op == PatchEdit::Op::Append ? edit.path.size() : edit.path.size() - 1;
+    std::optional<u32> index = makeWritable(mRoot);
+    for (size_t i = 0; i < depth && index; ++i) {
+      Container& container = mContainers[*index];
+      const std::optional<size_t> position = find(container, edit.path[i]);
+      if (!position)
+        return false;
+      index = makeWritable(container.items[*position]);
+    }
+    if (!index)
+      return false;
+
+    Container& container = mContainers[*index];
+    switch (edit.op) {
+    case PatchEdit::Op::Set:
+      return set(container, edit.path.back(), edit.value);
+    case PatchEdit::Op::Remove:
+      return remove(container, edit.path.back());
+    case PatchEdit::Op::Append:
+      if (container.type != NodeType::Array || container.items.size() >= MaxNumItems)
+        return false;
+      container.items.emplace_back(edit.value);
+      return true;
+    }
+    return false;
+  }
+
+  std::optional<std::vector<u8>> write();
+
+private:
+  /// Get the rewritten container for an item, and rewrite it first if needed.
+  /// Returns nullopt if the item is not a container or if it is invalid.
+  std::optional<u32> makeWritable(Item& item) {
+    if (const auto* ref = std::get_if<ContainerRef>(&item))
+      return ref->index;
+
+    Container container;
+    if (const auto* raw = std::get_if<RawItemData>(&item)) {
+      const ItemData data{mSource, *raw};
+      switch (raw->type) {
+      case NodeType::Array:
+      case NodeType::MonoTypedArray: {
+        // Monotyped arrays are rewritten as regular arrays.
+        const auto array = data.getArray();
+        if (!array)
+          return {};
+        container.type = NodeType::Array;
+        container.items.reserve(array->numItems());
+        for (size_t i = 0; i < array->numItems(); ++i)
+          container.items.emplace_back((*array)[i].raw);
+        break;
+      }
+      case NodeType::Hash: {
+        const auto hash = data.getHash();
+        if (!hash)
+          return {};
+        container.type = NodeType::Hash;
+        container.items.reserve(hash->numItems());
+        container.keys.reserve(hash->numItems());
+        for (size_t i = 0; i < hash->numItems(); ++i) {
+          const auto child = hash->getByIndex(i);
+          if (!child || !child->name)
+            return {};
+          container.keys.emplace_back(child->name);
+          container.items.emplace_back(child->data.raw);
+        }
+        break;
+      }
+      case NodeType::Hash32:
+      case NodeType::ValueHash32: {
+        const auto hash = data.getHash32();
+        if (!hash)
+          return {};
+        container.type = raw->type;
+        container.items.reserve(hash->numItems());
+        container.hash32Keys.reserve(hash->numItems());
+        for (size_t i = 0; i < hash->numItems(); ++i) {
+          const auto child = hash->getByIndex(i);
+          if (!child)
+            return {};
+          container.hash32Keys.push_back(child->key);
+          container.items.emplace_back(child->data.raw);
+        }
+        break;
+      }
+      default:
+        return {};
+      }
+    } else {
+      const Node& node = std::get<Node>(item);
+      container.type = node.getType();
+      if (node.isArray()) {
+        container.items.assign(node.getArrayItems(), node.getArrayItems() + node.numItems());
+      } else if (node.isHash()) {
+        for (size_t i = 0; i < node.numItems(); ++i) {
+          const HashEntry& entry = node.getHashEntries()[i];
+          container.keys.push_back(entry.getKey());
+          container.items.emplace_back(entry.value);
+        }
+      } else {
+        return {};
+      }
+    }
+
+    const u32 index = static_cast<u32>(mContainers.size());
+    mContainers.push_back(std::move(container));
+    item = ContainerRef{index};
+    return index;
+  }
+
+  /// Returns the position of an item in a container, or nullopt if it does not exist.
+  static std::optional<size_t> find(const Container& container, const PathElement& element) {
+    switch (element.type) {
+    case PathElement::Type::Key: {
+      if (container.type != NodeType::Hash)
+        return {};
+      const auto it = std::lower_bound(container.keys.begin(), container.keys.end(), element.key);
+      if (it == container.keys.end() || *it != element.key)
+        return {};
+      return it - container.keys.begin();
+    }
+    case PathElement::Type::Index:
+      if (container.type != NodeType::Array || element.index >= container.items.size())
+        return {};
+      return element.index;
+    case PathElement::Type::Hash32Key: {
+      if (container.type != NodeType::Hash32 && container.type != NodeType::ValueHash32)
+        return {};
+      const auto& keys = container.hash32Keys;
+      const auto it = std::lower_bound(keys.begin(), keys.end(), element.index);
+      if (it == keys.end() || *it != element.index)
+        return {};
+      return it - keys.begin();
+    }
+    }
+    return {};
+  }
+
+  bool set(Container& container, const PathElement& element, const Node& value) {
+    if (const auto position = find(container, element)) {
+      container.items[*position] = value;
+      return true;
+    }
+    if (container.items.size() >= MaxNumItems)
+      return false;
+
+    // Add a new item.
+    if (element.type == PathElement::Type::Key && container.type == NodeType::Hash) {
+      if (std::memchr(element.key.data(), 0, element.key.size()))
+        return false;
+      const auto it = std::lower_bound(container.keys.begin(), container.keys.end(), element.key);
+      const auto position = it - container.keys.begin();
+      container.keys.insert(it, mArena.copyString(element.key));
+      container.items.emplace(container.items.begin() + position, value);
+      return true;
+    }
+    if (element.type == PathElement::Type::Hash32Key &&
+        (container.type == NodeType::Hash32 || container.type == NodeType::ValueHash32)) {
+      auto& keys = container.hash32Keys;
+      const auto it = std::lower_bound(keys.begin(), keys.end(), element.index);
+      const auto position = it - keys.begin();
+      keys.insert(it, element.index);
+      container.items.emplace(container.items.begin() + position, value);
+      return true;
+    }
+    return false;
+  }
+
+  static bool remove(Container& container, const PathElement& element) {
+    const auto position = find(container, element);
+    if (!position)
+      return false;
+    container.items.erase(container.items.begin() + *position);
+    if (container.type == NodeType::Hash)
+      container.keys.erase(container.keys.begin() + *position);
+    else if (container.type != NodeType::Array)
+      container.hash32Keys.erase(container.hash32Keys.begin() + *position);
+    return true;
+  }
+
+  bool collectUsage();
+  bool buildTables();
+  bool collectSourceNodes();
+  std::optional<u32> findKeyIndex(std::string_view key) const;
+  std::optional<u32> findStringIndex(std::string_view string) const;
+  u32 relocate(NodeType type, u32 value) const;
+  void relocateSourceContainers();
+  std::optional<u32> writeRewrittenNodes();
+  std::optional<u32> encodeValue(const Item& item);
+
+  const Reader& mSource;
+  common::BinaryReader mBr;
+  /// Root of the patched document (a null node for empty documents).
+  Item mRoot = Node{};
+  /// Rewritten containers. A deque is used so that references to containers stay valid.
+  std::deque<Container> mContainers;
+  common::Arena mArena;
+  bool mModified = false;
+
+  // Nodes that are used by the patched document.
+
+  /// Source containers and other nodes at an offset that are referenced by rewritten containers.
+  std::vector<RawItemData> mSourceNodes;
+  /// Keys and strings of rewritten containers and new values.
+  std::vector<std::string_view> mKeys;
+  std::vector<std::string_view> mStrings;
+
+  // Layout of the output.
+
+  bool mTablesChanged = false;
+  std::vector<std::string_view> mNewKeys;
+  std::vector<std::string_view> mNewStrings;
+  IndexMap mKeyMap;
+  IndexMap mStringMap;
+  /// Offsets of the source containers that are referenced by the patched document
+  /// (only collected if the tables are rebuilt).
+  std::vector<u32> mSourceContainers;
+  /// Start of the part of the source data that is copied.
+  u32 mBodyStart = 0;
+  /// Alignment that the copied data must keep.
+  u32 mBodyAlignment = 8;
+  /// Value that is added to source offsets (modulo 2^32, since the data can be moved backwards).
+  u32 mDelta = 0;
+  std::vector<u8> mOutput;
+};
+
+/// Collect the keys and strings of new nodes, as well as the source nodes that they refer to.
+bool Patcher::collectUsage() {
+  std::vector<Item> stack{mRoot};
+  // Containers of new values can be shared.
+  std::unordered_set<const void*> visitedNodes;
+  while (!stack.empty()) {
+    const Item item = std::move(stack.back());
+    stack.pop_back();
+
+    if (const auto* raw = std::get_if<RawItemData>(&item)) {
+      if (isOffsetType(raw->type))
+        mSourceNodes.push_back(*raw);
+      continue;
+    }
+
+    if (const auto* ref = std::get_if<ContainerRef>(&item)) {
+      const Container& container = mContainers[ref->index];
+      mKeys.insert(mKeys.end(), container.keys.begin(), container.keys.end());
+      stack.insert(stack.end(), container.items.begin(), container.items.end());
+      continue;
+    }
+
+    const Node& node = std::get<Node>(item);
+    if (node.getType() == NodeType::String) {
+      mStrings.push_back(*node.getStringView());
+    } else if (node.isArray()) {
+      if (visitedNodes.insert(node.getArrayItems()).second)
+        stack.insert(stack.end(), node.getArrayItems(), node.getArrayItems() + node.numItems());
+    } else if (node.isHash()) {
+      if (visitedNodes.insert(node.getHashEntries()).second) {
+        for (size_t i = 0; i < node.numItems(); ++i) {
+          mKeys.push_back(node.getHashEntries()[i].getKey());
+          stack.emplace_back(node.getHashEntries()[i].value);
+        }
+      }
+    } else if (!isValueType(node.getType()) && mSource.getVersion() < 3) {
+      ERR_LOG("64-bit nodes require version 3");
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Determine whether the string tables need to be rebuilt and build them if so.
+bool Patcher::buildTables() {
+  // Keys and strings are null terminated, so they can be looked up in the source tables.
+  const auto getMissing = [](std::vector<std::string_view>& strings, auto isInSource) {
+    std::sort(strings.begin(), strings.end());
+    strings.erase(std::unique(strings.begin(), strings.end()), strings.end());
+    strings.erase(std::remove_if(strings.begin(), strings.end(), isInSource), strings.end());
+  };
+  getMissing(mKeys, [&](std::string_view key) { return mSource.findKey(key.data()).has_value(); });
+  getMissing(mStrings, [&](std::string_view string) {
+    return mSource.findString(string.data()).has_value();
+  });
+  if (mKeys.size() + mSource.getNumKeys() > MaxNumItems ||
+      mStrings.size() + mSource.getNumStrings() > MaxNumItems) {
+    return false;
+  }
+
+  mTablesChanged = !mKeys.empty() || !mStrings.empty();
+  if (!mTablesChanged)
+    return true;
+
+  auto newKeys = mergeStrings(
+      mSource.getNumKeys(), [&](u32 i) { return mSource.getKeyView(i); }, mKeys, mKeyMap);
+  auto newStrings = mergeStrings(
+      mSource.getNumStrings(), [&](u32 i) { return mSource.getStringView(i); }, mStrings,
+      mStringMap);
+  if (!newKeys || !newStrings)
+    return false;
+  mNewKeys = std::move(*newKeys);
+  mNewStrings = std::move(*newStrings);
+  return true;
+}
+
+/// Collect the source containers that are still referenced and determine which part of the
+/// source data needs to be copied. Only called if the tables are rebuilt.
+bool Patcher::collectSourceNodes() {
+  const u32 sourceSize = static_cast<u32>(mSource.getBuffer().size());
+
+  // In most documents, the string tables immediately follow the header and are followed by
+  // the nodes. Skip the tables if that is the case, and copy everything after the header otherwise.
+  std::vector<std::pair<u64, u64>> tables;
+  for (const u32 offset : {mSource.getHashKeyTableOffset(), mSource.getStringTableOffset()}) {
+    if (offset == 0)
+      continue;
+    if (u64(offset) + 4 > sourceSize)
+      return false;
+    const u32 numStrings = util::readContainerSize(mBr, offset);
+    const u64 endOffsetPos = u64(offset) + 4 + 4 * u64(numStrings);
+    if (endOffsetPos + 4 > sourceSize)
+      return false;
+    tables.emplace_back(offset, offset + u64(mBr.read<u32>(endOffsetPos)));
+  }
+  std::sort(tables.begin(), tables.end());
+  mBodyStart = sizeof(ResHeader);
+  for (const auto& [start, end] : tables) {
+    if (start != mBodyStart)
+      break;
+    mBodyStart = static_cast<u32>(std::min<u64>(common::AlignUp(end, 4), sourceSize));
+  }
+
+  std::vector<bool> visited(sourceSize);
+  std::vector<RawItemData> stack = std::move(mSourceNodes);
+  u32 minOffset = sourceSize;
+  while (!stack.empty()) {
+    const RawItemData node = stack.back();
+    stack.pop_back();
+    if (node.raw >= sourceSize)
+      return false;
+    minOffset = std::min<u32>(minOffset, node.raw);
+
+    if (node.type == NodeType::FileData) {
+      if (u64(node.raw) + 8 > sourceSize)
+        return false;
+      const u32 alignment = mBr.read<u32>(node.raw + 4);
+      if (alignment != 0 && (alignment & (alignment - 1)) == 0 && alignment <= MaxDataAlignment)
+        mBodyAlignment = std::max(mBodyAlignment, alignment);
+    }
+    if (!isAnyContainerType(node.type) || visited[node.raw])
+      continue;
+    visited[node.raw] = true;
+
+    // Check the container (if checked access is enabled) and queue its children.
+    const ItemData data{mSource, node};
+    std::optional<u32> numItems;
+    if (node.type == NodeType::Hash) {
+      if (const auto hash = data.getHash())
+        numItems = hash->numItems();
+    } else if (node.type == NodeType::Hash32 || node.type == NodeType::ValueHash32) {
+      if (const auto hash = data.getHash32())
+        numItems = hash->numItems();
+    } else if (const auto array = data.getArray()) {
+      numItems = array->numItems();
+    }
+    if (!numItems)
+      return false;
+
+    // Indices are checked here since they are used to look up the new indices.
+    mSourceContainers.push_back(node.raw);
+    for (u32 i = 0; i < *numItems; ++i) {
+      const RawItemData child = util::readContainerItem(mBr, node.raw, node.type, *numItems, i);
+      if (child.type == NodeType::String && child.raw >= mStringMap.size())
+        return false;
+      const bool isHash = node.type == NodeType::Hash;
+      if (isHash && util::readHashItemKeyIndex(mBr, node.raw, i) >= mKeyMap.size())
+        return false;
+      if (isOffsetType(child.type))
+        stack.push_back(child);
+    }
+  }
+
+  if (minOffset < sizeof(ResHeader))
+    return false;
+  if (minOffset < mBodyStart)
+    mBodyStart = sizeof(ResHeader);
+  return true;
+}
+
+std::optional<u32> Patcher::findKeyIndex(std::string_view key) const {
+  if (!mTablesChanged) {
+    const auto id = mSource.findKey(key.data());
+    return id ? std::optional<u32>{id->index} : std::nullopt;
+  }
+  const auto it = std::lower_bound(mNewKeys.begin(), mNewKeys.end(), key);
+  if (it == mNewKeys.end() || *it != key)
+    return {};
+  return static_cast<u32>(it - mNewKeys.begin());
+}
+
+std::optional<u32> Patcher::findStringIndex(std::string_view string) const {
+  if (!mTablesChanged)
+    return mSource.findString(string.data());
+  const auto it = std::lower_bound(mNewStrings.begin(), mNewStrings.end(), string);
+  if (it == mNewStrings.end() || *it != string)
+    return {};
+  return static_cast<u32>(it - mNewStrings.begin());
+}
+
+/// Get the new raw value of a node that is copied from the source document.
+u32 Patcher::relocate(NodeType type, u32 value) const {
+  if (type == NodeType::String)
+    return mStringMap.empty() ? value : mStringMap[value];
+  if (isOffsetType(type))
+    return value + mDelta;
+  return value;
+}
+
+/// Fix up the offsets and the string indices of the source containers that were copied.
+void Patcher::relocateSourceContainers() {
+  const common::BinaryWriter writer{mOutput.data(), mSource.isBigEndian()};
+  const auto relocateValue = [&](NodeType type, u32 sourceOffset) {
+    if (type == NodeType::String || isOffsetType(type))
+      writer.write<u32>(sourceOffset + mDelta, relocate(type, mBr.read<u32>(sourceOffset)));
+  };
+
+  for (const u32 offset : mSourceContainers) {
+    const auto type = NodeType(mBr.read<u8>(offset));
+    const u32 numItems = util::readContainerSize(mBr, offset);
+    switch (type) {
+    case NodeType::Array: {
+      const u64 typesOffset = util::getArrayTypesOffset(offset);
+      const u64 valuesOffset = util::getArrayValuesOffset(offset, numItems);
+      for (u32 i = 0; i < numItems; ++i)
+        relocateValue(NodeType(mBr.read<u8>(typesOffset + i)), valuesOffset + 4 * i);
+      break;
+    }
+    case NodeType::MonoTypedArray: {
+      const NodeType itemType = util::readMonoTypedArrayItemType(mBr, offset);
+      const u64 valuesOffset = util::getMonoTypedArrayValuesOffset(offset);
+      if (itemType == NodeType::String || isOffsetType(itemType)) {
+        for (u32 i = 0; i < numItems; ++i)
+          relocateValue(itemType, valuesOffset + 4 * i);
+      }
+      break;
+    }
+    case NodeType::Hash:
+      for (u32 i = 0; i < numItems; ++i) {
+        const u32 itemOffset = static_cast<u32>(util::getHashItemOffset(offset, i));
+        const util::RawHashItem item = util::readHashItemWithItemOffset(mBr, itemOffset);
+        if (!mKeyMap.empty())
+          writer.writeU24(itemOffset + mDelta, mKeyMap[item.keyIndex]);
+        relocateValue(item.data.type, itemOffset + 4);
+      }
+      break;
+    default: {
+      // Hash32 and ValueHash32.
+      const u32 valueOffset = type == NodeType::ValueHash32 ? 0 : 4;
+      const u64 typesOffset = util::getHash32TypesOffset(offset, numItems);
+      for (u32 i = 0; i < numItems; ++i) {
+        relocateValue(NodeType(mBr.read<u8>(typesOffset + i)),
+                      util::getHash32ItemOffset(offset, i) + valueOffset);
+      }
+      break;
+    }
+    }
+  }
+}
+
+/// Get the raw value of an item that is not a container. Returns nullopt on failure.
+std::optional<u32> Patcher::encodeValue(const Item& item) {
+  if (const auto* raw = std::get_if<RawItemData>(&item)) {
+    if (raw->type == NodeType::String && mTablesChanged && raw->raw >= mStringMap.size())
+      return {};
+    return relocate(raw->type, raw->raw);
+  }
+
+  const Node& node = std::get<Node>(item);
+  switch (node.getType()) {
+  case NodeType::String:
+    return findStringIndex(*node.getStringView());
+  case NodeType::Bool:
+    return u32(*node.getBool());
+  case NodeType::Int:
+    return static_cast<u32>(*node.getInt());
+  case NodeType::UInt:
+    return *node.getUInt();
+  case NodeType::Float: {
+    const f32 value = *node.getFloat();
+    u32 raw;
+    std::memcpy(&raw, &value, sizeof(raw));
+    return raw;
+  }
+  case NodeType::Int64:
+  case NodeType::UInt64:
+  case NodeType::Double: {
+    u64 raw;
+    if (node.getType() == NodeType::Double) {
+      const f64 value = *node.getDouble();
+      std::memcpy(&raw, &value, sizeof(raw));
+    } else if (node.getType() == NodeType::Int64) {
+      raw = static_cast<u64>(*node.getInt64());
+    } else {
+      raw = *node.getUInt64();
+    }
+    const u32 offset = static_cast<u32>(mOutput.size());
+    mOutput.resize(mOutput.size() + 8);
+    common::BinaryWriter{mOutput.data(), mSource.isBigEndian()}.write<u64>(offset, raw);
+    return offset;
+  }
+  case NodeType::Null:
+    return 0;
+  default:
+    return {};
+  }
+}
+
+/// Write the rewritten containers and new values at the end of the output.
+/// Children are written before their parents. Returns the offset of the root node.
+std::optional<u32> Patcher::writeRewrittenNodes() {
+  struct Frame {
+    NodeType type;
+    const Item* items;
+    size_t numItems;
+    /// Keys (for hashes) or nullptr.
+    const std::string_view* keys;
+    const HashEntry* entries;
+    /// Keys (for Hash32 nodes) or nullptr.
+    const u32* hash32Keys;
+    /// Items of a new array. Hash items are read from `entries`.
+    const Node* nodes;
+    /// Pointer that identifies a container of a new value (to detect cycles).
+    const void* identity;
+    std::vector<u32> values;
+    std::vector<NodeType> types;
+  };
+  std::vector<Frame> stack;
+  std::unordered_set<const void*> inProgress;
+
+  // Push a container, or return false if an item is not a container.
+  const auto push = [&](const Item& item) -> std::optional<bool> {
+    Frame frame{};
+    if (const auto* ref = std::get_if<ContainerRef>(&item)) {
+      const Container& container = mContainers[ref->index];
+      frame.type = container.type;
+      frame.items = container.items.data();
+      frame.numItems = container.items.size();
+      frame.keys = container.keys.data();
+      frame.hash32Keys = container.hash32Keys.data();
+    } else if (const auto* node = std::get_if<Node>(&item);
+               node && isContainerType(node->getType())) {
+      frame.type = node->getType();
+      frame.numItems = node->numItems();
+      frame.nodes = node->getArrayItems();
+      frame.entries = node->getHashEntries();
+      // Documents can contain cycles if an array is added to itself.
+      if (frame.numItems != 0) {
+        frame.identity = node->isArray() ? static_cast<const void*>(frame.nodes) : frame.entries;
+        if (!inProgress.insert(frame.identity).second)
+          return std::nullopt;
+      }
+    } else {
+      return false;
+    }
+    frame.values.reserve(frame.numItems);
+    frame.types.reserve(frame.numItems);
+    stack.push_back(std::move(frame));
+    return true;
+  };
+
+  const auto getItem = [](const Frame& frame, size_t i) -> Item {
+    if (frame.items)
+      return frame.items[i];
+    if (frame.nodes)
+      return frame.nodes[i];
+    return frame.entries ? Item{frame.entries[i].value} : Item{Node{}};
+  };
+
+  const auto getType = [&](const Item& item) {
+    if (const auto* raw = std::get_if<RawItemData>(&item))
+      return raw->type;
+    if (const auto* ref = std::get_if<ContainerRef>(&item))
+      return mContainers[ref->index].type;
+    return std::get<Node>(item).getType();
+  };
+
+  const auto pushed = push(mRoot);
+  if (!pushed)
+    return {};
+  if (!*pushed)
+    return 0;
+
+  while (true) {
+    Frame& frame = stack.back();
+    if (frame.values.size() < frame.numItems) {
+      const Item item = getItem(frame, frame.values.size());
+      const auto isContainer = push(item);
+      if (!isContainer)
+        return {};
+      if (*isContainer)
+        continue;
+      const auto value = encodeValue(item);
+      if (!value)
+        return {};
+      frame.values.push_back(*value);
+      frame.types.push_back(getType(item));
+      continue;
+    }
+
+    // Encode the container.
+    const u32 offset = static_cast<u32>(mOutput.size());
+    const size_t n = frame.numItems;
+    switch (frame.type) {
+    case NodeType::Array:
+      mOutput.resize(util::getArrayValuesOffset(offset, n) + 4 * n);
+      break;
+    case NodeType::Hash:
+      mOutput.resize(util::getHashItemOffset(offset, n));
+      break;
+    default:
+      mOutput.resize(util::getHash32TypesOffset(offset, n) + common::AlignUp(n, 4));
+      break;
+    }
+    if (mOutput.size() > 0xffffffff)
+      return {};
+
+    const common::BinaryWriter writer{mOutput.data(), mSource.isBigEndian()};
+    writer.write<u8>(offset, u8(frame.type));
+    writer.writeU24(offset + 1, n);
+    switch (frame.type) {
+    case NodeType::Array: {
+      const u64 typesOffset = util::getArrayTypesOffset(offset);
+      const u64 valuesOffset = util::getArrayValuesOffset(offset, n);
+      for (size_t i = 0; i < n; ++i) {
+        writer.write<u8>(typesOffset + i, u8(frame.types[i]));
+        writer.write<u32>(valuesOffset + 4 * i, frame.values[i]);
+      }
+      break;
+    }
+    case NodeType::Hash:
+      for (size_t i = 0; i < n; ++i) {
+        const std::string_view key = frame.keys ? frame.keys[i] : frame.entries[i].getKey();
+        const auto keyIndex = findKeyIndex(key);
+        if (!keyIndex)
+          return {};
+        const u64 itemOffset = util::getHashItemOffset(offset, i);
+        writer.writeU24(itemOffset, *keyIndex);
+        writer.write<u8>(itemOffset + 3, u8(frame.types[i]));
+        writer.write<u32>(itemOffset + 4, frame.values[i]);
+      }
+      break;
+    default: {
+      const bool isValueHash32 = frame.type == NodeType::ValueHash32;
+      const u64 typesOffset = util::getHash32TypesOffset(offset, n);
+      for (size_t i = 0; i < n; ++i) {
+        const u64 itemOffset = util::getHash32ItemOffset(offset, i);
+        writer.write<u32>(itemOffset + (isValueHash32 ? 4 : 0), frame.hash32Keys[i]);
+        writer.write<u32>(itemOffset + (isValueHash32 ? 0 : 4), frame.values[i]);
+        writer.write<u8>(typesOffset + i, u8(frame.types[i]));
+      }
+      break;
+    }
+    }
+
+    inProgress.erase(frame.identity);
+    const NodeType type = frame.type;
+    stack.pop_back();
+    if (stack.empty())
+      return offset;
+    stack.back().values.push_back(offset);
+    stack.back().types.push_back(type);
+  }
+}
+
+std::optional<std::vector<u8>> Patcher::write() {
+  const Buffer source = mSource.getBuffer();
+  if (!mModified)
+    return std::vector<u8>(source.data(), source.data() + source.size());
+
+  if (!collectUsage() || !buildTables())
+    return {};
+
+  if (!mTablesChanged) {
+    // Indices and offsets are unchanged: the source data is copied as is.
+    mOutput.assign(source.data(), source.data() + source.size());
+    mOutput.resize(common::AlignUp(mOutput.size(), 4));
+  } else {
+    if (!collectSourceNodes())
+      return {};
+
+    // Layout: header, hash key table, string table, source nodes, rewritten nodes.
+    const u32 keyTableSize = util::getStringTableSize(mNewKeys);
+    const u32 stringTableSize = util::getStringTableSize(mNewStrings);
+    const u64 tablesEnd = sizeof(ResHeader) + u64(keyTableSize) + stringTableSize;
+    // The copied data is moved by a multiple of its alignment.
+    u64 bodyOffset = common::AlignDown(tablesEnd, mBodyAlignment) + mBodyStart % mBodyAlignment;
+    if (bodyOffset < tablesEnd)
+      bodyOffset += mBodyAlignment;
+    const u64 outputSize = common::AlignUp(bodyOffset + source.size() - mBodyStart, 4);
+    if (outputSize > 0xffffffff)
+      return {};
+    mDelta = static_cast<u32>(bodyOffset - mBodyStart);
+
+    mOutput.resize(outputSize);
+    std::memcpy(mOutput.data(), source.data(), sizeof(ResHeader));
+    std::memcpy(mOutput.data() + bodyOffset, source.data() + mBodyStart,
+                source.size() - mBodyStart);
+    const common::BinaryWriter writer{mOutput.data(), mSource.isBigEndian()};
+    const u32 keyTableOffset = keyTableSize ? sizeof(ResHeader) : 0;
+    const u32 stringTableOffset = stringTableSize ? sizeof(ResHeader) + keyTableSize : 0;
+    writer.write<u32>(offsetof(ResHeader, hashKeyTableOffset), keyTableOffset);
+    writer.write<u32>(offsetof(ResHeader, stringTableOffset), stringTableOffset);
+    if (keyTableOffset)
+      util::writeStringTable(writer, keyTableOffset, mNewKeys);
+    if (stringTableOffset)
+      util::writeStringTable(writer, stringTableOffset, mNewStrings);
+    relocateSourceContainers();
+  }
+
+  const auto rootOffset = writeRewrittenNodes();
+  if (!rootOffset)
+    return {};
+  common::BinaryWriter{mOutput.data(), mSource.isBigEndian()}.write<u32>(
+      offsetof(ResHeader, rootNodeOffset), *rootOffset);
+  return std::move(mOutput);
+}
+
+}  // end of anonymous namespace
+
+std::optional<std::vector<u8>> applyPatch(const Reader& source,
+                                          const std::vector<PatchEdit>& edits) {
+  Patcher patcher{source};
+  if (!patcher.init())
+    return {};
+  for (const PatchEdit& edit : edits) {
+    if (!patcher.apply(edit))
+      return {};
+  }
+  return patcher.write();
+}
+
+}  // namespace byml
@@ -0,0 +1,831 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+
+#include "byml/query.h"
+
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "byml/binary_format.h"
+#include "byml/byml.h"
+#include "common/log.h"
+
+namespace byml {
+
+namespace {
+
+enum class StepKind : u8 {
+  /// The value of a key in a hash.
+  Key,
+  /// All items of a container.
+  AllItems,
+  /// An item of an array (negative indices count from the end).
+  Index,
+  /// A range of items of an array.
+  Slice,
+  /// The items of a container that satisfy a filter.
+  Filter,
+  /// The node itself and all containers below it, in document order.
+  Descendants,
+};
+
+struct Step {
+  StepKind kind;
+  /// Key slot (Key) or filter node index (Filter).
+  u32 index = 0;
+  /// Index (Index) or slice bounds (Slice).
+  s64 start = 0;
+  s64 stop = 0;
+  s64 stride = 1;
+  bool hasStart = false;
+  bool hasStop = false;
+};
+
+using Path = std::vector<Step>;
+
+/// A number that can hold any BYML numeric value without losing precision.
+/// Integers are stored as s64 if they are negative and as u64 otherwise.
+struct Number {
+  enum class Kind : u8 { Negative, NonNegative, Float };
+  Kind kind = Kind::NonNegative;
+  s64 negative = 0;
+  u64 nonNegative = 0;
+  f64 floatValue = 0;
+
+  static Number fromSigned(s64 value) {
+    Number number;
+    if (value < 0) {
+      number.kind = Kind::Negative;
+      number.negative = value;
+    } else {
+      number.nonNegative = value;
+    }
+    return number;
+  }
+
+  static Number fromUnsigned(u64 value) {
+    Number number;
+    number.nonNegative = value;
+    return number;
+  }
+
+  static Number fromFloat(f64 value) {
+    Number number;
+    number.kind = Kind::Float;
+    number.floatValue = value;
+    return number;
+  }
+
+  f64 toDouble() const {
+    switch (kind) {
+    case Kind::Negative:
+      return f64(negative);
+    case Kind::NonNegative:
+      return f64(nonNegative);
+    case Kind::Float:
+      return floatValue;
+    }
+    return 0;
+  }
+};
+
+/// Returns -1, 0 or 1, or nullopt if the numbers are unordered (NaN).
+std::optional<int> compareNumbers(const Number& a, const Number& b) {
+  using Kind = Number::Kind;
+  const auto sign = [](auto x, auto y) { return x < y ? -1 : (x > y ? 1 : 0); };
+  if (a.kind == Kind::Float || b.kind == Kind::Float) {
+    const f64 x = a.toDouble();
+    const f64 y = b.toDouble();
+    if (std::isnan(x) || std::isnan(y))
+      return {};
+    return sign(x, y);
+  }
+  if (a.kind != b.kind)
+    return a.kind == Kind::Negative ? -1 : 1;
+  return a.kind == Kind::Negative ? sign(a.negative, b.negative) :
+                                    sign(a.nonNegative, b.nonNegative);
+}
+
+std::optional<Number> getNumber(const ItemData& item) {
+  switch (item.raw.type) {
+  case NodeType::Int:
+    return Number::fromSigned(*item.getInt());
+  case NodeType::UInt:
+    return Number::fromUnsigned(item.raw.raw);
+  case NodeType::Int64:
+    return Number::fromSigned(*item.getInt64());
+  case NodeType::UInt64:
+    return Number::fromUnsigned(*item.getUInt64());
+  case NodeType::Float:
+  case NodeType::Double:
+    return Number::fromFloat(*item.getDouble());
+  default:
+    return {};
+  }
+}
+
+enum class LiteralType : u8 { String, Number, Bool, Null };
+
+struct Literal {
+  LiteralType type = LiteralType::Null;
+  /// String slot (String).
+  u32 index = 0;
+  std::string string;
+  Number number;
+  bool boolean = false;
+};
+
+enum class CompareOp : u8 { Eq, Ne, Lt, Le, Gt, Ge };
+
+enum class FilterOp : u8 { And, Or, Not, Exists, Compare };
+
+struct FilterNode {
+  FilterOp op = FilterOp::Exists;
+  /// Operands (And, Or, Not).
+  u32 lhs = 0;
+  u32 rhs = 0;
+  /// Path index (Exists, Compare).
+  u32 path = 0;
+  CompareOp compare = CompareOp::Eq;
+  Literal literal;
+};
+
+}  // end of anonymous namespace
+
+struct Query::Plan {
+  std::string expression;
+  /// The main path is paths[0]. Other paths are used by filters.
+  std::vector<Path> paths;
+  std::vector<FilterNode> filters;
+  /// Keys and string literals, deduplicated. Steps and literals refer to them by slot.
+  std::vector<std::string> keys;
+  std::vector<std::string> strings;
+};
+
+namespace {
+
+constexpr bool isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+constexpr bool isNameChar(char c) {
+  return !isSpace(c) && c != '\0' && !std::strchr(".[]()*@$?:,'\"=!<>&|", c);
+}
+
+class QueryParser {
+public:
+  explicit QueryParser(std::string_view text) : mText{text} {}
+
+  std::optional<Query::Plan> parse() {
+    mPlan.expression = mText;
+    mPlan.paths.emplace_back();
+    skipSpaces();
+    if (peek() == '$')
+      ++mPos;
+    if (!parsePath(0, true))
+      return {};
+    skipSpaces();
+    if (mPos != mText.size())
+      return fail("unexpected character");
+    return std::move(mPlan);
+  }
+
+private:
+  char peek(size_t offset = 0) const {
+    return mPos + offset < mText.size() ? mText[mPos + offset] : '\0';
+  }
+
+  void skipSpaces() {
+    while (isSpace(peek()))
+      ++mPos;
+  }
+
+  bool consume(std::string_view token) {
+    skipSpaces();
+    if (mText.substr(mPos, token.size()) != token)
+      return false;
+    mPos += token.size();
+    return true;
+  }
+
+  std::nullopt_t fail([[maybe_unused]] const char* message) {
+    if (!mError)
+      ERR_LOG("Invalid query \"{}\" (column {}): {}", mText, mPos + 1, message);
+    mError = true;
+    return std::nullopt;
+  }
+
+  Path& path(u32 index) { return mPlan.paths[index]; }
+
+  static u32 addSlot(std::vector<std::string>& slots, std::string value) {
+    for (size_t i = 0; i < slots.size(); ++i) {
+      if (slots[i] == value)
+        return i;
+    }
+    slots.emplace_back(std::move(value));
+    return slots.size() - 1;
+  }
+
+  void addKeyStep(u32 pathIndex, std::string key) {
+    path(pathIndex).push_back({StepKind::Key, addSlot(mPlan.keys, std::move(key))});
+  }
+
+  /// Parse a sequence of steps. If `bare` is true, the first step may be a key or `*`
+  /// without a leading dot.
+  bool parsePath(u32 pathIndex, bool bare) {
+    while (true) {
+      const char c = peek();
+      if (c == '.' && peek(1) == '.') {
+        mPos += 2;
+        path(pathIndex).push_back({StepKind::Descendants});
+        if (peek() == '[')
+          continue;
+        if (!parseKeyOrWildcard(pathIndex))
+          return false;
+      } else if (c == '.') {
+        ++mPos;
+        if (!parseKeyOrWildcard(pathIndex))
+          return false;
+      } else if (c == '[') {
+        ++mPos;
+        if (!parseBracket(pathIndex))
+          return false;
+      } else if (bare && (isNameChar(c) || c == '*')) {
+        if (!parseKeyOrWildcard(pathIndex))
+          return false;
+      } else {
+        return true;
+      }
+      bare = false;
+    }
+  }
+
+  bool parseKeyOrWildcard(u32 pathIndex) {
+    if (peek() == '*') {
+      ++mPos;
+      path(pathIndex).push_back({StepKind::AllItems});
+      return true;
+    }
+    const size_t begin = mPos;
+    while (isNameChar(peek()))
+      ++mPos;
+    if (mPos == begin)
+      return fail("expected a key"), false;
+    addKeyStep(pathIndex, std::string(mText.substr(begin, mPos - begin)));
+    return true;
+  }
+
+  bool parseBracket(u32 pathIndex) {
+    skipSpaces();
+    const char c = peek();
+    if (c == '*') {
+      ++mPos;
+      path(pathIndex).push_back({StepKind::AllItems});
+    } else if (c == '"' || c == '\'') {
+      std::string key;
+      if (!parseQuoted(&key))
+        return false;
+      addKeyStep(pathIndex, std::move(key));
+    } else if (c == '?') {
+      ++mPos;
+      const auto filter = parseOr();
+      if (!filter)
+        return false;
+      path(pathIndex).push_back({StepKind::Filter, *filter});
+    } else if (!parseIndexOrSlice(pathIndex)) {
+      return false;
+    }
+    if (!consume("]"))
+      return fail("expected ]"), false;
+    return true;
+  }
+
+  bool parseIndexOrSlice(u32 pathIndex) {
+    Step step{StepKind::Index};
+    step.hasStart = parseInteger(&step.start);
+    if (!consume(":")) {
+      if (!step.hasStart)
+        return fail("expected an index, a slice, a quoted key, * or a filter"), false;
+      path(pathIndex).push_back(step);
+      return true;
+    }
+    step.kind = StepKind::Slice;
+    step.hasStop = parseInteger(&step.stop);
+    if (consume(":") && parseInteger(&step.stride) && step.stride <= 0)
+      return fail("slice steps must be positive"), false;
+    path(pathIndex).push_back(step);
+    return true;
+  }
+
+  bool parseInteger(s64* value) {
+    skipSpaces();
+    const char* begin = mText.data() + mPos;
+    const char* end = mText.data() + mText.size();
+    const auto result = std::from_chars(begin, end, *value);
+    if (result.ec != std::errc{})
+      return false;
+    mPos += result.ptr - begin;
+    return true;
+  }
+
+  bool parseQuoted(std::string* out) {
+    const char quote = mText[mPos++];
+    while (true) {
+      const char c = peek();
+      if (mPos >= mText.size())
+        return fail("unterminated string"), false;
+      ++mPos;
+      if (c == quote)
+        return true;
+      if (c == '\\') {
+        if (mPos >= mText.size())
+          return fail("unterminated string"), false;
+        const char escaped = mText[mPos++];
+        switch (escaped) {
+        case 'n':
+          *out += '\n';
+          break;
+        case 't':
+          *out += '\t';
+          break;
+        case '\\':
+        case '"':
+        case '\'':
+          *out += escaped;
+          break;
+        default:
+          return fail("invalid escape sequence"), false;
+        }
+        continue;
+      }
+      *out += c;
+    }
+  }
+
+  u32 addFilter(FilterNode node) {
+    mPlan.filters.emplace_back(std::move(node));
+    return mPlan.filters.size() - 1;
+  }
+
+  std::optional<u32> parseOr() {
+    auto lhs = parseAnd();
+    while (lhs && consume("||")) {
+      const auto rhs = parseAnd();
+      if (!rhs)
+        return {};
+      FilterNode node;
+      node.op = FilterOp::Or;
+      node.lhs = *lhs;
+      node.rhs = *rhs;
+      lhs = addFilter(std::move(node));
+    }
+    return lhs;
+  }
+
+  std::optional<u32> parseAnd() {
+    auto lhs = parseUnary();
+    while (lhs && consume("&&")) {
+      const auto rhs = parseUnary();
+      if (!rhs)
+        return {};
+      FilterNode node;
+      node.op = FilterOp::And;
+      node.lhs = *lhs;
+      node.rhs = *rhs;
+      lhs = addFilter(std::move(node));
+    }
+    return lhs;
+  }
+
+  std::optional<u32> parseUnary() {
+    skipSpaces();
+    if (peek() == '!' && peek(1) != '=') {
+      ++mPos;
+      const auto operand = parseUnary();
+      if (!operand)
+        return {};
+      FilterNode node;
+      node.op = FilterOp::Not;
+      node.lhs = *operand;
+      return addFilter(std::move(node));
+    }
+    if (consume("(")) {
+      const auto inner = parseOr();
+      if (inner && !consume(")"))
+        return fail("expected )");
+      return inner;
+    }
+    return parseCondition();
+  }
+
+  std::optional<u32> parseCondition() {
+    skipSpaces();
+    const u32 pathIndex = mPlan.paths.size();
+    mPlan.paths.emplace_back();
+    bool bare = true;
+    if (peek() == '@') {
+      ++mPos;
+      bare = false;
+    } else if (!isNameChar(peek()) && peek() != '*') {
+      return fail("expected a path");
+    }
+    if (!parsePath(pathIndex, bare))
+      return {};
+
+    FilterNode node;
+    node.op = FilterOp::Exists;
+    node.path = pathIndex;
+    const auto compare = parseCompareOp();
+    if (!compare)
+      return addFilter(std::move(node));
+
+    node.op = FilterOp::Compare;
+    node.compare = *compare;
+    if (!parseLiteral(&node.literal))
+      return {};
+    const bool isOrdered = node.literal.type == LiteralType::String ||
+                           node.literal.type == LiteralType::Number;
+    if (!isOrdered && node.compare != CompareOp::Eq && node.compare != CompareOp::Ne)
+      return fail("booleans and null can only be compared with == and !=");
+    return addFilter(std::move(node));
+  }
+
+  std::optional<CompareOp> parseCompareOp() {
+    if (consume("=="))
+      return CompareOp::Eq;
+    if (consume("!="))
+      return CompareOp::Ne;
+    if (consume("<="))
+      return CompareOp::Le;
+    if (consume(">="))
+      return CompareOp::Ge;
+    if (consume("<"))
+      return CompareOp::Lt;
+    if (consume(">"))
+      return CompareOp::Gt;
+    return {};
+  }
+
+  bool parseLiteral(Literal* literal) {
+    skipSpaces();
+    const char c = peek();
+    if (c == '"' || c == '\'') {
+      literal->type = LiteralType::String;
+      if (!parseQuoted(&literal->string))
+        return false;
+      literal->index = addSlot(mPlan.strings, literal->string);
+      return true;
+    }
+
+    const size_t begin = mPos;
+    while (isNameChar(peek()) || peek() == '.')
+      ++mPos;
+    const std::string_view token = mText.substr(begin, mPos - begin);
+    if (token == "true" || token == "false") {
+      literal->type = LiteralType::Bool;
+      literal->boolean = token == "true";
+      return true;
+    }
+    if (token == "null") {
+      literal->type = LiteralType::Null;
+      return true;
+    }
+    if (!parseNumber(token, &literal->number)) {
+      mPos = begin;
+      return fail("expected a string, a number, true, false or null"), false;
+    }
+    literal->type = LiteralType::Number;
+    return true;
+  }
+
+  static bool parseNumber(std::string_view token, Number* number) {
+    const char* begin = token.data();
+    const char* end = token.data() + token.size();
+    if (token.empty() || !(token[0] == '-' || ('0' <= token[0] && token[0] <= '9')))
+      return false;
+    if (s64 value = 0; std::from_chars(begin, end, value).ptr == end) {
+      *number = Number::fromSigned(value);
+      return true;
+    }
+    if (u64 value = 0; std::from_chars(begin, end, value).ptr == end) {
+      *number = Number::fromUnsigned(value);
+      return true;
+    }
+    f64 value = 0;
+    const auto result = std::from_chars(begin, end, value);
+    if (result.ec != std::errc{} || result.ptr != end)
+      return false;
+    *number = Number::fromFloat(value);
+    return true;
+  }
+
+  std::string_view mText;
+  size_t mPos = 0;
+  bool mError = false;
+  Query::Plan mPlan;
+};
+
+/// Runs a plan on one document.
+class QueryRunner {
+public:
+  QueryRunner(const Query::Plan& plan, const Reader& reader) : mPlan{plan}, mReader{reader} {
+    mKeys.reserve(plan.keys.size());
+    for (const std::string& key : plan.keys)
+      mKeys.emplace_back(reader.findKey(key.c_str()));
+    mStrings.reserve(plan.strings.size());
+    for (const std::string& string : plan.strings)
+      mStrings.emplace_back(reader.findString(string.c_str()));
+  }
+
+  /// Returns false if a key of the main path is missing, in which case nothing can match.
+  bool mayMatch() const {
+    for (const Step& step : mPlan.paths[0]) {
+      if (step.kind == StepKind::Key && !mKeys[step.index])
+        return false;
+    }
+    return true;
+  }
+
+  /// Calls fn for each node that the path selects. Returns false if fn stopped the traversal.
+  template <typename Fn>
+  bool visit(const Path& path, size_t stepIdx, const ItemData& node, Fn& fn) {
+    if (stepIdx == path.size())
+      return fn(node);
+
+    const Step& step = path[stepIdx];
+    switch (step.kind) {
+    case StepKind::Key: {
+      const auto hash = node.getHash();
+      const std::optional<KeyId>& key = mKeys[step.index];
+      if (!hash || !key)
+        return true;
+      const auto value = hash->getByKey(*key);
+      return !value || visit(path, stepIdx + 1, *value, fn);
+    }
+    case StepKind::AllItems:
+      return forEachChild(node, [&](const ItemData& child) {
+        return visit(path, stepIdx + 1, child, fn);
+      });
+    case StepKind::Index: {
+      const auto array = node.getArray();
+      if (!array)
+        return true;
+      const s64 size = array->numItems();
+      const s64 idx = step.start < 0 ? step.start + size : step.start;
+      if (idx < 0 || idx >= size)
+        return true;
+      return visit(path, stepIdx + 1, (*array)[idx], fn);
+    }
+    case StepKind::Slice: {
+      const auto array = node.getArray();
+      if (!array)
+        return true;
+      const s64 size = array->numItems();
+      const auto clamp = [size](s64 idx) {
+        idx = idx < 0 ? idx + size : idx;
+        return idx < 0 ? 0 : (idx > size ? size : idx);
+      };
+      const s64 start = step.hasStart ? clamp(step.start) : 0;
+      const s64 stop = step.hasStop ? clamp(step.stop) : size;
+      for (s64 i = start; i < stop;) {
+        if (!visit(path, stepIdx + 1, (*array)[i], fn))
+          return false;
+        // Strides can be arbitrarily large: check before advancing so that `i` cannot overflow.
+        if (stop - i <= step.stride)
+          break;
+        i += step.stride;
+      }
+      return true;
+    }
+    case StepKind::Filter:
+      return forEachChild(node, [&](const ItemData& child) {
+        return !evaluate(step.index, child) || visit(path, stepIdx + 1, child, fn);
+      });
+    case StepKind::Descendants:
+      return forEachDescendant(node, [&](const ItemData& descendant) {
+        return visit(path, stepIdx + 1, descendant, fn);
+      });
+    }
+    return true;
+  }
+
+private:
+  template <typename Fn>
+  static bool forEachChild(const ItemData& node, Fn&& fn) {
+    if (const auto hash = node.getHash()) {
+      for (size_t i = 0; i < hash->numItems(); ++i) {
+        if (!fn(hash->getByIndex(i)->data))
+          return false;
+      }
+    } else if (const auto array = node.getArray()) {
+      for (size_t i = 0; i < array->numItems(); ++i) {
+        if (!fn((*array)[i]))
+          return false;
+      }
+    }
+    return true;
+  }
+
+  /// Calls fn for the node and all containers below it in document order (pre-order).
+  /// The traversal uses an explicit stack so that deep documents cannot overflow the call stack.
+  template <typename Fn>
+  bool forEachDescendant(const ItemData& node, Fn&& fn) {
+    struct Frame {
+      std::optional<Array> array;
+      std::optional<Hash> hash;
+      size_t next;
+    };
+    std::vector<Frame> stack;
+    // Documents that have not been validated may contain cycles.
+    const bool checkCycles = mReader.isCheckedAccessEnabled();
+    std::unordered_set<u32> inProgress;
+
+    const auto enter = [&](const ItemData& item) {
+      auto array = item.getArray();
+      auto hash = array ? std::nullopt : item.getHash();
+      if (!array && !hash)
+        return true;
+      if (checkCycles && !inProgress.insert(item.raw).second)
+        return true;
+      if (!fn(item))
+        return false;
+      stack.push_back({std::move(array), std::move(hash), 0});
+      return true;
+    };
+
+    if (!enter(node))
+      return false;
+    while (!stack.empty()) {
+      Frame& frame = stack.back();
+      const size_t numItems = frame.array ? frame.array->numItems() : frame.hash->numItems();
+      if (frame.next == numItems) {
+        if (checkCycles)
+          inProgress.erase(frame.array ? frame.array->getOffset() : frame.hash->getOffset());
+        stack.pop_back();
+        continue;
+      }
+      const size_t idx = frame.next++;
+      // enter() may reallocate the stack, so the frame must not be used after this point.
+      if (!enter(frame.array ? (*frame.array)[idx] : frame.hash->getByIndex(idx)->data))
+        return false;
+    }
+    return true;
+  }
+
+  bool evaluate(u32 filterIdx, const ItemData& item) {
+    const FilterNode& filter = mPlan.filters[filterIdx];
+    switch (filter.op) {
+    case FilterOp::And:
+      return evaluate(filter.lhs, item) && evaluate(filter.rhs, item);
+    case FilterOp::Or:
+      return evaluate(filter.lhs, item) || evaluate(filter.rhs, item);
+    case FilterOp::Not:
+      return !evaluate(filter.lhs, item);
+    case FilterOp::Exists:
+    case FilterOp::Compare: {
+      bool found = false;
+      auto check = [&](const ItemData& node) {
+        found = filter.op == FilterOp::Exists || compare(node, filter);
+        return !found;
+      };
+      visit(mPlan.paths[filter.path], 0, item, check);
+      return found;
+    }
+    }
+    return false;
+  }
+
+  bool compare(const ItemData& node, const FilterNode& filter) const {
+    if (filter.compare == CompareOp::Ne)
+      return !isEqual(node, filter.literal);
+    if (filter.compare == CompareOp::Eq)
+      return isEqual(node, filter.literal);
+
+    std::optional<int> order;
+    if (filter.literal.type == LiteralType::String && node.raw.type == NodeType::String) {
+      order = std::strcmp(node.getString(), filter.literal.string.c_str());
+    } else if (filter.literal.type == LiteralType::Number) {
+      if (const auto number = getNumber(node))
+        order = compareNumbers(*number, filter.literal.number);
+    }
+    if (!order)
+      return false;
+    switch (filter.compare) {
+    case CompareOp::Lt:
+      return *order < 0;
+    case CompareOp::Le:
+      return *order <= 0;
+    case CompareOp::Gt:
+      return *order > 0;
+    case CompareOp::Ge:
+      return *order >= 0;
+    default:
+      return false;
+    }
+  }
+
+  bool isEqual(const ItemData& node, const Literal& literal) const {
+    switch (literal.type) {
+    case LiteralType::String: {
+      // String tables are sorted and do not contain duplicates: equal strings have equal indices.
+      const std::optional<u32>& idx = mStrings[literal.index];
+      return node.raw.type == NodeType::String && idx && node.raw.raw == *idx;
+    }
+    case LiteralType::Number: {
+      const auto number = getNumber(node);
+      return number && compareNumbers(*number, literal.number) == 0;
+    }
+    case LiteralType::Bool:
+      return node.raw.type == NodeType::Bool && (node.raw.raw != 0) == literal.boolean;
+    case LiteralType::Null:
+      return node.raw.type == NodeType::Null;
+    }
+    return false;
+  }
+
+  const Query::Plan& mPlan;
+  const Reader& mReader;
+  std::vector<std::optional<KeyId>> mKeys;
+  std::vector<std::optional<u32>> mStrings;
+};
+
+}  // end of anonymous namespace
+
+Query::Query(std::shared_ptr<const Plan> plan) : mPlan{std::move(plan)} {}
+
+std::optional<Query> Query::compile(std::string_view expression) {
+  auto plan = QueryParser{expression}.parse();
+  if (!plan)
+    return {};
+  return Query{std::make_shared<const Plan>(std::move(*plan))};
+}
+
+size_t Query::forEach(const Reader& reader, const Callback& fn) const {
+  const auto root = reader.getRoot();
+  return root ? forEach(*root, fn) : 0;
+}
+
+size_t Query::forEach(const ItemData& root, const Callback& fn) const {
+  QueryRunner runner{*mPlan, root.reader};
+  if (!runner.mayMatch())
+    return 0;
+  size_t numMatches = 0;
+  auto onMatch = [&](const ItemData& item) {
+    ++numMatches;
+    return fn(item);
+  };
+  runner.visit(mPlan->paths[0], 0, root, onMatch);
+  return numMatches;
+}
+
+std::vector<ItemData> Query::findAll(const Reader& reader) const {
+  const auto root = reader.getRoot();
+  return root ? findAll(*root) : std::vector<ItemData>{};
+}
+
+std::vector<ItemData> Query::findAll(const ItemData& root) const {
+  std::vector<ItemData> matches;
+  forEach(root, [&](const ItemData& item) {
+    matches.push_back(item);
+    return true;
+  });
+  return matches;
+}
+
+std::optional<ItemData> Query::findFirst(const Reader& reader) const {
+  const auto root = reader.getRoot();
+  return root ? findFirst(*root) : std::nullopt;
+}
+
+std::optional<ItemData> Query::findFirst(const ItemData& root) const {
+  std::optional<ItemData> match;
+  forEach(root, [&](const ItemData& item) {
+    match.emplace(item);
+    return false;
+  });
+  return match;
+}
+
+size_t Query::count(const Reader& reader) const {
+  return forEach(reader, [](const ItemData&) { return true; });
+}
+
+size_t Query::count(const ItemData& root) const {
+  return forEach(root, [](const ItemData&) { return true; });
+}
+
+bool Query::mayMatch(const Reader& reader) const {
+  return QueryRunner{*mPlan, reader}.mayMatch();
+}
+
+const std::string& Query::getExpression() const {
+  return mPlan->expression;
+}
+
+}  // namespace byml
@@ -0,0 +1,121 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+
+#include "byml/scan.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <numeric>
+#include <system_error>
+
+#include "common/thread_pool.h"
+
+namespace byml {
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+double secondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+bool hasMatchingExtension(const fs::path& path, const std::vector<std::string>& extensions) {
+  if (extensions.empty())
+    return true;
+  std::string extension = path.extension().string();
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return std::find(extensions.begin(), extensions.end(), extension) != extensions.end();
+}
+
+ScanStatus scanFile(size_t index, const std::string& path, const ScanVisitor& visitor,
+                    const ScanOptions& options) {
+  auto reader = Reader::openFile(path);
+  if (!reader)
+    return ScanStatus::OpenFailed;
+  if (options.validate && !reader->isValid())
+    return ScanStatus::Invalid;
+  if (!options.validate)
+    reader->setCheckedAccess(true);
+  if (visitor && !visitor(index, *reader))
+    return ScanStatus::VisitFailed;
+  return ScanStatus::Ok;
+}
+}  // end of anonymous namespace
+
+size_t ScanReport::numFailed() const {
+  return std::count_if(files.begin(), files.end(),
+                       [](const ScanFileReport& file) { return file.status != ScanStatus::Ok; });
+}
+
+u64 ScanReport::totalSize() const {
+  return std::accumulate(files.begin(), files.end(), u64(0),
+                         [](u64 size, const ScanFileReport& file) { return size + file.size; });
+}
+
+std::vector<std::string> findFiles(const std::string& root, const ScanOptions& options) {
+  std::vector<std::string> paths;
+  std::error_code ec;
+  if (fs::is_regular_file(root, ec)) {
+    paths.push_back(root);
+    return paths;
+  }
+
+  fs::recursive_directory_iterator it{root, fs::directory_options::skip_permission_denied, ec};
+  for (; !ec && it != fs::recursive_directory_iterator{}; it.increment(ec)) {
+    std::error_code statusEc;
+    if (it->is_regular_file(statusEc) && hasMatchingExtension(it->path(), options.extensions))
+      paths.push_back(it->path().string());
+  }
+  std::sort(paths.begin(), paths.end());
+  return paths;
+}
+
+ScanReport scanFiles(std::vector<std::string> paths, const ScanVisitor& visitor,
+                     const ScanOptions& options) {
+  const auto start = Clock::now();
+  std::sort(paths.begin(), paths.end());
+  paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+  ScanReport report;
+  report.files.resize(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    std::error_code ec;
+    const auto size = fs::file_size(paths[i], ec);
+    report.files[i].path = std::move(paths[i]);
+    report.files[i].size = ec ? 0 : size;
+  }
+
+  // Start with the largest files so that a large file is not the last one to be processed.
+  std::vector<size_t> order(report.files.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return report.files[a].size > report.files[b].size;
+  });
+
+  if (!order.empty()) {
+    common::ThreadPool pool{options.numThreads};
+    for (const size_t index : order) {
+      pool.submit([&, index] {
+        ScanFileReport& file = report.files[index];
+        const auto fileStart = Clock::now();
+        file.status = scanFile(index, file.path, visitor, options);
+        file.seconds = secondsSince(fileStart);
+      });
+    }
+    pool.wait();
+  }
+
+  report.seconds = secondsSince(start);
+  return report;
+}
+
+ScanReport scanDirectory(const std::string& root, const ScanVisitor& visitor,
+                         const ScanOptions& options) {
+  return scanFiles(findFiles(root, options), visitor, options);
+}
+
+}  // namespace byml
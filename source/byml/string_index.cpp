@@ -0,0 +1,455 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+
+#include "byml/string_index.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+
+#include "byml/byml.h"
+#include "common/binary_reader.h"
+#include "common/binary_writer.h"
+#include "common/log.h"
+#include "common/mapped_file.h"
+
+namespace byml {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr std::array<char, 8> Magic = {'B', 'Y', 'M', 'L', 'S', 'I', 'D', 'X'};
+constexpr u32 Version = 1;
+
+// Header layout.
+constexpr size_t HeaderSize = 0x40;
+constexpr size_t VersionOffset = 0x08;
+constexpr size_t NumFilesOffset = 0x0c;
+constexpr size_t NumStringsOffset = 0x10;
+constexpr size_t FileTableOffsetOffset = 0x18;
+constexpr size_t StringTableOffsetOffset = 0x20;
+
+// File table entry layout.
+constexpr size_t FileEntrySize = 0x20;
+constexpr size_t FilePathOffset = 0x00;
+constexpr size_t FileSizeOffset = 0x08;
+constexpr size_t FileTimeOffset = 0x10;
+constexpr size_t FileFlagsOffset = 0x18;
+constexpr size_t FilePathLengthOffset = 0x1c;
+constexpr u32 FileFlagFailed = 1 << 0;
+
+// String table entry layout.
+constexpr size_t StringEntrySize = 0x18;
+constexpr size_t StringDataOffset = 0x00;
+constexpr size_t StringLengthOffset = 0x08;
+constexpr size_t StringNumPostingsOffset = 0x0c;
+constexpr size_t StringPostingsOffset = 0x10;
+
+// Postings.
+constexpr u32 UsageKey = 1 << 0;
+constexpr u32 UsageValue = 1 << 1;
+constexpr u32 UsageBits = 2;
+constexpr u32 MaxFiles = 1u << (32 - UsageBits);
+
+bool isInBounds(u64 offset, u64 size, u64 bufferSize) {
+  return offset <= bufferSize && size <= bufferSize - offset;
+}
+
+s64 getModificationTime(const std::string& path) {
+  std::error_code ec;
+  const auto time = fs::last_write_time(path, ec);
+  if (ec)
+    return 0;
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+struct IndexedFile {
+  std::string path;
+  u64 size = 0;
+  s64 modificationTime = 0;
+  bool failed = false;
+  /// (string ID, usage flags), one entry per distinct string.
+  std::vector<std::pair<u32, u8>> strings;
+};
+
+/// Strings of a document that was scanned: the hash key table and the string table merged into
+/// a single sorted list. `data` contains the null-terminated strings.
+struct ScannedStrings {
+  std::string data;
+  std::vector<u8> usages;
+};
+
+/// Returns nullopt if an entry of the string tables is invalid (only possible if checked access
+/// is enabled), so that files are never indexed with a partial set of strings.
+std::optional<ScannedStrings> collectStrings(const Reader& reader) {
+  ScannedStrings result;
+  const size_t numKeys = reader.getNumKeys();
+  const size_t numStrings = reader.getNumStrings();
+  size_t i = 0;
+  size_t j = 0;
+  // Both tables are sorted, so they can be merged in a single pass.
+  while (i < numKeys || j < numStrings) {
+    const char* key = i < numKeys ? reader.getKey(i) : nullptr;
+    const char* string = j < numStrings ? reader.getString(j) : nullptr;
+    if ((i < numKeys && !key) || (j < numStrings && !string))
+      return {};
+    const int cmp = !key ? 1 : (!string ? -1 : std::strcmp(key, string));
+    u8 usage = 0;
+    if (cmp <= 0)
+      usage |= UsageKey, ++i;
+    if (cmp >= 0)
+      usage |= UsageValue, ++j;
+    result.data += cmp <= 0 ? key : string;
+    result.data += '\0';
+    result.usages.push_back(usage);
+  }
+  return result;
+}
+
+class StringIndexBuilder {
+public:
+  /// Add a string and return its ID.
+  u32 intern(std::string_view string) {
+    const auto [it, inserted] = mIds.emplace(string, u32(mStrings.size()));
+    if (inserted)
+      mStrings.push_back(string);
+    return it->second;
+  }
+
+  /// Serialize the index. `files` must be sorted by path.
+  std::vector<u8> build(const std::vector<IndexedFile>& files) const {
+    // Sort strings and compute the rank of each string ID.
+    std::vector<u32> order(mStrings.size());
+    for (u32 i = 0; i < order.size(); ++i)
+      order[i] = i;
+    std::sort(order.begin(), order.end(),
+              [&](u32 a, u32 b) { return mStrings[a] < mStrings[b]; });
+    std::vector<u32> rank(mStrings.size());
+    for (u32 i = 0; i < order.size(); ++i)
+      rank[order[i]] = i;
+
+    // Postings are grouped by string. Files are visited in order, so each group ends up
+    // sorted by file index.
+    std::vector<u32> postingsStart(mStrings.size() + 1);
+    for (const IndexedFile& file : files) {
+      for (const auto& [id, usage] : file.strings)
+        ++postingsStart[rank[id] + 1];
+    }
+    for (size_t i = 1; i < postingsStart.size(); ++i)
+      postingsStart[i] += postingsStart[i - 1];
+    std::vector<u32> postings(postingsStart.back());
+    std::vector<u32> next(postingsStart.begin(), postingsStart.end() - 1);
+    for (u32 fileIdx = 0; fileIdx < files.size(); ++fileIdx) {
+      for (const auto& [id, usage] : files[fileIdx].strings)
+        postings[next[rank[id]]++] = fileIdx << UsageBits | usage;
+    }
+
+    const u64 fileTableOffset = HeaderSize;
+    const u64 stringTableOffset = fileTableOffset + FileEntrySize * files.size();
+    const u64 postingsOffset = stringTableOffset + StringEntrySize * mStrings.size();
+    const u64 stringDataOffset = postingsOffset + 4 * postings.size();
+    u64 size = stringDataOffset;
+    for (const IndexedFile& file : files)
+      size += file.path.size() + 1;
+    for (const std::string_view string : mStrings)
+      size += string.size() + 1;
+
+    std::vector<u8> data(size);
+    const common::BinaryWriter bw{data.data(), false};
+    std::memcpy(data.data(), Magic.data(), Magic.size());
+    bw.write<u32>(VersionOffset, Version);
+    bw.write<u32>(NumFilesOffset, files.size());
+    bw.write<u32>(NumStringsOffset, mStrings.size());
+    bw.write<u64>(FileTableOffsetOffset, fileTableOffset);
+    bw.write<u64>(StringTableOffsetOffset, stringTableOffset);
+
+    u64 dataOffset = stringDataOffset;
+    const auto writeString = [&](std::string_view string) {
+      const u64 offset = dataOffset;
+      std::memcpy(&data[offset], string.data(), string.size());
+      dataOffset += string.size() + 1;
+      return offset;
+    };
+
+    for (size_t i = 0; i < files.size(); ++i) {
+      const IndexedFile& file = files[i];
+      const u64 entry = fileTableOffset + FileEntrySize * i;
+      bw.write<u64>(entry + FilePathOffset, writeString(file.path));
+      bw.write<u64>(entry + FileSizeOffset, file.size);
+      bw.write<s64>(entry + FileTimeOffset, file.modificationTime);
+      bw.write<u32>(entry + FileFlagsOffset, file.failed ? FileFlagFailed : 0);
+      bw.write<u32>(entry + FilePathLengthOffset, file.path.size());
+    }
+
+    for (size_t i = 0; i < order.size(); ++i) {
+      const std::string_view string = mStrings[order[i]];
+      const u64 entry = stringTableOffset + StringEntrySize * i;
+      bw.write<u64>(entry + StringDataOffset, writeString(string));
+      bw.write<u32>(entry + StringLengthOffset, string.size());
+      bw.write<u32>(entry + StringNumPostingsOffset, postingsStart[i + 1] - postingsStart[i]);
+      bw.write<u64>(entry + StringPostingsOffset, postingsOffset + 4 * postingsStart[i]);
+    }
+
+    for (size_t i = 0; i < postings.size(); ++i)
+      bw.write<u32>(postingsOffset + 4 * i, postings[i]);
+
+    return data;
+  }
+
+private:
+  std::unordered_map<std::string_view, u32> mIds;
+  std::vector<std::string_view> mStrings;
+};
+
+bool writeFile(const std::string& path, const std::vector<u8>& data) {
+  std::ofstream stream{path, std::ios::binary | std::ios::trunc};
+  stream.write(reinterpret_cast<const char*>(data.data()), data.size());
+  stream.close();
+  return bool(stream);
+}
+
+}  // end of anonymous namespace
+
+std::optional<StringIndex> StringIndex::open(const std::string& path) {
+  auto file = common::MappedFile::open(path);
+  if (!file || file->size() < HeaderSize)
+    return {};
+
+  const u8* data = file->data();
+  const common::LittleEndianReader br{data};
+  if (std::memcmp(data, Magic.data(), Magic.size()) != 0 || br.read<u32>(VersionOffset) != Version)
+    return {};
+
+  StringIndex index;
+  index.mData = data;
+  index.mSize = file->size();
+  index.mNumFiles = br.read<u32>(NumFilesOffset);
+  index.mNumStrings = br.read<u32>(NumStringsOffset);
+  index.mFileTableOffset = br.read<u64>(FileTableOffsetOffset);
+  index.mStringTableOffset = br.read<u64>(StringTableOffsetOffset);
+  // Entries are bounds checked when they are accessed, so that opening an index is cheap.
+  if (!isInBounds(index.mFileTableOffset, u64(FileEntrySize) * index.mNumFiles, index.mSize) ||
+      !isInBounds(index.mStringTableOffset, u64(StringEntrySize) * index.mNumStrings,
+                  index.mSize)) {
+    return {};
+  }
+  index.mStorage = std::move(file);
+  return index;
+}
+
+StringIndex::FileInfo StringIndex::getFile(u32 index) const {
+  const common::LittleEndianReader br{mData};
+  const u64 entry = mFileTableOffset + FileEntrySize * u64(index);
+  if (index >= mNumFiles)
+    return {{}, 0, 0, true};
+  const u64 pathOffset = br.read<u64>(entry + FilePathOffset);
+  const u32 pathLength = br.read<u32>(entry + FilePathLengthOffset);
+  std::string_view path;
+  if (isInBounds(pathOffset, pathLength, mSize))
+    path = {reinterpret_cast<const char*>(mData + pathOffset), pathLength};
+  return {path, br.read<u64>(entry + FileSizeOffset), br.read<s64>(entry + FileTimeOffset),
+          (br.read<u32>(entry + FileFlagsOffset) & FileFlagFailed) != 0};
+}
+
+std::string_view StringIndex::getString(u32 index) const {
+  const common::LittleEndianReader br{mData};
+  if (index >= mNumStrings)
+    return {};
+  const u64 entry = mStringTableOffset + StringEntrySize * u64(index);
+  const u64 offset = br.read<u64>(entry + StringDataOffset);
+  const u32 length = br.read<u32>(entry + StringLengthOffset);
+  if (!isInBounds(offset, length, mSize))
+    return {};
+  return {reinterpret_cast<const char*>(mData + offset), length};
+}
+
+u32 StringIndex::lowerBound(std::string_view string) const {
+  u32 a = 0;
+  u32 b = mNumStrings;
+  while (a < b) {
+    const u32 m = a + (b - a) / 2;
+    if (getString(m) < string)
+      a = m + 1;
+    else
+      b = m;
+  }
+  return a;
+}
+
+std::vector<StringIndex::Hit> StringIndex::find(std::string_view string) const {
+  const u32 index = lowerBound(string);
+  if (index >= mNumStrings || getString(index) != string)
+    return {};
+  return getHits(index);
+}
+
+std::vector<StringIndex::Hit> StringIndex::getHits(u32 index) const {
+  std::vector<Hit> hits;
+  if (index >= mNumStrings)
+    return hits;
+
+  const common::LittleEndianReader br{mData};
+  const u64 entry = mStringTableOffset + StringEntrySize * u64(index);
+  const u32 numPostings = br.read<u32>(entry + StringNumPostingsOffset);
+  const u64 postingsOffset = br.read<u64>(entry + StringPostingsOffset);
+  if (!isInBounds(postingsOffset, 4 * u64(numPostings), mSize))
+    return hits;
+
+  hits.reserve(numPostings);
+  for (u32 i = 0; i < numPostings; ++i) {
+    const u32 posting = br.read<u32>(postingsOffset + 4 * i);
+    hits.push_back({posting >> UsageBits, (posting & UsageKey) != 0, (posting & UsageValue) != 0});
+  }
+  return hits;
+}
+
+std::vector<std::string_view> StringIndex::findPrefix(std::string_view prefix,
+                                                      size_t limit) const {
+  std::vector<std::string_view> strings;
+  for (u32 i = lowerBound(prefix); i < mNumStrings && strings.size() < limit; ++i) {
+    const std::string_view string = getString(i);
+    if (string.substr(0, prefix.size()) != prefix)
+      break;
+    strings.push_back(string);
+  }
+  return strings;
+}
+
+bool updateStringIndex(const std::string& indexPath, const std::vector<std::string>& roots,
+                       const ScanOptions& options, StringIndexUpdateStats* stats) {
+  StringIndexUpdateStats localStats;
+  if (!stats)
+    stats = &localStats;
+  *stats = {};
+
+  std::vector<std::string> paths;
+  for (const std::string& root : roots) {
+    auto rootPaths = findFiles(root, options);
+    paths.insert(paths.end(), std::make_move_iterator(rootPaths.begin()),
+                 std::make_move_iterator(rootPaths.end()));
+  }
+  std::sort(paths.begin(), paths.end());
+  paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+  if (paths.size() >= MaxFiles) {
+    ERR_LOG("Too many files to index: {}", paths.size());
+    return false;
+  }
+
+  std::vector<IndexedFile> files(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    std::error_code ec;
+    files[i].path = paths[i];
+    files[i].size = fs::file_size(paths[i], ec);
+    if (ec)
+      files[i].size = 0;
+    files[i].modificationTime = getModificationTime(paths[i]);
+  }
+
+  // The previous index must stay mapped until the new one has been built,
+  // since the strings of unchanged files are interned from it.
+  const std::optional<StringIndex> previous = StringIndex::open(indexPath);
+  StringIndexBuilder builder;
+  std::vector<size_t> toScan;
+  // Index of the file in the new file table, for each file of the previous index that is reused.
+  std::vector<std::optional<u32>> reusedFiles(previous ? previous->numFiles() : 0);
+  {
+    std::unordered_map<std::string_view, u32> previousFiles;
+    for (u32 i = 0; i < reusedFiles.size(); ++i)
+      previousFiles.emplace(previous->getFile(i).path, i);
+
+    size_t numKept = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+      const auto it = previousFiles.find(files[i].path);
+      numKept += it != previousFiles.end();
+      const auto info = it != previousFiles.end() ? previous->getFile(it->second) :
+                                                    std::optional<StringIndex::FileInfo>{};
+      if (info && info->size == files[i].size &&
+          info->modificationTime == files[i].modificationTime) {
+        files[i].failed = info->failed;
+        reusedFiles[it->second] = i;
+        ++stats->numReused;
+      } else {
+        toScan.push_back(i);
+      }
+    }
+    stats->numRemoved = reusedFiles.size() - numKept;
+  }
+
+  if (previous && stats->numReused != 0) {
+    for (u32 i = 0; i < previous->numStrings(); ++i) {
+      std::optional<u32> id;
+      for (const StringIndex::Hit& hit : previous->getHits(i)) {
+        if (hit.file >= reusedFiles.size() || !reusedFiles[hit.file])
+          continue;
+        if (!id)
+          id = builder.intern(previous->getString(i));
+        const u8 usage = (hit.isKey ? UsageKey : 0) | (hit.isValue ? UsageValue : 0);
+        files[*reusedFiles[hit.file]].strings.emplace_back(*id, usage);
+      }
+    }
+  }
+
+  std::vector<std::string> scanPaths(toScan.size());
+  for (size_t i = 0; i < toScan.size(); ++i)
+    scanPaths[i] = files[toScan[i]].path;
+  // Each worker only writes to the entry of the file it is processing.
+  std::vector<ScannedStrings> scanned(toScan.size());
+  stats->report = scanFiles(
+      std::move(scanPaths),
+      [&](size_t index, const Reader& reader) {
+        std::optional<ScannedStrings> strings = collectStrings(reader);
+        if (!strings)
+          return false;
+        scanned[index] = std::move(*strings);
+        return true;
+      },
+      options);
+  stats->numScanned = toScan.size();
+
+  for (size_t i = 0; i < toScan.size(); ++i) {
+    IndexedFile& file = files[toScan[i]];
+    file.failed = stats->report.files[i].status != ScanStatus::Ok;
+    const ScannedStrings& strings = scanned[i];
+    const char* string = strings.data.data();
+    for (const u8 usage : strings.usages) {
+      const std::string_view view{string};
+      file.strings.emplace_back(builder.intern(view), usage);
+      string += view.size() + 1;
+    }
+    // Malformed (unsorted) string tables can contain duplicates.
+    std::sort(file.strings.begin(), file.strings.end());
+    size_t numUnique = 0;
+    for (size_t j = 0; j < file.strings.size(); ++j) {
+      if (numUnique != 0 && file.strings[numUnique - 1].first == file.strings[j].first)
+        file.strings[numUnique - 1].second |= file.strings[j].second;
+      else
+        file.strings[numUnique++] = file.strings[j];
+    }
+    file.strings.resize(numUnique);
+  }
+
+  const std::vector<u8> data = builder.build(files);
+  const std::string tempPath = indexPath + ".tmp";
+  if (!writeFile(tempPath, data)) {
+    ERR_LOG("Failed to write {}", tempPath);
+    return false;
+  }
+  std::error_code ec;
+  fs::rename(tempPath, indexPath, ec);
+  if (ec) {
+    ERR_LOG("Failed to replace {}: {}", indexPath, ec.message());
+    fs::remove(tempPath, ec);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace byml
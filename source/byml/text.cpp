@@ -0,0 +1,545 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+
+#include "byml/text.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "byml/binary_format.h"
+#include "byml/byml.h"
+#include "byml/container_util.h"
+#include "common/binary_reader.h"
+#include "common/simd.h"
+
+namespace byml {
+
+namespace {
+
+/// Buffered text output. Text is written to a fixed-size buffer that is flushed to a string
+/// or a file descriptor when it is full.
+class OutputBuffer {
+public:
+  static constexpr size_t Capacity = 64 * 1024;
+  /// Maximum size that can be requested with reserve().
+  static constexpr size_t MaxReserve = 256;
+
+  explicit OutputBuffer(std::string* string) : mString{string} {}
+  explicit OutputBuffer(int fd) : mFd{fd} {}
+
+  /// Returns a pointer to at least `size` (<= MaxReserve) bytes of writable space.
+  char* reserve(size_t size) {
+    if (Capacity - mSize < size)
+      flush();
+    return &mData[mSize];
+  }
+  void commit(char* end) { mSize = end - mData.get(); }
+
+  void put(char c) { *reserve(1) = c, ++mSize; }
+
+  void write(const char* data, size_t size) {
+    while (size != 0) {
+      if (mSize == Capacity)
+        flush();
+      const size_t chunk = std::min(size, Capacity - mSize);
+      std::memcpy(&mData[mSize], data, chunk);
+      mSize += chunk;
+      data += chunk;
+      size -= chunk;
+    }
+  }
+  void write(std::string_view string) { write(string.data(), string.size()); }
+
+  bool flush() {
+    if (mString) {
+      mString->append(mData.get(), mSize);
+    } else {
+      const char* data = mData.get();
+      size_t remaining = mSize;
+      while (remaining != 0 && !mError) {
+#ifdef _WIN32
+        const auto written = ::_write(mFd, data, static_cast<unsigned>(remaining));
+#else
+        const auto written = ::write(mFd, data, remaining);
+#endif
+        if (written <= 0)
+          mError = true;
+        else
+          data += written, remaining -= written;
+      }
+    }
+    mSize = 0;
+    return !mError;
+  }
+
+private:
+  std::unique_ptr<char[]> mData{new char[Capacity]};
+  size_t mSize = 0;
+  std::string* mString = nullptr;
+  int mFd = -1;
+  bool mError = false;
+};
+
+/// Returns the index of the first character that may need escaping or that is significant in YAML
+/// (control characters, DEL, '"', '\\', ':' and '#'), or `size` if there is none.
+size_t findSpecialChar(const char* string, size_t size) {
+  size_t i = 0;
+#ifdef BYML_USE_SSE2
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i colon = _mm_set1_epi8(':');
+  const __m128i hash = _mm_set1_epi8('#');
+  const __m128i del = _mm_set1_epi8(0x7f);
+  const __m128i maxControl = _mm_set1_epi8(0x1f);
+  for (; i + 16 <= size; i += 16) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(string + i));
+    // Unsigned v <= 0x1f is equivalent to max(v, 0x1f) == 0x1f.
+    __m128i special = _mm_cmpeq_epi8(_mm_max_epu8(v, maxControl), maxControl);
+    special = _mm_or_si128(special, _mm_cmpeq_epi8(v, quote));
+    special = _mm_or_si128(special, _mm_cmpeq_epi8(v, backslash));
+    special = _mm_or_si128(special, _mm_cmpeq_epi8(v, colon));
+    special = _mm_or_si128(special, _mm_cmpeq_epi8(v, hash));
+    special = _mm_or_si128(special, _mm_cmpeq_epi8(v, del));
+    const int mask = _mm_movemask_epi8(special);
+    if (mask != 0)
+      return i + common::countTrailingZeros(mask);
+  }
+#endif
+  for (; i < size; ++i) {
+    const auto c = static_cast<unsigned char>(string[i]);
+    if (c <= 0x1f || c == '"' || c == '\\' || c == ':' || c == '#' || c == 0x7f)
+      return i;
+  }
+  return size;
+}
+
+/// Returns whether a string would be read back as something else than a string
+/// (by YAML parsers or by fromText, which also accepts the JSON names of non-finite floats).
+bool isYamlKeyword(std::string_view string) {
+  if (string.size() > 8)
+    return false;
+  char lower[8];
+  for (size_t i = 0; i < string.size(); ++i) {
+    const char c = string[i];
+    lower[i] = 'A' <= c && c <= 'Z' ? c - 'A' + 'a' : c;
+  }
+  const std::string_view s{lower, string.size()};
+  return s == "null" || s == "true" || s == "false" || s == "yes" || s == "no" || s == "on" ||
+         s == "off" || s == "y" || s == "n" || s == "<<" || s == "nan" || s == "infinity";
+}
+
+/// Returns whether a string can be written as a plain (unquoted) YAML scalar
+/// without changing its meaning. This errs on the side of quoting.
+bool canBePlainYamlScalar(std::string_view string, size_t firstSpecial) {
+  if (string.empty() || string.back() == ' ')
+    return false;
+  const char first = string.front();
+  if (std::strchr("-?:,[]{}#&*!|>'\"%@`~+. \t", first) || ('0' <= first && first <= '9'))
+    return false;
+  if (isYamlKeyword(string))
+    return false;
+
+  size_t i = firstSpecial;
+  while (i != string.size()) {
+    const char c = string[i];
+    if (c == ':') {
+      if (i + 1 == string.size() || string[i + 1] == ' ')
+        return false;
+    } else if (c == '#') {
+      if (string[i - 1] == ' ')
+        return false;
+    } else {
+      // Control characters, quotes and backslashes: use a double-quoted scalar
+      // so that they can be escaped.
+      return false;
+    }
+    ++i;
+    i += findSpecialChar(string.data() + i, string.size() - i);
+  }
+  return true;
+}
+
+void writeQuotedString(OutputBuffer& out, std::string_view string, size_t firstSpecial) {
+  static constexpr char HexDigits[] = "0123456789abcdef";
+  out.put('"');
+  size_t i = 0;
+  size_t special = firstSpecial;
+  while (true) {
+    out.write(string.data() + i, special - i);
+    if (special == string.size())
+      break;
+
+    const auto c = static_cast<unsigned char>(string[special]);
+    char* p = out.reserve(6);
+    switch (c) {
+    case '"':
+    case '\\':
+      *p++ = '\\';
+      *p++ = c;
+      break;
+    case '\n':
+      *p++ = '\\';
+      *p++ = 'n';
+      break;
+    case '\t':
+      *p++ = '\\';
+      *p++ = 't';
+      break;
+    case '\r':
+      *p++ = '\\';
+      *p++ = 'r';
+      break;
+    case ':':
+    case '#':
+      *p++ = c;
+      break;
+    default:
+      std::memcpy(p, "\\u00", 4);
+      p[4] = HexDigits[c >> 4];
+      p[5] = HexDigits[c & 0xf];
+      p += 6;
+      break;
+    }
+    out.commit(p);
+
+    i = special + 1;
+    special = i + findSpecialChar(string.data() + i, string.size() - i);
+  }
+  out.put('"');
+}
+
+/// Format a floating-point number so that it is always read back as a float
+/// (i.e. with a decimal point) and round trips.
+template <typename T>
+char* formatFloat(char* out, T value, bool yaml) {
+  const auto copy = [out](std::string_view string) {
+    std::memcpy(out, string.data(), string.size());
+    return out + string.size();
+  };
+  if (std::isnan(value))
+    return copy(yaml ? ".nan" : "NaN");
+  if (std::isinf(value)) {
+    if (yaml)
+      return copy(value < 0 ? "-.inf" : ".inf");
+    return copy(value < 0 ? "-Infinity" : "Infinity");
+  }
+
+  char* end = std::to_chars(out, out + 64, value).ptr;
+  if (std::find(out, end, '.') != end)
+    return end;
+  char* exponent = std::find(out, end, 'e');
+  std::memmove(exponent + 2, exponent, end - exponent);
+  exponent[0] = '.';
+  exponent[1] = '0';
+  return end + 2;
+}
+
+/// Returns whether a node is written as a sequence or a mapping. Monotyped arrays are written
+/// like regular arrays; other nodes that were added in version 7 cannot be written.
+constexpr bool isTextContainerType(NodeType type) {
+  return isContainerType(type) || type == NodeType::MonoTypedArray;
+}
+
+template <typename BR>
+class TextEmitter {
+public:
+  TextEmitter(const Reader& reader, BR br, TextFormat format, OutputBuffer& out)
+      : mReader{reader}, mBr{br}, mYaml{format == TextFormat::Yaml}, mOut{out} {}
+
+  bool emit() {
+    if (mReader.isHash32())
+      return false;
+    if (!mReader.isArray() && !mReader.isHash()) {
+      mOut.write("null\n");
+      return true;
+    }
+    const auto array = mReader.getArray();
+    const auto hash = mReader.getHash();
+    if (!array && !hash)
+      return false;
+    const RawItemData root = array ? RawItemData{array->getOffset(), array->getNodeType()} :
+                                     RawItemData{hash->getOffset(), NodeType::Hash};
+    writeContainer(root, 0, false);
+
+    while (mOk && !mStack.empty()) {
+      Frame& frame = mStack.back();
+      if (frame.nextItem == frame.numItems) {
+        const u32 depth = frame.depth;
+        const NodeType type = frame.type;
+        if (mCheckCycles)
+          mInProgress.erase(frame.offset);
+        mStack.pop_back();
+        if (!mYaml) {
+          writeNewline(depth);
+          mOut.put(type == NodeType::Hash ? '}' : ']');
+        }
+        continue;
+      }
+
+      // `frame` must not be used after an item is emitted since it may push to the stack.
+      const u32 idx = frame.nextItem++;
+      const bool isFirstInline = idx == 0 && frame.inlineFirst;
+      if (frame.type == NodeType::Hash)
+        emitHashItem(frame.offset, idx, frame.depth, isFirstInline);
+      else
+        emitArrayItem(frame.offset, frame.type, frame.numItems, idx, frame.depth, isFirstInline);
+    }
+
+    // YAML items end with a newline, except for empty root containers.
+    if (mOk && (!mYaml || mIsRootEmpty))
+      mOut.put('\n');
+    return mOk;
+  }
+
+private:
+  struct Frame {
+    u32 offset;
+    NodeType type;
+    u32 numItems;
+    u32 nextItem;
+    u32 depth;
+    /// (YAML) Whether the first item continues the line of the parent item ("- ").
+    bool inlineFirst;
+  };
+
+  /// Returns the number of items in a container, or nullopt if it is invalid.
+  std::optional<u32> getContainerSize(RawItemData item) {
+    // This performs checks if checked access is enabled.
+    const ItemData data{mReader, item};
+    if (item.type == NodeType::Hash ? !data.getHash() : !data.getArray()) {
+      mOk = false;
+      return {};
+    }
+    return util::readContainerSize(mBr, item.raw);
+  }
+
+  /// Write a container. Empty containers are written inline; other containers are pushed
+  /// to the stack and their items are written by the main loop.
+  /// Returns false if the container is empty or invalid.
+  bool writeContainer(RawItemData item, u32 depth, bool inlineFirst) {
+    const auto numItems = getContainerSize(item);
+    if (!numItems)
+      return false;
+    if (*numItems == 0) {
+      mOut.write(item.type == NodeType::Hash ? "{}" : "[]");
+      mIsRootEmpty = mStack.empty();
+      return false;
+    }
+    if (!mYaml)
+      mOut.put(item.type == NodeType::Hash ? '{' : '[');
+    pushContainer(item, *numItems, depth, inlineFirst);
+    return true;
+  }
+
+  void pushContainer(RawItemData item, u32 numItems, u32 depth, bool inlineFirst) {
+    // Documents that have not been validated may contain cycles.
+    if (mCheckCycles && !mInProgress.insert(item.raw).second) {
+      mOk = false;
+      return;
+    }
+    mStack.push_back({item.raw, item.type, numItems, 0, depth, inlineFirst});
+  }
+
+  void writeNewline(u32 depth) {
+    mOut.put('\n');
+    writeIndent(depth);
+  }
+
+  void writeIndent(u32 depth) {
+    u32 numSpaces = 2 * depth;
+    while (numSpaces != 0) {
+      const u32 chunk = std::min<u32>(numSpaces, OutputBuffer::MaxReserve);
+      char* p = mOut.reserve(chunk);
+      std::memset(p, ' ', chunk);
+      mOut.commit(p + chunk);
+      numSpaces -= chunk;
+    }
+  }
+
+  void emitHashItem(u32 offset, u32 idx, u32 depth, bool isFirstInline) {
+    const auto item = util::readHashItem(mBr, offset, idx);
+    const char* key =
+        mBr.getString(util::getStringOffset(mBr, mReader.getHashKeyTableOffset(), item.keyIndex));
+
+    if (!mYaml) {
+      if (idx != 0)
+        mOut.put(',');
+      writeNewline(depth + 1);
+      writeString(key);
+      mOut.write(": ", 2);
+      writeItem(item.data, depth + 1);
+      return;
+    }
+
+    if (!isFirstInline)
+      writeIndent(depth);
+    writeString(key);
+    if (!isTextContainerType(item.data.type)) {
+      mOut.write(": ", 2);
+      writeValue(item.data);
+      mOut.put('\n');
+      return;
+    }
+    const auto numItems = getContainerSize(item.data);
+    if (!numItems)
+      return;
+    if (*numItems == 0) {
+      mOut.write(item.data.type == NodeType::Hash ? ": {}\n" : ": []\n");
+      return;
+    }
+    mOut.write(":\n", 2);
+    pushContainer(item.data, *numItems, depth + 1, false);
+  }
+
+  void emitArrayItem(u32 offset, NodeType type, u32 numItems, u32 idx, u32 depth,
+                     bool isFirstInline) {
+    const auto item = util::readContainerItem(mBr, offset, type, numItems, idx);
+    if (!mYaml) {
+      if (idx != 0)
+        mOut.put(',');
+      writeNewline(depth + 1);
+      writeItem(item, depth + 1);
+      return;
+    }
+
+    if (!isFirstInline)
+      writeIndent(depth);
+    mOut.write("- ", 2);
+    if (isTextContainerType(item.type)) {
+      // Items of a non-empty container start on the same line.
+      if (!writeContainer(item, depth + 1, true))
+        mOut.put('\n');
+    } else {
+      writeValue(item);
+      mOut.put('\n');
+    }
+  }
+
+  /// (JSON) Write an item value.
+  void writeItem(RawItemData item, u32 depth) {
+    if (isTextContainerType(item.type))
+      writeContainer(item, depth, false);
+    else
+      writeValue(item);
+  }
+
+  void writeString(const char* string) {
+    const std::string_view view{string};
+    const size_t firstSpecial = findSpecialChar(view.data(), view.size());
+    if (mYaml ? canBePlainYamlScalar(view, firstSpecial) : false)
+      mOut.write(view);
+    else
+      writeQuotedString(mOut, view, firstSpecial);
+  }
+
+  void writeValue(RawItemData item) {
+    char* p = mOut.reserve(64);
+    switch (item.type) {
+    case NodeType::String:
+      writeString(mBr.getString(
+          util::getStringOffset(mBr, mReader.getStringTableOffset(), item.raw)));
+      return;
+    case NodeType::Bool:
+      p = copy(p, item.raw ? "true" : "false");
+      break;
+    case NodeType::Int:
+      p = std::to_chars(p, p + 64, static_cast<s32>(item.raw)).ptr;
+      break;
+    case NodeType::UInt:
+      if (mYaml) {
+        static constexpr char HexDigits[] = "0123456789abcdef";
+        p = copy(p, "!u 0x");
+        for (int shift = 28; shift >= 0; shift -= 4)
+          *p++ = HexDigits[(item.raw >> shift) & 0xf];
+      } else {
+        p = std::to_chars(p, p + 64, item.raw).ptr;
+      }
+      break;
+    case NodeType::Float: {
+      f32 value;
+      std::memcpy(&value, &item.raw, sizeof(value));
+      p = formatFloat(p, value, mYaml);
+      break;
+    }
+    case NodeType::Int64:
+      if (mYaml)
+        p = copy(p, "!l ");
+      p = std::to_chars(p, p + 64, mBr.template read<s64>(item.raw)).ptr;
+      break;
+    case NodeType::UInt64:
+      if (mYaml)
+        p = copy(p, "!ul ");
+      p = std::to_chars(p, p + 64, mBr.template read<u64>(item.raw)).ptr;
+      break;
+    case NodeType::Double: {
+      if (mYaml)
+        p = copy(p, "!f64 ");
+      const u64 raw = mBr.template read<u64>(item.raw);
+      f64 value;
+      std::memcpy(&value, &raw, sizeof(value));
+      p = formatFloat(p, value, mYaml);
+      break;
+    }
+    case NodeType::Null:
+      p = copy(p, "null");
+      break;
+    default:
+      mOk = false;
+      return;
+    }
+    mOut.commit(p);
+  }
+
+  static char* copy(char* p, std::string_view string) {
+    std::memcpy(p, string.data(), string.size());
+    return p + string.size();
+  }
+
+  const Reader& mReader;
+  BR mBr;
+  bool mYaml;
+  OutputBuffer& mOut;
+  std::vector<Frame> mStack;
+  bool mCheckCycles = mReader.isCheckedAccessEnabled();
+  /// Containers that are on the stack (only tracked if mCheckCycles is true).
+  std::unordered_set<u32> mInProgress;
+  bool mOk = true;
+  bool mIsRootEmpty = false;
+};
+
+bool emitText(const Reader& reader, TextFormat format, OutputBuffer& out) {
+  const bool ok =
+      common::withStaticReader(reader.getBuffer(), reader.isBigEndian(), [&](auto br) {
+        return TextEmitter<decltype(br)>{reader, br, format, out}.emit();
+      });
+  return out.flush() && ok;
+}
+
+}  // end of anonymous namespace
+
+std::optional<std::string> toText(const Reader& reader, TextFormat format) {
+  std::string text;
+  OutputBuffer out{&text};
+  if (!emitText(reader, format, out))
+    return {};
+  return text;
+}
+
+bool writeText(const Reader& reader, TextFormat format, int fd) {
+  OutputBuffer out{fd};
+  return emitText(reader, format, out);
+}
+
+}  // namespace byml
@@ -0,0 +1,827 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "byml/binary_format.h"
+#include "byml/text.h"
+#include "byml/writer.h"
+#include "common/log.h"
+#include "common/mapped_file.h"
+
+namespace byml {
+
+namespace {
+
+constexpr bool isSpace(char c) {
+  return c == ' ' || c == '\t';
+}
+
+constexpr bool isLineEnd(char c) {
+  return c == '\n' || c == '\r' || c == '\0';
+}
+
+constexpr bool isFlowIndicator(char c) {
+  return c == ',' || c == '[' || c == ']' || c == '{' || c == '}';
+}
+
+bool isNullScalar(std::string_view value) {
+  return value.empty() || value == "~" || value == "null" || value == "Null" || value == "NULL";
+}
+
+std::string_view trimRight(std::string_view string) {
+  while (!string.empty() && isSpace(string.back()))
+    string.remove_suffix(1);
+  return string;
+}
+
+bool parseUnsigned(std::string_view string, u64* value) {
+  int base = 10;
+  if (string.size() > 2 && string[0] == '0' && (string[1] == 'x' || string[1] == 'X'))
+    base = 16, string.remove_prefix(2);
+  else if (string.size() > 2 && string[0] == '0' && string[1] == 'o')
+    base = 8, string.remove_prefix(2);
+  if (string.empty())
+    return false;
+  const auto result = std::from_chars(string.data(), string.data() + string.size(), *value, base);
+  return result.ec == std::errc{} && result.ptr == string.data() + string.size();
+}
+
+/// Parse a signed integer. The magnitude is returned separately so that the full range
+/// of both s64 and u64 values can be represented.
+bool parseInteger(std::string_view string, bool* negative, u64* magnitude) {
+  *negative = !string.empty() && string[0] == '-';
+  if (!string.empty() && (string[0] == '-' || string[0] == '+'))
+    string.remove_prefix(1);
+  return parseUnsigned(string, magnitude);
+}
+
+template <typename T>
+bool parseFloat(std::string_view string, T* value) {
+  const bool negative = !string.empty() && string[0] == '-';
+  std::string_view unsigned_ = string;
+  if (!unsigned_.empty() && (unsigned_[0] == '-' || unsigned_[0] == '+'))
+    unsigned_.remove_prefix(1);
+
+  if (unsigned_ == ".inf" || unsigned_ == ".Inf" || unsigned_ == ".INF" ||
+      unsigned_ == "Infinity") {
+    *value = negative ? -std::numeric_limits<T>::infinity() : std::numeric_limits<T>::infinity();
+    return true;
+  }
+  if (string == ".nan" || string == ".NaN" || string == ".NAN" || string == "NaN") {
+    *value = std::numeric_limits<T>::quiet_NaN();
+    return true;
+  }
+
+  // from_chars also accepts "inf" and "nan", which are strings in YAML, so make sure
+  // that the string looks like a number first.
+  if (unsigned_.empty() || !(('0' <= unsigned_[0] && unsigned_[0] <= '9') || unsigned_[0] == '.'))
+    return false;
+  const char* begin = string[0] == '+' ? string.data() + 1 : string.data();
+  const char* end = string.data() + string.size();
+  const auto result = std::from_chars(begin, end, *value);
+  return result.ec == std::errc{} && result.ptr == end;
+}
+
+void appendUtf8(std::string& out, u32 codePoint) {
+  if (codePoint < 0x80) {
+    out += char(codePoint);
+  } else if (codePoint < 0x800) {
+    out += char(0xc0 | (codePoint >> 6));
+    out += char(0x80 | (codePoint & 0x3f));
+  } else if (codePoint < 0x10000) {
+    out += char(0xe0 | (codePoint >> 12));
+    out += char(0x80 | ((codePoint >> 6) & 0x3f));
+    out += char(0x80 | (codePoint & 0x3f));
+  } else {
+    out += char(0xf0 | (codePoint >> 18));
+    out += char(0x80 | ((codePoint >> 12) & 0x3f));
+    out += char(0x80 | ((codePoint >> 6) & 0x3f));
+    out += char(0x80 | (codePoint & 0x3f));
+  }
+}
+
+/// Single-pass parser for the YAML subset that is commonly used for BYML documents
+/// (and for JSON, which is parsed as YAML flow collections). Nodes are passed to a Writer
+/// as soon as they are parsed: the only state is a stack of open containers.
+class TextParser {
+public:
+  TextParser(std::string_view text, Writer& writer) : mText{text}, mWriter{writer} {}
+
+  bool parse() {
+    while (!atEnd() && !mError) {
+      // Start of a line.
+      s32 indent = 0;
+      while (peek() == ' ')
+        ++mPos, ++indent;
+      const char c = peek();
+      if (c == '\t')
+        return fail("tabs cannot be used for indentation");
+      if (isLineEnd(c) || c == '#') {
+        skipToNextLine();
+        continue;
+      }
+      if (indent == 0 && (startsWith("---") || startsWith("...")) &&
+          (isSpace(peek(3)) || isLineEnd(peek(3)))) {
+        mPos += 3;
+        if (!expectLineEnd())
+          return fail("content after a document marker is not supported");
+        continue;
+      }
+      parseLine(indent);
+    }
+    if (mError)
+      return false;
+
+    if (mPendingValue && !mBlocks.empty())
+      mWriter.addNull();
+    for (size_t i = 0; i < mBlocks.size(); ++i)
+      mWriter.end();
+    return mWriter.isOk() || fail("invalid document");
+  }
+
+private:
+  struct BlockFrame {
+    NodeType type;
+    s32 indent;
+    /// Whether this is a sequence that has the same indentation as its parent mapping.
+    bool indentless;
+  };
+
+  enum class FlowState {
+    ItemOrEnd,
+    SeparatorOrEnd,
+  };
+
+  struct FlowFrame {
+    NodeType type;
+    FlowState state;
+  };
+
+  bool atEnd() const { return mPos >= mText.size(); }
+  char peek(size_t i = 0) const { return mPos + i < mText.size() ? mText[mPos + i] : '\0'; }
+  bool startsWith(std::string_view prefix) const {
+    return mText.substr(mPos, prefix.size()) == prefix;
+  }
+
+  void skipSpaces() {
+    while (isSpace(peek()))
+      ++mPos;
+  }
+
+  void skipToNextLine() {
+    const size_t end = mText.find('\n', mPos);
+    mPos = end == std::string_view::npos ? mText.size() : end + 1;
+  }
+
+  /// Skip whitespace (including line breaks) and comments.
+  void skipWhitespace() {
+    while (!atEnd()) {
+      const char c = peek();
+      if (isSpace(c) || c == '\n' || c == '\r')
+        ++mPos;
+      else if (c == '#')
+        skipToNextLine();
+      else
+        break;
+    }
+  }
+
+  bool isAtLineEndOrComment() {
+    skipSpaces();
+    return isLineEnd(peek()) || peek() == '#';
+  }
+
+  bool expectLineEnd() {
+    if (!isAtLineEndOrComment())
+      return fail("unexpected characters at the end of the line");
+    skipToNextLine();
+    return true;
+  }
+
+  bool fail([[maybe_unused]] const char* message) {
+    if (!mError) {
+      [[maybe_unused]] const size_t line =
+          1 + std::count(mText.begin(), mText.begin() + std::min(mPos, mText.size()), '\n');
+      ERR_LOG("Line {}: {}", line, message);
+    }
+    mError = true;
+    return false;
+  }
+
+  bool isSequenceEntry() const { return peek() == '-' && (isSpace(peek(1)) || isLineEnd(peek(1))); }
+
+  /// Parse the nodes that start on the current line at column `column`.
+  bool parseLine(s32 column) {
+    while (true) {
+      const bool isSeqEntry = isSequenceEntry();
+
+      // Does this line provide the value of the previous mapping key or sequence entry?
+      bool opensValue = false;
+      if (mPendingValue) {
+        const bool isIndentlessSeq = isSeqEntry && column == mPendingIndent &&
+                                     !mBlocks.empty() && mBlocks.back().type == NodeType::Hash;
+        if (column > mPendingIndent || isIndentlessSeq) {
+          opensValue = true;
+        } else {
+          mWriter.addNull();
+        }
+        mPendingValue = false;
+      }
+
+      if (!opensValue) {
+        while (!mBlocks.empty() &&
+               (mBlocks.back().indent > column ||
+                (mBlocks.back().indentless && mBlocks.back().indent == column && !isSeqEntry))) {
+          mWriter.end();
+          mBlocks.pop_back();
+        }
+        if (mBlocks.empty() || mBlocks.back().indent != column)
+          return fail("bad indentation");
+      }
+
+      if (isSeqEntry) {
+        if (opensValue) {
+          mWriter.beginArray();
+          mBlocks.push_back({NodeType::Array, column, column == mPendingIndent});
+        } else if (mBlocks.back().type != NodeType::Array) {
+          return fail("unexpected sequence entry in a mapping");
+        }
+        mPendingValue = true;
+        mPendingIndent = column;
+        ++mPos;
+        const size_t valueStart = mPos;
+        if (isAtLineEndOrComment()) {
+          skipToNextLine();
+          return true;
+        }
+        // The value starts on the same line (e.g. "- - x" or "- key: value").
+        column += 1 + static_cast<s32>(mPos - valueStart);
+        continue;
+      }
+
+      std::string_view key;
+      if (!tryParseKey(&key)) {
+        if (mError)
+          return false;
+        // A scalar or flow collection.
+        if (!opensValue)
+          return fail("unexpected value");
+        if (mBlocks.empty() && peek() != '[' && peek() != '{')
+          return parseRootScalar();
+        return parseInlineValue(false) && expectLineEnd();
+      }
+
+      if (opensValue) {
+        mWriter.beginHash();
+        mBlocks.push_back({NodeType::Hash, column, false});
+      } else if (mBlocks.back().type != NodeType::Hash) {
+        return fail("unexpected mapping key in a sequence");
+      }
+      mWriter.setKey(key);
+      if (isAtLineEndOrComment()) {
+        mPendingValue = true;
+        mPendingIndent = column;
+        skipToNextLine();
+        return true;
+      }
+      if (isSequenceEntry())
+        return fail("sequences must start on a new line");
+      return parseInlineValue(false) && expectLineEnd();
+    }
+  }
+
+  /// The root node must be a container, or null for an empty document (which is what toText
+  /// emits for documents without a root node).
+  bool parseRootScalar() {
+    if (!isNullScalar(readPlain(false)))
+      return fail("the root node must be a container or null");
+    return expectLineEnd();
+  }
+
+  /// Try to parse a mapping key (followed by a colon) in block context.
+  /// Returns false and leaves the position unchanged if there is no key.
+  bool tryParseKey(std::string_view* key) {
+    const size_t start = mPos;
+    const char c = peek();
+    if (c == '"' || c == '\'') {
+      if (!parseQuoted(key))
+        return false;
+      skipSpaces();
+      if (peek() == ':' && (isSpace(peek(1)) || isLineEnd(peek(1)))) {
+        ++mPos;
+        return true;
+      }
+      mPos = start;
+      return false;
+    }
+
+    if (c == '[' || c == '{' || c == '!' || c == '&' || c == '*' || c == '|' || c == '>' ||
+        c == '?') {
+      return false;
+    }
+
+    for (size_t i = mPos; i < mText.size() && !isLineEnd(mText[i]); ++i) {
+      const char next = i + 1 < mText.size() ? mText[i + 1] : '\0';
+      if (mText[i] == ':' && (isSpace(next) || isLineEnd(next))) {
+        *key = trimRight(mText.substr(mPos, i - mPos));
+        mPos = i + 1;
+        return true;
+      }
+      if (mText[i] == '#' && i != mPos && isSpace(mText[i - 1]))
+        break;
+    }
+    return false;
+  }
+
+  /// Read a plain scalar. In flow context, plain scalars also end at flow indicators
+  /// and at colons that separate keys from values, and may span several lines.
+  std::string_view readPlain(bool flow) {
+    const std::string_view firstLine = readPlainLine(flow);
+    if (!flow)
+      return firstLine;
+
+    bool folded = false;
+    while (peek() == '\n' || peek() == '\r') {
+      const size_t lineEnd = mPos;
+      size_t numBreaks = 0;
+      while (skipLineBreak()) {
+        ++numBreaks;
+        skipSpaces();
+      }
+      const char c = peek();
+      const bool isKeySeparator =
+          c == ':' && (isSpace(peek(1)) || isLineEnd(peek(1)) || isFlowIndicator(peek(1)));
+      if (atEnd() || c == '#' || isFlowIndicator(c) || isKeySeparator) {
+        mPos = lineEnd;
+        break;
+      }
+      if (!folded) {
+        mScratch.assign(firstLine);
+        folded = true;
+      }
+      if (numBreaks == 1)
+        mScratch += ' ';
+      else
+        mScratch.append(numBreaks - 1, '\n');
+      mScratch += readPlainLine(flow);
+    }
+    return folded ? std::string_view(mScratch) : firstLine;
+  }
+
+  std::string_view readPlainLine(bool flow) {
+    const size_t start = mPos;
+    while (!atEnd()) {
+      const char c = mText[mPos];
+      if (c == '\n' || c == '\r')
+        break;
+      if (c == '#' && mPos != start && isSpace(mText[mPos - 1]))
+        break;
+      if (flow && isFlowIndicator(c))
+        break;
+      if (flow && c == ':') {
+        const char next = peek(1);
+        if (isSpace(next) || isLineEnd(next) || isFlowIndicator(next))
+          break;
+      }
+      ++mPos;
+    }
+    return trimRight(mText.substr(start, mPos - start));
+  }
+
+  /// Skip a line break (LF or CR LF). Returns false if there is no line break.
+  bool skipLineBreak() {
+    if (peek() == '\r' && peek(1) == '\n')
+      mPos += 2;
+    else if (peek() == '\n' || peek() == '\r')
+      ++mPos;
+    else
+      return false;
+    return true;
+  }
+
+  /// Parse a single- or double-quoted scalar. Strings that do not contain any escape sequence
+  /// or line break refer to the input directly; others are decoded into a scratch buffer.
+  bool parseQuoted(std::string_view* value) {
+    const char quote = mText[mPos++];
+    const size_t start = mPos;
+
+    // Fast path: no escape sequences or line breaks.
+    while (!atEnd()) {
+      const char c = mText[mPos];
+      if (c == quote && !(quote == '\'' && peek(1) == '\''))
+        break;
+      if ((quote == '"' && c == '\\') || quote == c || c == '\n' || c == '\r')
+        return parseQuotedSlow(quote, start, value);
+      ++mPos;
+    }
+    if (atEnd())
+      return fail("unterminated quoted scalar");
+    *value = mText.substr(start, mPos - start);
+    ++mPos;
+    return true;
+  }
+
+  bool parseQuotedSlow(char quote, size_t start, std::string_view* value) {
+    mScratch.assign(mText.data() + start, mPos - start);
+    // Length of the part of mScratch that must not be trimmed when folding lines
+    // (escaped whitespace is preserved).
+    size_t protectedLength = 0;
+    while (true) {
+      if (atEnd())
+        return fail("unterminated quoted scalar");
+      const char c = mText[mPos];
+      if (c == '\n' || c == '\r') {
+        foldLines(protectedLength);
+        continue;
+      }
+
+      if (quote == '\'') {
+        ++mPos;
+        if (c != '\'') {
+          mScratch += c;
+        } else if (peek() == '\'') {
+          mScratch += '\'';
+          ++mPos;
+        } else {
+          break;
+        }
+        continue;
+      }
+
+      ++mPos;
+      if (c == '"')
+        break;
+      if (c != '\\') {
+        mScratch += c;
+        continue;
+      }
+      if (!parseEscapeSequence())
+        return false;
+      protectedLength = mScratch.size();
+    }
+    *value = mScratch;
+    return true;
+  }
+
+  /// Fold a line break in a multi-line quoted scalar: trailing and leading whitespace is
+  /// removed, a single line break becomes a space and n+1 line breaks become n newlines.
+  void foldLines(size_t protectedLength) {
+    while (mScratch.size() > protectedLength && isSpace(mScratch.back()))
+      mScratch.pop_back();
+    size_t numBreaks = 0;
+    while (skipLineBreak()) {
+      ++numBreaks;
+      skipSpaces();
+    }
+    if (numBreaks == 1)
+      mScratch += ' ';
+    else
+      mScratch.append(numBreaks - 1, '\n');
+  }
+
+  bool parseEscapeSequence() {
+    const char c = peek();
+    if (skipLineBreak()) {
+      // Escaped line break: the lines are joined without any separator.
+      skipSpaces();
+      while (skipLineBreak()) {
+        mScratch += '\n';
+        skipSpaces();
+      }
+      return true;
+    }
+    ++mPos;
+    switch (c) {
+    case '0':
+      mScratch += '\0';
+      return true;
+    case 'a':
+      mScratch += '\a';
+      return true;
+    case 'b':
+      mScratch += '\b';
+      return true;
+    case 't':
+    case '\t':
+      mScratch += '\t';
+      return true;
+    case 'n':
+      mScratch += '\n';
+      return true;
+    case 'v':
+      mScratch += '\v';
+      return true;
+    case 'f':
+      mScratch += '\f';
+      return true;
+    case 'r':
+      mScratch += '\r';
+      return true;
+    case 'e':
+      mScratch += '\x1b';
+      return true;
+    case ' ':
+    case '"':
+    case '/':
+    case '\\':
+      mScratch += c;
+      return true;
+    case 'N':
+      appendUtf8(mScratch, 0x85);
+      return true;
+    case '_':
+      appendUtf8(mScratch, 0xa0);
+      return true;
+    case 'L':
+      appendUtf8(mScratch, 0x2028);
+      return true;
+    case 'P':
+      appendUtf8(mScratch, 0x2029);
+      return true;
+    case 'x':
+    case 'u':
+    case 'U': {
+      u32 codePoint;
+      if (!parseHexEscape(c == 'x' ? 2 : c == 'u' ? 4 : 8, &codePoint))
+        return false;
+      // UTF-16 surrogate pairs (as written by JSON encoders).
+      if (c == 'u' && 0xd800 <= codePoint && codePoint < 0xdc00) {
+        u32 low;
+        if (peek() != '\\' || peek(1) != 'u')
+          return fail("invalid surrogate pair");
+        mPos += 2;
+        if (!parseHexEscape(4, &low) || low < 0xdc00 || low >= 0xe000)
+          return fail("invalid surrogate pair");
+        codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (low - 0xdc00);
+      }
+      if (codePoint > 0x10ffff || (0xd800 <= codePoint && codePoint < 0xe000))
+        return fail("invalid code point");
+      appendUtf8(mScratch, codePoint);
+      return true;
+    }
+    default:
+      return fail("invalid escape sequence");
+    }
+  }
+
+  bool parseHexEscape(size_t numDigits, u32* value) {
+    if (mPos + numDigits > mText.size())
+      return fail("invalid escape sequence");
+    const char* begin = mText.data() + mPos;
+    const auto result = std::from_chars(begin, begin + numDigits, *value, 16);
+    if (result.ec != std::errc{} || result.ptr != begin + numDigits)
+      return fail("invalid escape sequence");
+    mPos += numDigits;
+    return true;
+  }
+
+  /// Parse a value that starts at the current position: a scalar, a tagged scalar
+  /// or a flow collection.
+  bool parseInlineValue(bool flow) {
+    const char c = peek();
+    if (c == '[' || c == '{')
+      return parseFlowCollection();
+    if (c == '!')
+      return parseTaggedScalar(flow);
+    if (c == '"' || c == '\'') {
+      std::string_view value;
+      if (!parseQuoted(&value))
+        return false;
+      mWriter.addString(value);
+      return true;
+    }
+    if (c == '&' || c == '*')
+      return fail("anchors and aliases are not supported");
+    if (c == '|' || c == '>')
+      return fail("block scalars are not supported");
+    if (!flow && c == '-' && isSpace(peek(1)))
+      return fail("unexpected sequence entry");
+    return addPlainScalar(readPlain(flow));
+  }
+
+  bool addPlainScalar(std::string_view value) {
+    if (isNullScalar(value)) {
+      mWriter.addNull();
+      return true;
+    }
+    if (value == "true" || value == "True" || value == "TRUE") {
+      mWriter.addBool(true);
+      return true;
+    }
+    if (value == "false" || value == "False" || value == "FALSE") {
+      mWriter.addBool(false);
+      return true;
+    }
+
+    const char first = value[0];
+    if (('0' <= first && first <= '9') || first == '-' || first == '+' || first == '.' ||
+        first == 'N' || first == 'I') {
+      bool negative;
+      u64 magnitude;
+      if (parseInteger(value, &negative, &magnitude)) {
+        addInteger(negative, magnitude);
+        return true;
+      }
+      f32 floatValue;
+      if (parseFloat(value, &floatValue)) {
+        mWriter.addFloat(floatValue);
+        return true;
+      }
+    }
+    mWriter.addString(value);
+    return true;
+  }
+
+  /// Integers are stored in the smallest type that can represent them,
+  /// preferring signed types.
+  void addInteger(bool negative, u64 magnitude) {
+    if (negative) {
+      if (magnitude <= 0x80000000)
+        mWriter.addInt(static_cast<s32>(-static_cast<s64>(magnitude)));
+      else if (magnitude <= 0x8000000000000000)
+        mWriter.addInt64(static_cast<s64>(0 - magnitude));
+      else
+        fail("integer is out of range");
+      return;
+    }
+    if (magnitude <= 0x7fffffff)
+      mWriter.addInt(static_cast<s32>(magnitude));
+    else if (magnitude <= 0xffffffff)
+      mWriter.addUInt(static_cast<u32>(magnitude));
+    else if (magnitude <= 0x7fffffffffffffff)
+      mWriter.addInt64(static_cast<s64>(magnitude));
+    else
+      mWriter.addUInt64(magnitude);
+  }
+
+  bool parseTaggedScalar(bool flow) {
+    const size_t start = mPos;
+    while (!atEnd() && !isSpace(peek()) && !isLineEnd(peek()) && !(flow && isFlowIndicator(peek())))
+      ++mPos;
+    const std::string_view tag = mText.substr(start, mPos - start);
+    skipSpaces();
+
+    std::string_view value;
+    if (peek() == '"' || peek() == '\'') {
+      if (!parseQuoted(&value))
+        return false;
+    } else {
+      value = readPlain(flow);
+    }
+
+    if (tag == "!!str") {
+      mWriter.addString(value);
+      return true;
+    }
+    if (tag == "!u") {
+      u64 number;
+      if (!parseUnsigned(value, &number) || number > 0xffffffff)
+        return fail("invalid !u value");
+      mWriter.addUInt(static_cast<u32>(number));
+      return true;
+    }
+    if (tag == "!l") {
+      bool negative;
+      u64 magnitude;
+      if (!parseInteger(value, &negative, &magnitude) ||
+          magnitude > (negative ? 0x8000000000000000 : 0x7fffffffffffffff)) {
+        return fail("invalid !l value");
+      }
+      mWriter.addInt64(negative ? static_cast<s64>(0 - magnitude) : static_cast<s64>(magnitude));
+      return true;
+    }
+    if (tag == "!ul") {
+      u64 number;
+      if (!parseUnsigned(value, &number))
+        return fail("invalid !ul value");
+      mWriter.addUInt64(number);
+      return true;
+    }
+    if (tag == "!f64") {
+      f64 number;
+      if (!parseFloat(value, &number))
+        return fail("invalid !f64 value");
+      mWriter.addDouble(number);
+      return true;
+    }
+    return fail("unsupported tag");
+  }
+
+  /// Parse a flow collection (which may span several lines). Nested collections are handled
+  /// with an explicit stack.
+  bool parseFlowCollection() {
+    const auto begin = [&](char c) {
+      if (c == '[')
+        mWriter.beginArray();
+      else
+        mWriter.beginHash();
+      mFlowStack.push_back({c == '[' ? NodeType::Array : NodeType::Hash, FlowState::ItemOrEnd});
+      ++mPos;
+    };
+
+    mFlowStack.clear();
+    begin(peek());
+    while (!mFlowStack.empty()) {
+      skipWhitespace();
+      if (atEnd())
+        return fail("unterminated flow collection");
+
+      FlowFrame& frame = mFlowStack.back();
+      const char c = peek();
+      if (c == ']' || c == '}') {
+        if ((c == ']') != (frame.type == NodeType::Array))
+          return fail("mismatched brackets");
+        ++mPos;
+        mWriter.end();
+        mFlowStack.pop_back();
+        if (!mFlowStack.empty())
+          mFlowStack.back().state = FlowState::SeparatorOrEnd;
+        continue;
+      }
+
+      if (frame.state == FlowState::SeparatorOrEnd) {
+        if (c != ',')
+          return fail("expected ',' or the end of the flow collection");
+        ++mPos;
+        frame.state = FlowState::ItemOrEnd;
+        continue;
+      }
+
+      if (c == ',')
+        return fail("unexpected ','");
+      frame.state = FlowState::SeparatorOrEnd;
+
+      if (frame.type == NodeType::Hash) {
+        std::string_view key;
+        if (c == '"' || c == '\'') {
+          if (!parseQuoted(&key))
+            return false;
+        } else {
+          key = readPlain(true);
+        }
+        mWriter.setKey(key);
+        skipWhitespace();
+        if (peek() != ':')
+          return fail("expected ':' after a key");
+        ++mPos;
+        skipWhitespace();
+      }
+
+      const char valueStart = peek();
+      if (valueStart == '[' || valueStart == '{') {
+        begin(valueStart);
+        continue;
+      }
+      if (frame.type == NodeType::Hash && (valueStart == ',' || valueStart == '}')) {
+        mWriter.addNull();
+        continue;
+      }
+      if (!parseInlineValue(true))
+        return false;
+    }
+    return !mError;
+  }
+
+  std::string_view mText;
+  size_t mPos = 0;
+  Writer& mWriter;
+  bool mError = false;
+
+  std::vector<BlockFrame> mBlocks;
+  /// Whether the last mapping key or sequence entry is still waiting for its value.
+  /// Initially true, for the root node.
+  bool mPendingValue = true;
+  /// Indentation of the container that is waiting for a value.
+  s32 mPendingIndent = -1;
+
+  std::vector<FlowFrame> mFlowStack;
+  std::string mScratch;
+};
+
+}  // end of anonymous namespace
+
+std::optional<std::vector<u8>> fromText(std::string_view text, u16 version, bool bigEndian) {
+  Writer writer{version, bigEndian};
+  if (!TextParser{text, writer}.parse())
+    return {};
+  return writer.finish();
+}
+
+std::optional<std::vector<u8>> fromTextFile(const std::string& path, u16 version,
+                                            bool bigEndian) {
+  const auto file = common::MappedFile::open(path);
+  if (!file)
+    return {};
+  const std::string_view text{reinterpret_cast<const char*>(file->data()), file->size()};
+  return fromText(text, version, bigEndian);
+}
+
+}  // namespace byml
@@ -3,38 +3,186 @@
 
 #include "byml/value.h"
 
+#include <algorithm>
 #include <cstring>
+#include <type_traits>
+#include <utility>
 
 #include "byml/binary_format.h"
 #include "byml/byml.h"
 #include "byml/container_util.h"
 #include "byml/types.h"
 #include "common/binary_reader.h"
+#include "common/simd.h"
 #include "common/swap.h"
 
 namespace byml {
 
-static common::BinaryReader getBinaryReader(const Reader& reader) {
-  return {reader.getBuffer(), reader.isBigEndian()};
+/// Call `fn` with a reader that has the document's byte order built in.
+/// Accessors pick the byte order once per call and then only do plain (or byteswapped) loads.
+/// The byte order is not baked into the Reader itself: that would require either templating
+/// every public type on it or dispatching through function pointers, which cannot be inlined.
+/// The branch here always goes the same way for a given document and is well predicted.
+template <typename Fn>
+static decltype(auto) withBinaryReader(const Reader& reader, Fn&& fn) {
+  return common::withStaticReader(reader.getBuffer(), reader.isBigEndian(), std::forward<Fn>(fn));
 }
 
 ContainerBase::ContainerBase(const Reader& reader, u32 offset) : mReader{reader}, mOffset{offset} {
-  mNumItems = util::readContainerSize(getBinaryReader(mReader), mOffset);
+  mNumItems =
+      withBinaryReader(mReader, [&](auto br) { return util::readContainerSize(br, mOffset); });
+}
+
+Array::Array(const Reader& reader, u32 offset)
+    : Container{reader, offset}, mType{NodeType(reader.getBuffer()[offset])} {
+  if (isMonoTyped()) {
+    mItemType = withBinaryReader(
+        mReader, [&](auto br) { return util::readMonoTypedArrayItemType(br, mOffset); });
+  }
 }
 
 std::optional<ItemData> Array::getByIndexImpl(size_t idx) const {
-  const common::BinaryReader br{getBinaryReader(mReader)};
+  if (numItems() <= idx)
+    return {};
+  return withBinaryReader(mReader, [&](auto br) {
+    if (isMonoTyped()) {
+      const u64 valuesOffset = util::getMonoTypedArrayValuesOffset(mOffset);
+      return ItemData{mReader, {br.template read<u32>(valuesOffset + 4 * idx), mItemType}};
+    }
+    const u64 typesOffset = util::getArrayTypesOffset(mOffset);
+    const u64 valuesOffset = util::getArrayValuesOffset(mOffset, numItems());
+    return ItemData{mReader, util::readArrayItem(br, typesOffset, valuesOffset, idx)};
+  });
+}
+
+std::optional<NodeType> Array::getUniformType() const {
+  if (numItems() == 0)
+    return {};
+  if (isMonoTyped())
+    return mItemType;
+  const u8* types = mReader.getBuffer().data() + util::getArrayTypesOffset(mOffset);
+  // All types are equal if and only if each type is equal to the next one.
+  if (std::memcmp(types, types + 1, numItems() - 1) != 0)
+    return {};
+  return NodeType(types[0]);
+}
+
+const u8* Array::getRawValues() const {
+  if (isMonoTyped())
+    return mReader.getBuffer().data() + util::getMonoTypedArrayValuesOffset(mOffset);
+  return mReader.getBuffer().data() + util::getArrayValuesOffset(mOffset, numItems());
+}
+
+void Array::decodeTypes(NodeType* types) const {
+  if (isMonoTyped()) {
+    std::fill_n(types, numItems(), mItemType);
+    return;
+  }
+  std::memcpy(types, mReader.getBuffer().data() + util::getArrayTypesOffset(mOffset), numItems());
+}
+
+void Array::decodeRaw(u32* values) const {
+  if (mReader.isBigEndian() == common::detail::isBigEndianPlatform())
+    std::memcpy(values, getRawValues(), 4 * numItems());
+  else
+    common::byteswap32(values, getRawValues(), numItems());
+}
+
+/// Get the node type of the items that can be decoded as T.
+template <typename T>
+static constexpr NodeType getNodeTypeForValue() {
+  static_assert(std::is_same_v<T, s32> || std::is_same_v<T, u32> || std::is_same_v<T, f32> ||
+                    std::is_same_v<T, bool>,
+                "Unsupported value type");
+  return std::is_same_v<T, s32> ? NodeType::Int :
+         std::is_same_v<T, u32> ? NodeType::UInt :
+         std::is_same_v<T, f32> ? NodeType::Float :
+                                  NodeType::Bool;
+}
+
+/// Returns whether all items of an array have the given type. The type bytes are scanned
+/// with vectorized compares, except for monotyped arrays which only have one type.
+static bool allItemsHaveType(const Array& array, NodeType type) {
+  if (array.isMonoTyped())
+    return array.numItems() == 0 || array.getUniformType() == type;
+  const u8* data = array.getReader().getBuffer().data();
+  const u8* types = data + util::getArrayTypesOffset(array.getOffset());
+  return common::allBytesEqual(types, array.numItems(), u8(type));
+}
+
+template <typename T>
+bool Array::decodeInto(T* values) const {
+  if (!allItemsHaveType(*this, getNodeTypeForValue<T>()))
+    return false;
+
+  if constexpr (std::is_same_v<T, bool>) {
+    // Whether a word is zero does not depend on the byte order.
+    const u8* raw = getRawValues();
+    for (size_t i = 0; i < numItems(); ++i) {
+      u32 value;
+      std::memcpy(&value, raw + 4 * i, sizeof(value));
+      values[i] = value != 0;
+    }
+  } else if (mReader.isBigEndian() == common::detail::isBigEndianPlatform()) {
+    std::memcpy(values, getRawValues(), 4 * numItems());
+  } else {
+    common::byteswap32(values, getRawValues(), numItems());
+  }
+  return true;
+}
+
+template bool Array::decodeInto<s32>(s32*) const;
+template bool Array::decodeInto<u32>(u32*) const;
+template bool Array::decodeInto<f32>(f32*) const;
+template bool Array::decodeInto<bool>(bool*) const;
+
+template <typename T>
+std::optional<ArraySpan<T>> Array::asSpan() const {
+  if (!allItemsHaveType(*this, getNodeTypeForValue<T>()))
+    return {};
+  return ArraySpan<T>{getRawValues(), numItems(),
+                      mReader.isBigEndian() != common::detail::isBigEndianPlatform()};
+}
+
+template std::optional<ArraySpan<s32>> Array::asSpan<s32>() const;
+template std::optional<ArraySpan<u32>> Array::asSpan<u32>() const;
+template std::optional<ArraySpan<f32>> Array::asSpan<f32>() const;
+template std::optional<ArraySpan<bool>> Array::asSpan<bool>() const;
 
+Hash32::Hash32(const Reader& reader, u32 offset)
+    : Container{reader, offset}, mType{NodeType(reader.getBuffer()[offset])} {}
+
+std::optional<Hash32Item> Hash32::getByIndexImpl(size_t idx) const {
   if (numItems() <= idx)
     return {};
-  const u64 typesOffset = util::getArrayTypesOffset(mOffset);
-  const u64 valuesOffset = util::getArrayValuesOffset(mOffset, numItems());
-  return ItemData{mReader, util::readArrayItem(br, typesOffset, valuesOffset, idx)};
+  return withBinaryReader(mReader, [&](auto br) {
+    const auto item = util::readHash32Item(br, mOffset, mType, numItems(), idx);
+    return Hash32Item{item.key, {mReader, item.data}};
+  });
+}
+
+std::optional<ItemData> Hash32::getByKey(u32 key) const {
+  return withBinaryReader(mReader, [&](auto br) -> std::optional<ItemData> {
+    s32 a = 0;
+    s32 b = numItems() - 1;
+    while (a <= b) {
+      s32 m = (a + b) / 2;
+      const u32 itemKey = util::readHash32ItemKey(br, mOffset, mType, m);
+      if (itemKey < key)
+        a = m + 1;
+      else if (itemKey > key)
+        b = m - 1;
+      else
+        return ItemData{mReader, util::readHash32Item(br, mOffset, mType, numItems(), m).data};
+    }
+    return {};
+  });
 }
 
 namespace {
-inline HashItem hashGetByIndex(const Reader& reader, common::BinaryReader br, u32 offset,
-                               u32 hashKeyTableOffset, size_t idx) {
+template <typename BR>
+inline HashItem hashGetByIndex(const Reader& reader, BR br, u32 offset, u32 hashKeyTableOffset,
+                               size_t idx) {
   const auto item = util::readHashItem(br, offset, idx);
   const char* key = br.getString(util::getStringOffset(br, hashKeyTableOffset, item.keyIndex));
   return {key, {reader, item.data}};
@@ -42,83 +190,112 @@ inline HashItem hashGetByIndex(const Reader& reader, common::BinaryReader br, u3
 }  // end of anonymous namespace
 
 std::optional<HashItem> Hash::getByIndexImpl(size_t idx) const {
-  const common::BinaryReader br{getBinaryReader(mReader)};
+  if (numItems() <= idx)
+    return {};
+  return withBinaryReader(mReader, [&](auto br) {
+    return hashGetByIndex(mReader, br, mOffset, mReader.getHashKeyTableOffset(), idx);
+  });
+}
 
+std::optional<KeyId> Hash::getKeyIdByIndex(size_t idx) const {
   if (numItems() <= idx)
     return {};
-  return hashGetByIndex(mReader, br, mOffset, mReader.getHashKeyTableOffset(), idx);
+  return withBinaryReader(
+      mReader, [&](auto br) { return KeyId{util::readHashItemKeyIndex(br, mOffset, idx)}; });
 }
 
 std::optional<ItemData> Hash::getByKey(const char* key) const {
-  const common::BinaryReader br{getBinaryReader(mReader)};
-
-  // Since all items are lexicographically sorted, a binary search can be performed here.
-  // Holding the indexes in signed 32-bit integers is fine
-  // since a BYML container can only contain up to 2**24 items.
-  s32 a = 0;
-  s32 b = numItems() - 1;
-  while (a <= b) {
-    s32 m = (a + b) / 2;
-    const HashItem item = hashGetByIndex(mReader, br, mOffset, mReader.getHashKeyTableOffset(), m);
-    const int cmp = std::strcmp(item.name, key);
-    if (cmp < 0)
-      a = m + 1;
-    else if (cmp > 0)
-      b = m - 1;
-    else
-      return item.data;
+  if (mReader.hasKeyIndex()) {
+    if (const auto id = mReader.findKey(key))
+      return getByKey(*id);
+    return {};
   }
-  return {};
+
+  return withBinaryReader(mReader, [&](auto br) -> std::optional<ItemData> {
+    // Since all items are lexicographically sorted, a binary search can be performed here.
+    // Holding the indexes in signed 32-bit integers is fine
+    // since a BYML container can only contain up to 2**24 items.
+    const u32 hashKeyTableOffset = mReader.getHashKeyTableOffset();
+    s32 a = 0;
+    s32 b = numItems() - 1;
+    while (a <= b) {
+      s32 m = (a + b) / 2;
+      const HashItem item = hashGetByIndex(mReader, br, mOffset, hashKeyTableOffset, m);
+      const int cmp = std::strcmp(item.name, key);
+      if (cmp < 0)
+        a = m + 1;
+      else if (cmp > 0)
+        b = m - 1;
+      else
+        return item.data;
+    }
+    return {};
+  });
+}
+
+std::optional<ItemData> Hash::getByKey(KeyId key) const {
+  return withBinaryReader(mReader, [&](auto br) -> std::optional<ItemData> {
+    // Items are sorted by key, and so are the strings in the hash key table:
+    // key indices are in ascending order.
+    s32 a = 0;
+    s32 b = numItems() - 1;
+    while (a <= b) {
+      s32 m = (a + b) / 2;
+      const u32 keyIndex = util::readHashItemKeyIndex(br, mOffset, m);
+      if (keyIndex < key.index)
+        a = m + 1;
+      else if (keyIndex > key.index)
+        b = m - 1;
+      else
+        return ItemData{mReader, util::readHashItem(br, mOffset, m).data};
+    }
+    return {};
+  });
 }
 
 std::optional<Hash> ItemData::getHash() const {
-  if (raw.type != NodeType::Hash)
+  if (raw.type != NodeType::Hash || !reader.checkContainerOnAccess(raw, NodeType::Hash))
     return {};
   return Hash{reader, raw};
 }
 
 std::optional<Array> ItemData::getArray() const {
-  if (raw.type != NodeType::Array)
+  if (raw.type != NodeType::Array && raw.type != NodeType::MonoTypedArray)
+    return {};
+  if (!reader.checkContainerOnAccess(raw, raw.type))
     return {};
   return Array{reader, raw};
 }
 
-const char* ItemData::getString() const {
-  if (raw.type != NodeType::String)
+std::optional<Hash32> ItemData::getHash32() const {
+  if (raw.type != NodeType::Hash32 && raw.type != NodeType::ValueHash32)
+    return {};
+  if (!reader.checkContainerOnAccess(raw, raw.type))
     return {};
-  const common::BinaryReader br{getBinaryReader(reader)};
-  return br.getString(util::getStringOffset(br, reader.getStringTableOffset(), raw));
+  return Hash32{reader, raw};
 }
 
-std::optional<bool> ItemData::getBool() const {
-  if (raw.type != NodeType::Bool)
+const char* ItemData::getString() const {
+  if (raw.type != NodeType::String)
     return {};
-  return raw != 0;
+  return withBinaryReader(reader, [&](auto br) {
+    return br.getString(util::getStringOffset(br, reader.getStringTableOffset(), raw));
+  });
 }
 
-std::optional<s32> ItemData::getInt() const {
-  if (raw.type != NodeType::Int)
+std::optional<std::string_view> ItemData::getStringView() const {
+  if (raw.type != NodeType::String)
     return {};
-  return static_cast<s32>(raw);
+  return reader.getStringView(raw);
 }
 
-std::optional<u32> ItemData::getUInt() const {
-  switch (raw.type) {
-  case NodeType::Int:
-    return static_cast<s32>(raw) >= 0 ? raw : std::optional<u32>{};
-  case NodeType::UInt:
-    return raw;
-  default:
-    return {};
-  }
+template <typename T>
+static T read64BitValue(const Reader& reader, u32 offset) {
+  return withBinaryReader(reader, [&](auto br) { return br.template read<T>(offset); });
 }
 
-std::optional<f32> ItemData::getFloat() const {
-  if (raw.type != NodeType::Float)
-    return {};
-  float value;
-  std::memcpy(&value, &raw.raw, sizeof(value));
-  return value;
+static u32 read32BitValue(const Reader& reader, u64 offset) {
+  return withBinaryReader(reader, [&](auto br) { return br.template read<u32>(offset); });
 }
 
 std::optional<s64> ItemData::getInt64() const {
@@ -128,7 +305,7 @@ std::optional<s64> ItemData::getInt64() const {
   case NodeType::UInt:
     return raw;
   case NodeType::Int64:
-    return getBinaryReader(reader).read<s64>(raw);
+    return read64BitValue<s64>(reader, raw);
   default:
     return {};
   }
@@ -141,7 +318,7 @@ std::optional<u64> ItemData::getUInt64() const {
   if (raw.type != NodeType::Int64 && raw.type != NodeType::UInt64)
     return {};
 
-  const u64 value = getBinaryReader(reader).read<u64>(raw);
+  const u64 value = read64BitValue<u64>(reader, raw);
   if (raw.type == NodeType::Int64 && static_cast<s64>(value) < 0)
     return {};
   return value;
@@ -154,18 +331,50 @@ std::optional<f64> ItemData::getDouble() const {
   if (raw.type != NodeType::Double)
     return {};
 
-  const u64 rawValue = getBinaryReader(reader).read<u64>(raw);
+  const u64 rawValue = read64BitValue<u64>(reader, raw);
   double value;
   std::memcpy(&value, &rawValue, sizeof(value));
   return value;
 }
 
+std::optional<Buffer> ItemData::getBinary() const {
+  if (!isBinaryType(raw.type))
+    return {};
+  // The data follows the header: {u32 size} or {u32 size, u32 alignment}.
+  const u32 headerSize = raw.type == NodeType::FileData ? 8 : 4;
+  const u32 size = read32BitValue(reader, raw);
+  return Buffer{reader.getBuffer().data() + raw + headerSize, size};
+}
+
+std::optional<u32> ItemData::getBinaryAlignment() const {
+  switch (raw.type) {
+  case NodeType::Binary:
+    return 1;
+  case NodeType::FileData:
+    return read32BitValue(reader, raw + 4);
+  default:
+    return {};
+  }
+}
+
 ItemData::Variant ItemData::val() const {
+  if (auto value = tryVal())
+    return std::move(*value);
+  return 0x0badbadbadbadbad;
+}
+
+std::optional<ItemData::Variant> ItemData::tryVal() const {
   switch (raw.type) {
   case NodeType::Hash:
-    return *getHash();
+    // Containers can fail checks if checked access is enabled.
+    if (const auto hash = getHash())
+      return *hash;
+    break;
   case NodeType::Array:
-    return *getArray();
+  case NodeType::MonoTypedArray:
+    if (const auto array = getArray())
+      return *array;
+    break;
   case NodeType::String:
     return getString();
   case NodeType::Bool:
@@ -183,9 +392,10 @@ ItemData::Variant ItemData::val() const {
   case NodeType::Double:
     return *getDouble();
   default:
-    // Should never happen -- all nodes are checked by the reader.
-    return 0x0badbadbadbadbad;
+    // Binary data, Hash32 and Null nodes cannot be represented.
+    break;
   }
+  return {};
 }
 
 }  // namespace byml
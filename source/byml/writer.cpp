@@ -0,0 +1,578 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+
+#include "byml/writer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#include "byml/binary_format.h"
+#include "byml/byml.h"
+#include "byml/container_util.h"
+#include "common/align.h"
+#include "common/arena.h"
+#include "common/binary_reader.h"
+#include "common/binary_writer.h"
+#include "common/log.h"
+
+namespace byml {
+
+namespace {
+
+constexpr u32 NoKey = 0xffffffff;
+constexpr u32 MaxNumItems = 0xffffff;
+
+/// Item of a container that has not been encoded yet.
+struct PendingItem {
+  /// Key ID (for hash items) or NoKey.
+  u32 key;
+  NodeType type;
+  /// Raw value. For strings, this is a string ID; for containers and 64-bit values,
+  /// an offset relative to the start of the body.
+  u32 value;
+};
+
+/// Pool of unique strings. IDs are assigned in insertion order; the indices in the final
+/// string table are only known once the document is complete.
+class StringPool {
+public:
+  u32 add(common::Arena& arena, std::string_view string) {
+    const auto it = mIds.find(string);
+    if (it != mIds.end())
+      return it->second;
+    const std::string_view copy = arena.copyString(string);
+    const u32 id = static_cast<u32>(mStrings.size());
+    mStrings.push_back(copy);
+    mIds.emplace(copy, id);
+    return id;
+  }
+
+  size_t size() const { return mStrings.size(); }
+  bool empty() const { return mStrings.empty(); }
+  std::string_view get(u32 id) const { return mStrings[id]; }
+
+  /// Sort the strings. Returns the sorted strings and the table index of each string ID.
+  /// string_view comparisons are byte-wise (unsigned), which matches strcmp.
+  std::pair<std::vector<std::string_view>, std::vector<u32>> sort() const {
+    std::vector<u32> ids(mStrings.size());
+    for (u32 i = 0; i < ids.size(); ++i)
+      ids[i] = i;
+    std::sort(ids.begin(), ids.end(), [&](u32 a, u32 b) { return mStrings[a] < mStrings[b]; });
+
+    std::vector<std::string_view> sorted(ids.size());
+    std::vector<u32> indices(ids.size());
+    for (u32 i = 0; i < ids.size(); ++i) {
+      sorted[i] = mStrings[ids[i]];
+      indices[ids[i]] = i;
+    }
+    return {std::move(sorted), std::move(indices)};
+  }
+
+private:
+  std::unordered_map<std::string_view, u32> mIds;
+  std::vector<std::string_view> mStrings;
+};
+
+/// Hash of an encoded container. Containers are always a multiple of 4 bytes long.
+u64 hashContainer(const u8* data, size_t size) {
+  u64 hash = 0x9e3779b97f4a7c15 ^ size;
+  const auto mix = [&](u64 word) {
+    hash = (hash ^ word) * 0xff51afd7ed558ccd;
+    hash ^= hash >> 32;
+  };
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    u64 word;
+    std::memcpy(&word, data + i, sizeof(word));
+    mix(word);
+  }
+  if (i < size) {
+    u32 word;
+    std::memcpy(&word, data + i, sizeof(word));
+    mix(word);
+  }
+  return hash;
+}
+
+}  // end of anonymous namespace
+
+struct Writer::Impl {
+  struct Frame {
+    NodeType type;
+    /// Key of the container in its parent (or NoKey).
+    u32 key;
+    /// Index of the first item of the container in `items`.
+    size_t firstItem;
+  };
+
+  struct EncodedContainer {
+    u32 offset;
+    u32 size;
+  };
+
+  Impl(u16 version_, bool bigEndian_) : version{version_}, bigEndian{bigEndian_} {
+    if (version < 2 || version > 3) {
+      ERR_LOG("Unsupported version: {}", version);
+      ok = false;
+    }
+  }
+
+  void fail() { ok = false; }
+
+  /// Returns false if a node cannot be added in the current state.
+  bool checkCanAdd() {
+    if (!ok)
+      return false;
+    if (stack.empty()) {
+      // Only the root container can be added without a parent.
+      ok = false;
+      return false;
+    }
+    // Hash items need a key and array items must not have one.
+    if ((stack.back().type == NodeType::Hash) == (pendingKey == NoKey)) {
+      ok = false;
+      return false;
+    }
+    return true;
+  }
+
+  void addItem(NodeType type, u32 value) {
+    if (!checkCanAdd())
+      return;
+    items.push_back({pendingKey, type, value});
+    pendingKey = NoKey;
+  }
+
+  void add64BitValue(NodeType type, u64 value) {
+    if (version < 3) {
+      ERR_LOG("64-bit nodes require version 3");
+      fail();
+      return;
+    }
+    if (!checkCanAdd())
+      return;
+
+    // Identical values are only stored once.
+    const auto it = values64.find(value);
+    if (it != values64.end()) {
+      addItem(type, it->second);
+      return;
+    }
+    const u32 offset = static_cast<u32>(body.size());
+    body.resize(body.size() + 8);
+    common::BinaryWriter{body.data(), bigEndian}.write<u64>(offset, value);
+    values64.emplace(value, offset);
+    addItem(type, offset);
+  }
+
+  void setKey(std::string_view key) {
+    if (keys.size() >= MaxNumItems || std::memchr(key.data(), 0, key.size())) {
+      fail();
+      return;
+    }
+    pendingKey = keys.add(arena, key);
+  }
+
+  void begin(NodeType type) {
+    if (!ok)
+      return;
+    if (stack.empty() && (root || pendingKey != NoKey)) {
+      fail();
+      return;
+    }
+    if (!stack.empty() && !checkCanAdd())
+      return;
+    stack.push_back({type, pendingKey, items.size()});
+    pendingKey = NoKey;
+  }
+
+  /// Returns the body offset of the container.
+  std::optional<u32> end() {
+    if (!ok || stack.empty() || pendingKey != NoKey) {
+      fail();
+      return {};
+    }
+    const Frame frame = stack.back();
+    stack.pop_back();
+
+    const size_t numItems = items.size() - frame.firstItem;
+    if (numItems > MaxNumItems || body.size() > 0xffffffff - 0x1000000) {
+      fail();
+      return {};
+    }
+    PendingItem* first = items.data() + frame.firstItem;
+
+    if (frame.type == NodeType::Hash) {
+      // Hash items must be sorted by key. Keys are pooled, so duplicate keys have the same ID.
+      std::sort(first, first + numItems, [&](const PendingItem& a, const PendingItem& b) {
+        return keys.get(a.key) < keys.get(b.key);
+      });
+      for (size_t i = 1; i < numItems; ++i) {
+        if (first[i - 1].key == first[i].key) {
+          ERR_LOG("Duplicate key: {}", keys.get(first[i].key));
+          fail();
+          return {};
+        }
+      }
+    }
+
+    const u32 offset = encodeContainer(frame.type, first, numItems);
+    items.resize(frame.firstItem);
+
+    if (stack.empty()) {
+      root = offset;
+    } else {
+      items.push_back({frame.key, frame.type, offset});
+    }
+    return offset;
+  }
+
+  /// Encode a container at the end of the body and return its offset.
+  /// If an identical container has already been encoded, that one is reused instead.
+  u32 encodeContainer(NodeType type, const PendingItem* first, size_t numItems) {
+    const u32 offset = static_cast<u32>(body.size());
+    if (type == NodeType::Hash)
+      body.resize(util::getHashItemOffset(offset, numItems));
+    else
+      body.resize(util::getArrayValuesOffset(offset, numItems) + 4 * numItems);
+
+    const common::BinaryWriter writer{body.data(), bigEndian};
+    writer.write<u8>(offset, u8(type));
+    writer.writeU24(offset + 1, numItems);
+    if (type == NodeType::Hash) {
+      for (size_t i = 0; i < numItems; ++i) {
+        const u32 itemOffset = util::getHashItemOffset(offset, i);
+        writer.writeU24(itemOffset, first[i].key);
+        writer.write<u8>(itemOffset + 3, u8(first[i].type));
+        writer.write<u32>(itemOffset + 4, first[i].value);
+      }
+    } else {
+      const u32 typesOffset = util::getArrayTypesOffset(offset);
+      const u32 valuesOffset = util::getArrayValuesOffset(offset, numItems);
+      for (size_t i = 0; i < numItems; ++i) {
+        writer.write<u8>(typesOffset + i, u8(first[i].type));
+        writer.write<u32>(valuesOffset + 4 * i, first[i].value);
+      }
+    }
+
+    // Children are encoded before their parents and have already been deduplicated,
+    // so two containers are identical iff their encoded bytes are identical.
+    const u32 size = static_cast<u32>(body.size()) - offset;
+    const u64 hash = hashContainer(&body[offset], size);
+    const auto range = encodedContainers.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      const EncodedContainer& other = it->second;
+      if (other.size == size && std::memcmp(&body[other.offset], &body[offset], size) == 0) {
+        body.resize(offset);
+        return other.offset;
+      }
+    }
+    encodedContainers.emplace(hash, EncodedContainer{offset, size});
+    containerOffsets.push_back(offset);
+    return offset;
+  }
+
+  std::optional<std::vector<u8>> finish() const;
+
+  u16 version;
+  bool bigEndian;
+  bool ok = true;
+
+  common::Arena arena;
+  StringPool keys;
+  StringPool strings;
+
+  std::vector<Frame> stack;
+  std::vector<PendingItem> items;
+  u32 pendingKey = NoKey;
+
+  /// Encoded nodes (containers and 64-bit values). Offsets in the body are relative to its start,
+  /// and string and key indices are string IDs; both are fixed up when the document is finished.
+  std::vector<u8> body;
+  std::optional<u32> root;
+  std::vector<u32> containerOffsets;
+  std::unordered_multimap<u64, EncodedContainer> encodedContainers;
+  std::unordered_map<u64, u32> values64;
+};
+
+std::optional<std::vector<u8>> Writer::Impl::finish() const {
+  if (!ok || !stack.empty() || pendingKey != NoKey)
+    return {};
+  // String table sizes are stored as 24-bit integers.
+  if (keys.size() > MaxNumItems || strings.size() > MaxNumItems)
+    return {};
+
+  const auto [sortedKeys, keyIndices] = keys.sort();
+  const auto [sortedStrings, stringIndices] = strings.sort();
+
+  // Layout: header, hash key table, string table, nodes.
+  const u32 keyTableSize = util::getStringTableSize(sortedKeys);
+  const u32 stringTableSize = util::getStringTableSize(sortedStrings);
+  const u32 keyTableOffset = keyTableSize ? sizeof(ResHeader) : 0;
+  const u32 stringTableOffset = stringTableSize ? sizeof(ResHeader) + keyTableSize : 0;
+  const u32 bodyOffset = sizeof(ResHeader) + keyTableSize + stringTableSize;
+  if (u64(bodyOffset) + body.size() > 0xffffffff)
+    return {};
+
+  std::vector<u8> data(bodyOffset + body.size());
+  const common::BinaryWriter writer{data.data(), bigEndian};
+  data[0] = bigEndian ? 'B' : 'Y';
+  data[1] = bigEndian ? 'Y' : 'B';
+  writer.write<u16>(offsetof(ResHeader, version), version);
+  writer.write<u32>(offsetof(ResHeader, hashKeyTableOffset), keyTableOffset);
+  writer.write<u32>(offsetof(ResHeader, stringTableOffset), stringTableOffset);
+  writer.write<u32>(offsetof(ResHeader, rootNodeOffset), root ? bodyOffset + *root : 0);
+  if (keyTableOffset)
+    util::writeStringTable(writer, keyTableOffset, sortedKeys);
+  if (stringTableOffset)
+    util::writeStringTable(writer, stringTableOffset, sortedStrings);
+  if (!body.empty())
+    std::memcpy(&data[bodyOffset], body.data(), body.size());
+
+  const auto relocate = [&](NodeType type, u32 value) -> u32 {
+    switch (type) {
+    case NodeType::String:
+      return stringIndices[value];
+    case NodeType::Array:
+    case NodeType::Hash:
+    case NodeType::Int64:
+    case NodeType::UInt64:
+    case NodeType::Double:
+      return bodyOffset + value;
+    default:
+      return value;
+    }
+  };
+
+  // Fix up offsets and string indices. Each container is only encoded once,
+  // so this is a single pass over all container items.
+  common::withStaticReader(data.data(), bigEndian, [&](auto br) {
+    for (const u32 containerOffset : containerOffsets) {
+      const u32 offset = bodyOffset + containerOffset;
+      const u32 numItems = util::readContainerSize(br, offset);
+      if (NodeType(data[offset]) == NodeType::Hash) {
+        for (u32 i = 0; i < numItems; ++i) {
+          const u32 itemOffset = util::getHashItemOffset(offset, i);
+          const auto type = NodeType(data[itemOffset + 3]);
+          writer.writeU24(itemOffset, keyIndices[br.readU24(itemOffset)]);
+          writer.write<u32>(itemOffset + 4, relocate(type, br.template read<u32>(itemOffset + 4)));
+        }
+      } else {
+        const u32 typesOffset = util::getArrayTypesOffset(offset);
+        const u32 valuesOffset = util::getArrayValuesOffset(offset, numItems);
+        for (u32 i = 0; i < numItems; ++i) {
+          const auto type = NodeType(data[typesOffset + i]);
+          const u32 valueOffset = valuesOffset + 4 * i;
+          writer.write<u32>(valueOffset, relocate(type, br.template read<u32>(valueOffset)));
+        }
+      }
+    }
+  });
+
+  return data;
+}
+
+Writer::Writer(u16 version, bool bigEndian) : mImpl{std::make_unique<Impl>(version, bigEndian)} {}
+
+Writer::~Writer() = default;
+
+Writer::Writer(Writer&&) noexcept = default;
+
+Writer& Writer::operator=(Writer&&) noexcept = default;
+
+void Writer::setKey(std::string_view key) {
+  mImpl->setKey(key);
+}
+
+void Writer::beginArray() {
+  mImpl->begin(NodeType::Array);
+}
+
+void Writer::beginHash() {
+  mImpl->begin(NodeType::Hash);
+}
+
+void Writer::end() {
+  mImpl->end();
+}
+
+std::optional<u32> Writer::endContainer() {
+  return mImpl->end();
+}
+
+void Writer::addContainer(NodeType type, u32 offset) {
+  mImpl->addItem(type, offset);
+}
+
+void Writer::addString(std::string_view value) {
+  if (std::memchr(value.data(), 0, value.size()) || mImpl->strings.size() >= MaxNumItems) {
+    mImpl->fail();
+    return;
+  }
+  mImpl->addItem(NodeType::String, mImpl->strings.add(mImpl->arena, value));
+}
+
+void Writer::addBool(bool value) {
+  mImpl->addItem(NodeType::Bool, value);
+}
+
+void Writer::addInt(s32 value) {
+  mImpl->addItem(NodeType::Int, static_cast<u32>(value));
+}
+
+void Writer::addUInt(u32 value) {
+  mImpl->addItem(NodeType::UInt, value);
+}
+
+void Writer::addFloat(f32 value) {
+  u32 raw;
+  std::memcpy(&raw, &value, sizeof(raw));
+  mImpl->addItem(NodeType::Float, raw);
+}
+
+void Writer::addInt64(s64 value) {
+  mImpl->add64BitValue(NodeType::Int64, static_cast<u64>(value));
+}
+
+void Writer::addUInt64(u64 value) {
+  mImpl->add64BitValue(NodeType::UInt64, value);
+}
+
+void Writer::addDouble(f64 value) {
+  u64 raw;
+  std::memcpy(&raw, &value, sizeof(raw));
+  mImpl->add64BitValue(NodeType::Double, raw);
+}
+
+void Writer::addNull() {
+  mImpl->addItem(NodeType::Null, 0);
+}
+
+void Writer::add(const ItemData& item) {
+  // Containers are copied iteratively so that deeply nested documents cannot overflow the stack.
+  struct Frame {
+    const u8* source;
+    std::optional<Array> array;
+    std::optional<Hash> hash;
+    u32 nextItem;
+  };
+  std::vector<Frame> stack;
+  // Containers that are referenced several times in the source document are only copied once.
+  std::unordered_map<const u8*, u32> copiedContainers;
+  // Documents that have not been validated may contain cycles.
+  const bool checkCycles = item.reader.isCheckedAccessEnabled();
+  std::unordered_set<const u8*> inProgress;
+
+  const auto copyNode = [&](const ItemData& node) {
+    switch (node.raw.type) {
+    case NodeType::Array:
+    case NodeType::MonoTypedArray:
+    case NodeType::Hash: {
+      // Monotyped arrays are written as regular arrays.
+      const NodeType type = node.raw.type == NodeType::Hash ? NodeType::Hash : NodeType::Array;
+      const u8* source = node.reader.getBuffer().data() + node.raw;
+      // This checks the container (including its type) if checked access is enabled,
+      // so it must be done before looking for a copied container.
+      auto array = node.getArray();
+      auto hash = node.getHash();
+      if (!array && !hash) {
+        mImpl->fail();
+        return;
+      }
+      const auto it = copiedContainers.find(source);
+      if (it != copiedContainers.end()) {
+        mImpl->addItem(type, it->second);
+        return;
+      }
+      if (checkCycles && !inProgress.insert(source).second) {
+        mImpl->fail();
+        return;
+      }
+      mImpl->begin(type);
+      stack.push_back({source, std::move(array), std::move(hash), 0});
+      return;
+    }
+    case NodeType::String:
+      if (const char* string = node.getString())
+        addString(string);
+      else
+        mImpl->fail();
+      return;
+    case NodeType::Bool:
+    case NodeType::Int:
+    case NodeType::UInt:
+    case NodeType::Float:
+      mImpl->addItem(node.raw.type, node.raw);
+      return;
+    case NodeType::Int64:
+      addInt64(*node.getInt64());
+      return;
+    case NodeType::UInt64:
+      addUInt64(*node.getUInt64());
+      return;
+    case NodeType::Double:
+      addDouble(*node.getDouble());
+      return;
+    case NodeType::Null:
+      addNull();
+      return;
+    default:
+      mImpl->fail();
+      return;
+    }
+  };
+
+  copyNode(item);
+  while (!stack.empty() && mImpl->ok) {
+    Frame& frame = stack.back();
+    const size_t numItems = frame.array ? frame.array->numItems() : frame.hash->numItems();
+    if (frame.nextItem == numItems) {
+      if (const auto offset = mImpl->end())
+        copiedContainers.emplace(frame.source, *offset);
+      inProgress.erase(frame.source);
+      stack.pop_back();
+      continue;
+    }
+
+    const u32 idx = frame.nextItem++;
+    if (frame.array) {
+      copyNode((*frame.array)[idx]);
+    } else {
+      const HashItem child = *frame.hash->getByIndex(idx);
+      setKey(child.name);
+      copyNode(child.data);
+    }
+  }
+}
+
+bool Writer::isOk() const {
+  return mImpl->ok;
+}
+
+std::optional<std::vector<u8>> Writer::finish() const {
+  return mImpl->finish();
+}
+
+std::optional<std::vector<u8>> Writer::write(const Reader& reader, u16 version, bool bigEndian) {
+  Writer writer{version, bigEndian};
+  if (reader.isHash32())
+    return {};
+  if (reader.isHash()) {
+    const auto hash = reader.getHash();
+    if (!hash)
+      return {};
+    writer.add(ItemData{reader, {hash->getOffset(), NodeType::Hash}});
+  } else if (reader.isArray()) {
+    const auto array = reader.getArray();
+    if (!array)
+      return {};
+    writer.add(ItemData{reader, {array->getOffset(), array->getNodeType()}});
+  }
+  return writer.finish();
+}
+
+}  // namespace byml
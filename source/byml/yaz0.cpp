@@ -0,0 +1,139 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+
+#include "byml/yaz0.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "common/binary_reader.h"
+#include "common/log.h"
+
+namespace byml::yaz0 {
+
+bool isCompressed(Buffer data) {
+  return data.size() >= sizeof(Header) && std::memcmp(data.data(), "Yaz0", 4) == 0;
+}
+
+std::optional<u32> getDecompressedSize(Buffer data) {
+  if (!isCompressed(data))
+    return {};
+  const u32 size = common::BinaryReader{data, true}.read<u32>(offsetof(Header, uncompressedSize));
+  // A chunk expands to at most 0x111 bytes and is encoded in at least 3 bytes.
+  constexpr u64 MaxExpansionRatio = 0x111 / 3 + 1;
+  if (size > u64(data.size() - sizeof(Header)) * MaxExpansionRatio) {
+    ERR_LOG("Invalid Yaz0 header: decompressed size 0x{:x} is too large", size);
+    return {};
+  }
+  return size;
+}
+
+bool decompress(Buffer src, u8* dst, size_t dstSize) {
+  return Decoder{src, dst, dstSize}.decodeAll();
+}
+
+Decoder::Decoder(Buffer src, u8* dst, size_t dstSize) : mSrc{src}, mDst{dst}, mDstSize{0} {
+  const auto size = getDecompressedSize(src);
+  if (!size || dstSize < *size) {
+    ERR_LOG("Invalid Yaz0 header or destination buffer is too small");
+    mError = true;
+    return;
+  }
+  mDstSize = *size;
+}
+
+namespace {
+/// Copy a back-reference. The source and destination may overlap when dist < size.
+/// `room` is the number of bytes that may be written at `out`.
+inline void copyBackReference(u8* out, size_t dist, size_t size, size_t room) {
+  const u8* in = out - dist;
+  if (dist >= 8 && size + 8 <= room) {
+    // Each 8-byte block only reads bytes that have already been written, so the copy can be done
+    // in blocks. The last block may write past the end of the match; this is fine because those
+    // bytes are overwritten by the next chunks.
+    for (size_t i = 0; i < size; i += 8)
+      std::memcpy(out + i, in + i, 8);
+    return;
+  }
+  for (size_t i = 0; i < size; ++i)
+    out[i] = in[i];
+}
+}  // end of anonymous namespace
+
+bool Decoder::decodeUntil(size_t size) {
+  if (mError)
+    return false;
+
+  const u8* src = mSrc.data();
+  const size_t srcSize = mSrc.size();
+  u8* dst = mDst;
+  const size_t end = std::min(size, mDstSize);
+
+  size_t srcPos = mSrcPos;
+  size_t dstPos = mDstPos;
+  u8 groupHeader = mGroupHeader;
+  int chunksLeft = mGroupChunksLeft;
+
+  while (dstPos < end) {
+    if (chunksLeft == 0) {
+      if (srcPos >= srcSize)
+        break;
+      groupHeader = src[srcPos++];
+      chunksLeft = 8;
+
+      // Fast path for groups that only contain literals, which are common in string tables.
+      if (groupHeader == 0xff && srcPos + 8 <= srcSize && dstPos + 8 <= mDstSize) {
+        std::memcpy(dst + dstPos, src + srcPos, 8);
+        srcPos += 8;
+        dstPos += 8;
+        chunksLeft = 0;
+        continue;
+      }
+    }
+
+    if (groupHeader & 0x80) {
+      if (srcPos >= srcSize)
+        break;
+      dst[dstPos++] = src[srcPos++];
+    } else {
+      if (srcPos + 2 > srcSize)
+        break;
+      const u32 b1 = src[srcPos++];
+      const u32 b2 = src[srcPos++];
+      const size_t dist = (((b1 & 0xf) << 8) | b2) + 1;
+      size_t length = b1 >> 4;
+      if (length == 0) {
+        if (srcPos >= srcSize)
+          break;
+        length = src[srcPos++] + 0x12;
+      } else {
+        length += 2;
+      }
+
+      if (dstPos < dist || mDstSize - dstPos < length) {
+        ERR_LOG("Invalid back-reference at 0x{:x}: dist={} length={}", srcPos, dist, length);
+        mError = true;
+        return false;
+      }
+      copyBackReference(dst + dstPos, dist, length, mDstSize - dstPos);
+      dstPos += length;
+    }
+
+    groupHeader <<= 1;
+    --chunksLeft;
+  }
+
+  mSrcPos = srcPos;
+  mDstPos = dstPos;
+  mGroupHeader = groupHeader;
+  mGroupChunksLeft = chunksLeft;
+
+  if (dstPos < end) {
+    ERR_LOG("Unexpected end of compressed data at 0x{:x}", srcPos);
+    mError = true;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace byml::yaz0
@@ -0,0 +1,77 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "byml/types.h"
+#include "common/align.h"
+
+namespace byml::common {
+
+/// Bump allocator. Memory is allocated from large blocks and only released when the arena
+/// is destroyed (or reset), all at once. Destructors of objects created in an arena are not run,
+/// so only trivially destructible objects (or objects whose memory is entirely arena-owned)
+/// should be created in it.
+class Arena final {
+public:
+  explicit Arena(size_t blockSize = 64 * 1024) : mBlockSize{blockSize} {}
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+  Arena(Arena&&) = default;
+  Arena& operator=(Arena&&) = default;
+
+  void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+    size_t padding = (alignment - reinterpret_cast<uintptr_t>(mCurrent) % alignment) % alignment;
+    if (!mCurrent || mRemaining < size + padding) {
+      addBlock(size + alignment);
+      padding = (alignment - reinterpret_cast<uintptr_t>(mCurrent) % alignment) % alignment;
+    }
+    u8* ptr = mCurrent + padding;
+    mCurrent += padding + size;
+    mRemaining -= padding + size;
+    return ptr;
+  }
+
+  template <typename T, typename... Args>
+  T* create(Args&&... args) {
+    return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+  }
+
+  /// Copy a string into the arena. The copy is null terminated.
+  std::string_view copyString(std::string_view string) {
+    char* data = static_cast<char*>(allocate(string.size() + 1, 1));
+    std::memcpy(data, string.data(), string.size());
+    data[string.size()] = '\0';
+    return {data, string.size()};
+  }
+
+  /// Free all allocations.
+  void reset() {
+    mBlocks.clear();
+    mCurrent = nullptr;
+    mRemaining = 0;
+  }
+
+private:
+  void addBlock(size_t minSize) {
+    const size_t size = std::max(mBlockSize, minSize);
+    mBlocks.emplace_back(new u8[size]);
+    mCurrent = mBlocks.back().get();
+    mRemaining = size;
+  }
+
+  std::vector<std::unique_ptr<u8[]>> mBlocks;
+  u8* mCurrent = nullptr;
+  size_t mRemaining = 0;
+  size_t mBlockSize;
+};
+
+}  // namespace byml::common
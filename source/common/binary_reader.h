@@ -8,17 +8,16 @@
 #include "byml/types.h"
 #include "common/swap.h"
 
-#ifdef _WIN32
-byml::u32 htonl(byml::u32);
-#else
-#include <arpa/inet.h>
-#endif
-
 namespace byml::common {
 
 namespace detail {
-inline bool isBigEndianPlatform() {
-  return htonl(0x12345678) == 0x12345678;
+constexpr bool isBigEndianPlatform() {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return true;
+#else
+  // MSVC only targets little endian platforms.
+  return false;
+#endif
 }
 
 template <typename T>
@@ -59,4 +58,51 @@ private:
   bool mBigEndian = false;
 };
 
+/// Same as BinaryReader, but the byte order is known at compile time so that reads compile
+/// to plain loads (or loads followed by a byteswap) without any runtime check.
+/// Has the same interface as BinaryReader, so code that is templated on the reader type
+/// works with both.
+template <bool BigEndian>
+class StaticBinaryReader final {
+public:
+  explicit StaticBinaryReader(const u8* data) : mData{data} {}
+
+  static constexpr bool isBigEndian() { return BigEndian; }
+  const u8* data() const { return mData; }
+
+  template <typename T>
+  T read(size_t offset) const {
+    T value;
+    std::memcpy(&value, &mData[offset], sizeof(T));
+    if constexpr (detail::isBigEndianPlatform() != BigEndian)
+      value = SwapValue(value);
+    return value;
+  }
+
+  u32 readU24(size_t offset) const {
+    if constexpr (BigEndian)
+      return mData[offset] << 16 | mData[offset + 1] << 8 | mData[offset + 2];
+    return mData[offset + 2] << 16 | mData[offset + 1] << 8 | mData[offset];
+  }
+
+  const char* getString(size_t offset) const {
+    return reinterpret_cast<const char*>(&mData[offset]);
+  }
+
+private:
+  const u8* mData = nullptr;
+};
+
+using BigEndianReader = StaticBinaryReader<true>;
+using LittleEndianReader = StaticBinaryReader<false>;
+
+/// Call `fn` with a StaticBinaryReader for the specified byte order.
+/// This is used to pick the byte order once before entering hot code.
+template <typename Fn>
+decltype(auto) withStaticReader(const u8* data, bool bigEndian, Fn&& fn) {
+  if (bigEndian)
+    return fn(BigEndianReader{data});
+  return fn(LittleEndianReader{data});
+}
+
 }  // namespace byml::common
@@ -0,0 +1,45 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+
+#pragma once
+
+#include <cstring>
+
+#include "byml/types.h"
+#include "common/binary_reader.h"
+#include "common/swap.h"
+
+namespace byml::common {
+
+/// Counterpart of BinaryReader: writes values with the specified byte order.
+class BinaryWriter final {
+public:
+  BinaryWriter(u8* data, bool bigEndian) : mData{data}, mBigEndian{bigEndian} {}
+
+  bool isBigEndian() const { return mBigEndian; }
+  u8* data() const { return mData; }
+
+  template <typename T>
+  void write(size_t offset, T value) const {
+    value = detail::swapIfNeeded(value, mBigEndian);
+    std::memcpy(&mData[offset], &value, sizeof(T));
+  }
+
+  void writeU24(size_t offset, u32 value) const {
+    if (mBigEndian) {
+      mData[offset] = u8(value >> 16);
+      mData[offset + 1] = u8(value >> 8);
+      mData[offset + 2] = u8(value);
+    } else {
+      mData[offset] = u8(value);
+      mData[offset + 1] = u8(value >> 8);
+      mData[offset + 2] = u8(value >> 16);
+    }
+  }
+
+private:
+  u8* mData = nullptr;
+  bool mBigEndian = false;
+};
+
+}  // namespace byml::common
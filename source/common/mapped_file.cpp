@@ -0,0 +1,76 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+
+#include "common/mapped_file.h"
+
+#ifdef _WIN32
+#include <fstream>
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace byml::common {
+
+#ifdef _WIN32
+std::shared_ptr<const MappedFile> MappedFile::open(const std::string& path) {
+  std::ifstream stream{path, std::ios::binary};
+  if (!stream)
+    return nullptr;
+
+  stream.seekg(0, std::ios::end);
+  const auto size = static_cast<size_t>(stream.tellg());
+  stream.seekg(0, std::ios::beg);
+
+  std::shared_ptr<MappedFile> file{new MappedFile};
+  u8* data = new u8[size];
+  file->mData = data;
+  file->mSize = size;
+  if (!stream.read(reinterpret_cast<char*>(data), size))
+    return nullptr;
+  return file;
+}
+
+MappedFile::~MappedFile() {
+  delete[] mData;
+}
+#else
+std::shared_ptr<const MappedFile> MappedFile::open(const std::string& path) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return nullptr;
+
+  std::shared_ptr<MappedFile> file;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    file.reset(new MappedFile);
+    file->mSize = static_cast<size_t>(st.st_size);
+    // Empty files cannot be mapped. Leave the data pointer null; the reader rejects them anyway.
+    if (file->mSize != 0) {
+      void* ptr = mmap(nullptr, file->mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (ptr != MAP_FAILED) {
+        file->mData = static_cast<const u8*>(ptr);
+        file->mIsMapped = true;
+        // Validation follows offsets all over the file and ends up touching every page,
+        // so ask the kernel to start reading the whole file in right away.
+        madvise(ptr, file->mSize, MADV_WILLNEED);
+      } else {
+        file.reset();
+      }
+    }
+  }
+
+  ::close(fd);
+  return file;
+}
+
+MappedFile::~MappedFile() {
+  if (mIsMapped)
+    munmap(const_cast<u8*>(mData), mSize);
+}
+#endif
+
+}  // namespace byml::common
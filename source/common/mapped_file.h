@@ -0,0 +1,36 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "byml/types.h"
+
+namespace byml::common {
+
+/// Read-only view of an entire file. On POSIX systems the file is memory-mapped;
+/// elsewhere its contents are read into memory.
+class MappedFile final {
+public:
+  /// Open and map a file. Returns nullptr if the file cannot be opened or mapped.
+  static std::shared_ptr<const MappedFile> open(const std::string& path);
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile();
+
+  const u8* data() const { return mData; }
+  size_t size() const { return mSize; }
+
+private:
+  MappedFile() = default;
+
+  const u8* mData = nullptr;
+  size_t mSize = 0;
+  /// Whether mData points to a mapping (as opposed to heap memory).
+  bool mIsMapped = false;
+};
+
+}  // namespace byml::common
@@ -0,0 +1,117 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+
+#include "byml/types.h"
+#include "common/swap.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define BYML_USE_AVX2 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define BYML_USE_SSE2 1
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace byml::common {
+
+/// Returns the index of the lowest set bit. value must not be 0.
+inline unsigned countTrailingZeros(u64 value) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward64(&index, value);
+  return index;
+#else
+  return __builtin_ctzll(value);
+#endif
+}
+
+/// Returns a mask with bit i set iff data[i] is 0, for the 64 bytes at data.
+inline u64 findZeroBytes64(const u8* data) {
+#if defined(BYML_USE_AVX2)
+  const __m256i zero = _mm256_setzero_si256();
+  const auto mask32 = [&](size_t i) {
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    return u64(u32(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero))));
+  };
+  return mask32(0) | mask32(32) << 32;
+#elif defined(BYML_USE_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+  const auto mask16 = [&](size_t i) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    return u64(u32(_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero))));
+  };
+  return mask16(0) | mask16(16) << 16 | mask16(32) << 32 | mask16(48) << 48;
+#else
+  u64 mask = 0;
+  for (size_t i = 0; i < 64; ++i)
+    mask |= u64(data[i] == 0) << i;
+  return mask;
+#endif
+}
+
+/// Returns whether all `size` bytes at data are equal to value.
+inline bool allBytesEqual(const u8* data, size_t size, u8 value) {
+  size_t i = 0;
+#if defined(BYML_USE_AVX2)
+  const __m256i expected = _mm256_set1_epi8(char(value));
+  for (; i + 32 <= size; i += 32) {
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    if (u32(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, expected))) != 0xffffffff)
+      return false;
+  }
+#elif defined(BYML_USE_SSE2)
+  const __m128i expected = _mm_set1_epi8(char(value));
+  for (; i + 16 <= size; i += 16) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, expected)) != 0xffff)
+      return false;
+  }
+#endif
+  for (; i < size; ++i) {
+    if (data[i] != value)
+      return false;
+  }
+  return true;
+}
+
+/// Copy `count` 32-bit words from src to dst, reversing the byte order of each word.
+/// The buffers may be unaligned but must not overlap.
+inline void byteswap32(void* dst, const void* src, size_t count) {
+  auto* out = static_cast<u8*>(dst);
+  const auto* in = static_cast<const u8*>(src);
+  size_t i = 0;
+#if defined(BYML_USE_AVX2)
+  const __m256i shuffle = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                           3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  for (; i + 8 <= count; i += 8) {
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + 4 * i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 4 * i), _mm256_shuffle_epi8(v, shuffle));
+  }
+#elif defined(BYML_USE_SSE2)
+  for (; i + 4 <= count; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 4 * i));
+    // Swap the bytes of each 16-bit half, then swap the halves.
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4 * i), v);
+  }
+#endif
+  for (; i < count; ++i) {
+    u32 value;
+    std::memcpy(&value, in + 4 * i, sizeof(value));
+    value = swap32(value);
+    std::memcpy(out + 4 * i, &value, sizeof(value));
+  }
+}
+
+}  // namespace byml::common
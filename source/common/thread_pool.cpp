@@ -0,0 +1,142 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+
+#include "common/thread_pool.h"
+
+#include <utility>
+
+namespace byml::common {
+
+namespace {
+/// Pool and queue index of the current worker thread, if any.
+thread_local const ThreadPool* tCurrentPool = nullptr;
+thread_local unsigned tCurrentIndex = 0;
+}  // end of anonymous namespace
+
+unsigned ThreadPool::getDefaultNumThreads() {
+  const unsigned num = std::thread::hardware_concurrency();
+  return num == 0 ? 1 : num;
+}
+
+ThreadPool::ThreadPool(unsigned numThreads) {
+  if (numThreads == 0)
+    numThreads = getDefaultNumThreads();
+
+  for (unsigned i = 0; i < numThreads; ++i)
+    mQueues.emplace_back(std::make_unique<Queue>());
+  for (unsigned i = 0; i < numThreads; ++i)
+    mWorkers.emplace_back(&ThreadPool::workerMain, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+  try {
+    wait();
+  } catch (...) {
+    // Exceptions can only be reported by an explicit call to wait().
+  }
+  {
+    std::lock_guard<std::mutex> lock{mMutex};
+    mStop = true;
+  }
+  mWorkAvailableCv.notify_all();
+  for (std::thread& worker : mWorkers)
+    worker.join();
+}
+
+void ThreadPool::submit(Task task) {
+  const unsigned index = tCurrentPool == this ? tCurrentIndex : mNextQueue++ % numThreads();
+
+  mNumPending++;
+  {
+    Queue& queue = *mQueues[index];
+    std::lock_guard<std::mutex> lock{queue.mutex};
+    queue.tasks.emplace_back(std::move(task));
+    mNumQueued++;
+  }
+
+  // Taking the lock ensures that a worker (or a thread in wait()) cannot miss the notification
+  // between checking mNumQueued and going to sleep.
+  { std::lock_guard<std::mutex> lock{mMutex}; }
+  mWorkAvailableCv.notify_one();
+  // The thread that is waiting for the pool also runs tasks.
+  mIdleCv.notify_one();
+}
+
+void ThreadPool::wait() {
+  Task task;
+  while (true) {
+    if (getTask(0, &task)) {
+      runTask(task);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock{mMutex};
+    mIdleCv.wait(lock, [this] { return mNumPending == 0 || mNumQueued != 0; });
+    if (mNumPending == 0) {
+      if (mException)
+        std::rethrow_exception(std::exchange(mException, nullptr));
+      return;
+    }
+  }
+}
+
+void ThreadPool::workerMain(unsigned index) {
+  tCurrentPool = this;
+  tCurrentIndex = index;
+
+  Task task;
+  while (true) {
+    if (getTask(index, &task)) {
+      runTask(task);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock{mMutex};
+    mWorkAvailableCv.wait(lock, [this] { return mStop || mNumQueued != 0; });
+    if (mStop && mNumQueued == 0)
+      return;
+  }
+}
+
+bool ThreadPool::getTask(unsigned index, Task* task) {
+  if (mNumQueued == 0)
+    return false;
+
+  const unsigned numQueues = numThreads();
+  for (unsigned i = 0; i < numQueues; ++i) {
+    Queue& queue = *mQueues[(index + i) % numQueues];
+    std::lock_guard<std::mutex> lock{queue.mutex};
+    if (queue.tasks.empty())
+      continue;
+
+    // Take the newest task from the worker's own queue and steal the oldest from other queues.
+    if (i == 0) {
+      *task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    } else {
+      *task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    }
+    mNumQueued--;
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::runTask(Task& task) {
+  // Exceptions must not escape from worker threads (which would terminate the program).
+  try {
+    task();
+  } catch (...) {
+    std::lock_guard<std::mutex> lock{mMutex};
+    if (!mException)
+      mException = std::current_exception();
+  }
+  task = nullptr;
+  if (--mNumPending == 0) {
+    { std::lock_guard<std::mutex> lock{mMutex}; }
+    mIdleCv.notify_all();
+  }
+}
+
+}  // namespace byml::common
@@ -0,0 +1,74 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace byml::common {
+
+/// Fixed-size thread pool with one task queue per worker and work stealing.
+///
+/// Tasks that are submitted from a worker thread are pushed to that worker's own queue and
+/// run in LIFO order, which keeps related work on the same thread. Idle workers steal
+/// the oldest tasks from other queues.
+class ThreadPool final {
+public:
+  using Task = std::function<void()>;
+
+  /// Create a pool. If numThreads is 0, one worker is started per hardware thread.
+  explicit ThreadPool(unsigned numThreads = 0);
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+  ~ThreadPool();
+
+  unsigned numThreads() const { return static_cast<unsigned>(mWorkers.size()); }
+  /// Returns whether there are tasks waiting to be picked up. Tasks can use this to decide
+  /// whether splitting their work is worthwhile.
+  bool hasQueuedTasks() const { return mNumQueued != 0; }
+
+  /// Schedule a task. Tasks may submit more tasks.
+  void submit(Task task);
+  /// Wait for all submitted tasks (including tasks submitted by them) to complete.
+  /// The calling thread runs tasks while it waits. Must not be called from a task.
+  /// If a task threw an exception, the first one is rethrown once all tasks have completed.
+  void wait();
+
+  static unsigned getDefaultNumThreads();
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void workerMain(unsigned index);
+  /// Pop a task from the specified queue, or steal one from another queue.
+  bool getTask(unsigned index, Task* task);
+  void runTask(Task& task);
+
+  std::vector<std::unique_ptr<Queue>> mQueues;
+  std::vector<std::thread> mWorkers;
+  std::atomic<unsigned> mNextQueue{0};
+
+  /// Number of tasks that are waiting in a queue.
+  std::atomic<size_t> mNumQueued{0};
+  /// Number of tasks that have been submitted but not completed.
+  std::atomic<size_t> mNumPending{0};
+  std::mutex mMutex;
+  std::condition_variable mWorkAvailableCv;
+  std::condition_variable mIdleCv;
+  bool mStop = false;
+  /// First exception that was thrown by a task since the last wait() (protected by mMutex).
+  std::exception_ptr mException;
+};
+
+}  // namespace byml::common
@@ -0,0 +1,209 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <byml/byml.h>
+#include <byml/writer.h>
+
+namespace {
+
+constexpr const char* Usage = R"(Usage: byml-bench [options] [file...]
+
+Measures the time it takes to iterate over, look up keys in and validate BYML documents,
+in little endian and in big endian byte order. Each document is converted to the other byte
+order (versions 2 and 3 only). Without files, a synthetic document with 40000 objects is used.
+
+Options:
+  -n, --runs N   number of runs per benchmark; the median time is printed (default: 10)
+)";
+
+using Clock = std::chrono::steady_clock;
+
+/// Prevents the compiler from optimizing away the benchmarked code.
+volatile byml::u64 gSink;
+
+std::vector<byml::u8> makeSyntheticDocument(bool bigEndian) {
+  byml::Writer writer{2, bigEndian};
+  writer.beginHash();
+  writer.setKey("Objs");
+  writer.beginArray();
+  for (int i = 0; i < 40000; ++i) {
+    writer.beginHash();
+    writer.setKey("UnitConfigName");
+    writer.addString("Obj" + std::to_string(i % 500));
+    writer.setKey("HashId");
+    writer.addUInt(0x10000000 + i);
+    writer.setKey("Translate");
+    writer.beginArray();
+    writer.addFloat(i * 0.5f);
+    writer.addFloat(0);
+    writer.addFloat(-i * 0.25f);
+    writer.end();
+    writer.setKey("!Parameters");
+    writer.beginHash();
+    writer.setKey("IsEnabled");
+    writer.addBool(i % 3 != 0);
+    writer.setKey("Level");
+    writer.addInt(i % 10);
+    writer.end();
+    writer.end();
+  }
+  writer.end();
+  writer.end();
+  return *writer.finish();
+}
+
+/// Visit every node of the document (shared containers are visited once per reference).
+byml::u64 walk(const byml::Reader& reader) {
+  byml::u64 sum = 0;
+  std::vector<byml::ItemData> stack;
+  if (const auto root = reader.getRoot())
+    stack.push_back(*root);
+  while (!stack.empty()) {
+    const byml::ItemData item = stack.back();
+    stack.pop_back();
+    sum += item.raw.raw;
+    if (const auto array = item.getArray()) {
+      for (size_t i = 0; i < array->numItems(); ++i)
+        stack.push_back((*array)[i]);
+    } else if (const auto hash = item.getHash()) {
+      for (size_t i = 0; i < hash->numItems(); ++i)
+        stack.push_back(hash->getByIndex(i)->data);
+    } else if (const auto hash32 = item.getHash32()) {
+      for (size_t i = 0; i < hash32->numItems(); ++i)
+        stack.push_back(hash32->getByIndex(i)->data);
+    }
+  }
+  return sum;
+}
+
+/// All hashes of a document, with their keys.
+std::vector<std::pair<byml::Hash, std::vector<const char*>>> collectHashes(
+    const byml::Reader& reader) {
+  std::vector<std::pair<byml::Hash, std::vector<const char*>>> hashes;
+  std::vector<byml::ItemData> stack;
+  if (const auto root = reader.getRoot())
+    stack.push_back(*root);
+  while (!stack.empty()) {
+    const byml::ItemData item = stack.back();
+    stack.pop_back();
+    if (const auto array = item.getArray()) {
+      for (size_t i = 0; i < array->numItems(); ++i)
+        stack.push_back((*array)[i]);
+    } else if (const auto hash = item.getHash()) {
+      std::vector<const char*> keys;
+      for (size_t i = 0; i < hash->numItems(); ++i) {
+        const auto child = hash->getByIndex(i);
+        keys.push_back(child->name);
+        stack.push_back(child->data);
+      }
+      hashes.emplace_back(*hash, std::move(keys));
+    }
+  }
+  return hashes;
+}
+
+double runBenchmark(int numRuns, const std::function<byml::u64()>& fn) {
+  std::vector<double> times;
+  for (int i = 0; i < numRuns; ++i) {
+    const auto start = Clock::now();
+    gSink = fn();
+    times.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+  }
+  std::sort(times.begin(), times.end());
+  return times[times.size() / 2];
+}
+
+void benchmarkDocument(const std::string& name, const byml::Reader& reader, int numRuns) {
+  const auto hashes = collectHashes(reader);
+  const char* byteOrder = reader.isBigEndian() ? "BE" : "LE";
+  const auto print = [&](const char* benchmark, double ms) {
+    std::printf("%-32s %s  %-16s %10.3f ms\n", name.c_str(), byteOrder, benchmark, ms);
+  };
+
+  print("iterate", runBenchmark(numRuns, [&] { return walk(reader); }));
+  print("lookup (key)", runBenchmark(numRuns, [&] {
+          byml::u64 sum = 0;
+          for (const auto& [hash, keys] : hashes) {
+            for (const char* key : keys)
+              sum += hash.getByKey(key)->raw.raw;
+          }
+          return sum;
+        }));
+  print("lookup (key ID)", runBenchmark(numRuns, [&] {
+          byml::u64 sum = 0;
+          for (const auto& [hash, keys] : hashes) {
+            for (size_t i = 0; i < keys.size(); ++i)
+              sum += hash.getByKey(*hash.getKeyIdByIndex(i))->raw.raw;
+          }
+          return sum;
+        }));
+  print("validate", runBenchmark(numRuns, [&] { return byml::u64(reader.isValid()); }));
+}
+
+}  // end of anonymous namespace
+
+int main(int argc, char** argv) {
+  int numRuns = 10;
+  std::vector<std::string> paths;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "-n" || arg == "--runs") {
+      if (i + 1 >= argc) {
+        std::fprintf(stderr, "error: missing value for %s\n", arg.c_str());
+        return 1;
+      }
+      numRuns = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "-h" || arg == "--help") {
+      std::fputs(Usage, stdout);
+      return 0;
+    } else if (!arg.empty() && arg[0] == '-') {
+      std::fprintf(stderr, "error: unknown option %s\n\n%s", arg.c_str(), Usage);
+      return 1;
+    } else {
+      paths.push_back(arg);
+    }
+  }
+
+  if (paths.empty()) {
+    for (const bool bigEndian : {false, true}) {
+      const std::vector<byml::u8> data = makeSyntheticDocument(bigEndian);
+      const byml::Reader reader{byml::Buffer{data.data(), data.size()}};
+      benchmarkDocument("(synthetic)", reader, numRuns);
+    }
+    return 0;
+  }
+
+  int status = 0;
+  for (const std::string& path : paths) {
+    const auto reader = byml::Reader::openFile(path);
+    if (!reader || !reader->isValid()) {
+      std::fprintf(stderr, "error: %s: failed to load\n", path.c_str());
+      status = 2;
+      continue;
+    }
+    benchmarkDocument(path, *reader, numRuns);
+
+    if (reader->getVersion() > 3)
+      continue;
+    const auto swapped =
+        byml::Writer::write(*reader, reader->getVersion(), !reader->isBigEndian());
+    if (!swapped) {
+      std::fprintf(stderr, "error: %s: failed to convert\n", path.c_str());
+      status = 2;
+      continue;
+    }
+    const byml::Reader swappedReader{byml::Buffer{swapped->data(), swapped->size()}};
+    benchmarkDocument(path, swappedReader, numRuns);
+  }
+  return status;
+}
@@ -0,0 +1,147 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <byml/scan.h>
+#include <byml/string_index.h>
+
+namespace {
+
+constexpr const char* Usage = R"(Usage: byml-index update [options] <index> <path>...
+       byml-index find <index> <string>...
+       byml-index prefix <index> <prefix>
+
+update  Builds an index of the hash keys and string values used by the BYML documents in
+        directory trees (or files). If the index exists, only the files that were added or
+        modified since it was last updated are scanned.
+find    Prints the files that use each string, and whether the string is used as a key,
+        as a value or both.
+prefix  Prints the indexed strings that start with a prefix.
+
+Update options:
+  -j, --threads N     number of worker threads (default: one per hardware thread)
+      --all-files     scan all files instead of only files with BYML extensions
+      --no-validate   use checked access instead of validating documents
+)";
+
+using Clock = std::chrono::steady_clock;
+
+double microsecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+int update(const std::vector<std::string>& args) {
+  byml::ScanOptions options;
+  std::vector<std::string> positional;
+  for (size_t i = 0; i < args.size(); ++i) {
+    const std::string& arg = args[i];
+    if (arg == "-j" || arg == "--threads") {
+      if (i + 1 >= args.size()) {
+        std::fprintf(stderr, "error: missing value for %s\n", arg.c_str());
+        return 1;
+      }
+      options.numThreads = static_cast<unsigned>(std::strtoul(args[++i].c_str(), nullptr, 10));
+    } else if (arg == "--all-files") {
+      options.extensions.clear();
+    } else if (arg == "--no-validate") {
+      options.validate = false;
+    } else if (!arg.empty() && arg[0] == '-') {
+      std::fprintf(stderr, "error: unknown option %s\n\n%s", arg.c_str(), Usage);
+      return 1;
+    } else {
+      positional.push_back(arg);
+    }
+  }
+  if (positional.size() < 2) {
+    std::fputs(Usage, stderr);
+    return 1;
+  }
+
+  const std::vector<std::string> roots(positional.begin() + 1, positional.end());
+  byml::StringIndexUpdateStats stats;
+  if (!byml::updateStringIndex(positional[0], roots, options, &stats)) {
+    std::fprintf(stderr, "error: failed to write %s\n", positional[0].c_str());
+    return 1;
+  }
+  for (const byml::ScanFileReport& file : stats.report.files) {
+    if (file.status != byml::ScanStatus::Ok)
+      std::fprintf(stderr, "error: %s: failed to load\n", file.path.c_str());
+  }
+  std::fprintf(stderr, "%zu files scanned (%.1f MiB in %.3f s), %zu unchanged, %zu removed\n",
+               stats.numScanned, stats.report.totalSize() / 1048576.0, stats.report.seconds,
+               stats.numReused, stats.numRemoved);
+  return stats.report.numFailed() == 0 ? 0 : 2;
+}
+
+std::optional<byml::StringIndex> openIndex(const std::string& path) {
+  auto index = byml::StringIndex::open(path);
+  if (!index)
+    std::fprintf(stderr, "error: %s is not a valid index\n", path.c_str());
+  return index;
+}
+
+int find(const std::vector<std::string>& args) {
+  if (args.size() < 2) {
+    std::fputs(Usage, stderr);
+    return 1;
+  }
+  const auto index = openIndex(args[0]);
+  if (!index)
+    return 1;
+
+  for (size_t i = 1; i < args.size(); ++i) {
+    const auto start = Clock::now();
+    const std::vector<byml::StringIndex::Hit> hits = index->find(args[i]);
+    const double us = microsecondsSince(start);
+    for (const byml::StringIndex::Hit& hit : hits) {
+      const std::string_view path = index->getFile(hit.file).path;
+      const char* usage = hit.isKey ? (hit.isValue ? "key,value" : "key") : "value";
+      std::printf("%.*s\t%s\n", int(path.size()), path.data(), usage);
+    }
+    std::fprintf(stderr, "%s: %zu files (%.1f us)\n", args[i].c_str(), hits.size(), us);
+  }
+  return 0;
+}
+
+int prefix(const std::vector<std::string>& args) {
+  if (args.size() != 2) {
+    std::fputs(Usage, stderr);
+    return 1;
+  }
+  const auto index = openIndex(args[0]);
+  if (!index)
+    return 1;
+  for (const std::string_view string : index->findPrefix(args[1]))
+    std::printf("%.*s\n", int(string.size()), string.data());
+  return 0;
+}
+
+}  // end of anonymous namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::fputs(Usage, stderr);
+    return 1;
+  }
+  const std::string command = argv[1];
+  const std::vector<std::string> args(argv + 2, argv + argc);
+  if (command == "update")
+    return update(args);
+  if (command == "find")
+    return find(args);
+  if (command == "prefix")
+    return prefix(args);
+  if (command == "-h" || command == "--help") {
+    std::fputs(Usage, stdout);
+    return 0;
+  }
+  std::fprintf(stderr, "error: unknown command %s\n\n%s", command.c_str(), Usage);
+  return 1;
+}
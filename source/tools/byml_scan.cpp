@@ -0,0 +1,142 @@
+// Copyright 2018 leoetlino <leo@leolam.fr>
+// Licensed under GPLv2+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <byml/byml.h>
+#include <byml/query.h>
+#include <byml/scan.h>
+
+namespace {
+
+constexpr const char* Usage = R"(Usage: byml-scan [options] <path>...
+
+Scans BYML documents in directory trees (or files) on all cores and prints the paths of
+the documents that match all the given conditions. Without any condition, all valid
+documents are printed.
+
+Options:
+  -k, --key KEY       match documents that use KEY as a hash key
+  -s, --string STR    match documents that contain the string STR
+  -q, --query EXPR    match documents for which the path query EXPR (e.g. 'Objs[*].Links')
+                      has at least one match
+  -j, --threads N     number of worker threads (default: one per hardware thread)
+  -t, --timings       print the time spent on each file
+      --all-files     scan all files instead of only files with BYML extensions
+      --no-validate   use checked access instead of validating documents
+  -h, --help          show this help
+)";
+
+const char* getStatusName(byml::ScanStatus status) {
+  switch (status) {
+  case byml::ScanStatus::Ok:
+    return "ok";
+  case byml::ScanStatus::OpenFailed:
+    return "failed to open";
+  case byml::ScanStatus::Invalid:
+    return "invalid document";
+  case byml::ScanStatus::VisitFailed:
+    return "failed to read";
+  }
+  return "?";
+}
+
+}  // end of anonymous namespace
+
+int main(int argc, char** argv) {
+  std::vector<std::string> roots;
+  std::vector<std::string> keys;
+  std::vector<std::string> strings;
+  std::vector<byml::Query> queries;
+  byml::ScanOptions options;
+  bool printTimings = false;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const auto nextArg = [&]() -> const char* {
+      if (i + 1 >= argc) {
+        std::fprintf(stderr, "error: missing value for %s\n", arg.c_str());
+        std::exit(1);
+      }
+      return argv[++i];
+    };
+    if (arg == "-k" || arg == "--key") {
+      keys.emplace_back(nextArg());
+    } else if (arg == "-s" || arg == "--string") {
+      strings.emplace_back(nextArg());
+    } else if (arg == "-q" || arg == "--query") {
+      auto query = byml::Query::compile(nextArg());
+      if (!query) {
+        std::fprintf(stderr, "error: invalid query %s\n", argv[i]);
+        return 1;
+      }
+      queries.push_back(std::move(*query));
+    } else if (arg == "-j" || arg == "--threads") {
+      options.numThreads = static_cast<unsigned>(std::strtoul(nextArg(), nullptr, 10));
+    } else if (arg == "-t" || arg == "--timings") {
+      printTimings = true;
+    } else if (arg == "--all-files") {
+      options.extensions.clear();
+    } else if (arg == "--no-validate") {
+      options.validate = false;
+    } else if (arg == "-h" || arg == "--help") {
+      std::fputs(Usage, stdout);
+      return 0;
+    } else if (!arg.empty() && arg[0] == '-') {
+      std::fprintf(stderr, "error: unknown option %s\n\n%s", arg.c_str(), Usage);
+      return 1;
+    } else {
+      roots.push_back(arg);
+    }
+  }
+  if (roots.empty()) {
+    std::fputs(Usage, stderr);
+    return 1;
+  }
+
+  std::vector<std::string> paths;
+  for (const std::string& root : roots) {
+    auto rootPaths = byml::findFiles(root, options);
+    paths.insert(paths.end(), rootPaths.begin(), rootPaths.end());
+  }
+
+  // Each worker only writes to the entry of the file it is processing.
+  std::vector<char> matches(paths.size());
+  const auto report = byml::scanFiles(
+      paths,
+      [&](size_t index, const byml::Reader& reader) {
+        bool match = true;
+        for (const std::string& key : keys)
+          match = match && reader.findKey(key.c_str()).has_value();
+        for (const std::string& string : strings)
+          match = match && reader.findString(string.c_str()).has_value();
+        for (const byml::Query& query : queries)
+          match = match && query.findFirst(reader).has_value();
+        matches[index] = match;
+        return true;
+      },
+      options);
+
+  for (size_t i = 0; i < report.files.size(); ++i) {
+    const byml::ScanFileReport& file = report.files[i];
+    if (file.status != byml::ScanStatus::Ok)
+      std::fprintf(stderr, "error: %s: %s\n", file.path.c_str(), getStatusName(file.status));
+    else if (matches[i])
+      std::printf("%s\n", file.path.c_str());
+    if (printTimings) {
+      std::fprintf(stderr, "%10.3f ms %12llu bytes  %s\n", file.seconds * 1000,
+                   static_cast<unsigned long long>(file.size), file.path.c_str());
+    }
+  }
+
+  std::fprintf(stderr, "%zu files (%.1f MiB) in %.3f s: %.1f MiB/s, %zu failed\n",
+               report.files.size(), report.totalSize() / 1048576.0, report.seconds,
+               report.throughput() / 1048576.0, report.numFailed());
+  return report.numFailed() == 0 ? 0 : 2;
+}